@@ -0,0 +1,194 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "diagnostics.h"
+#include "display-backend.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host-sim.h"
+#include "task-power.h"
+#include "task-wifi.h"
+#include "tracer.h"
+
+// Runs app_main() under the FreeRTOS POSIX port for a fixed time, cycling the
+// screens with simulated button presses, then prints per-task CPU usage and
+// the display's per-screen frame metrics and the memory diagnostics.  -T adds
+// the tail of the event trace, for tools/trace-to-chrome.  -P renders through
+// the emulated ST7789 instead of the headless framebuffer, reports its bus
+// traffic and checks the panel against what LVGL drew.  -F hands flushes to
+// the separate flush task like the board's pipelined mode.  -H diffs frames
+// on every screen and checks the tile hashes for collisions.  The power
+// governor's residency is printed against the elapsed clock; with -p 0 and
+// -t past its sleep timeout the board walks through every power state.
+
+#define BUTTON2 GPIO_NUM_0
+
+void app_main(void);
+
+typedef struct host_options {
+    int run_seconds;
+    int press_interval_ms;
+    int press_duration_ms;
+    bool coalescing;
+    bool solid_fill;
+    bool trace;
+    bool panel;
+    bool pipelined;
+    bool frame_diff;
+    uint32_t spi_hz;
+} host_options_t;
+
+static const char *tag = "host";
+
+static void main_task(void *param) {
+    (void)param;
+    app_main();
+    vTaskDelete(NULL);
+}
+
+static void print_run_time_stats(void) {
+    char *stats = calloc(uxTaskGetNumberOfTasks(), 64);
+    if (stats == NULL) {
+        return;
+    }
+    vTaskGetRunTimeStats(stats);
+    printf("Task            Time(us)        %%CPU\n%s", stats);
+    free(stats);
+}
+
+static void print_panel_stats(void) {
+    host_st7789_stats_t st;
+    host_st7789_get_stats(&st);
+    printf("panel: %" PRIu32 " transactions, %" PRIu32 " windows, %" PRIu64
+           " command/%" PRIu64 " parameter/%" PRIu64 " pixel bytes, "
+           "%" PRIu64 "us on the bus, %" PRIu32 " errors\n",
+           st.transactions, st.windows, st.command_bytes, st.param_bytes,
+           st.pixel_bytes, st.bus_ns / 1000, st.errors);
+    printf("panel: %" PRIu32 " pixels differ from LVGL's framebuffer\n",
+           host_st7789_mismatches(display_headless_framebuffer()));
+}
+
+// Residency should add up to the elapsed esp_timer time power_dump() shows
+static void print_power_stats(void) {
+    power_dump();
+    printf("power: cpu at %" PRIu32 "MHz, backlight duty %" PRIu32 "\n",
+           host_pm_cpu_freq_mhz(), host_ledc_get_duty(LEDC_CHANNEL_0));
+}
+
+static void stimulus_task(void *param) {
+    host_options_t *opts = param;
+    int64_t end = esp_timer_get_time() + opts->run_seconds * 1000000LL;
+
+    // Let app_main bring everything up before pressing anything
+    vTaskDelay(pdMS_TO_TICKS(500));
+
+    while (esp_timer_get_time() < end) {
+        if (opts->press_interval_ms > 0) {
+            host_gpio_set_input(BUTTON2, 0);
+            vTaskDelay(pdMS_TO_TICKS(opts->press_duration_ms));
+            host_gpio_set_input(BUTTON2, 1);
+            vTaskDelay(pdMS_TO_TICKS(opts->press_interval_ms));
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+    }
+
+    ESP_LOGI(tag, "Ran for %ds", opts->run_seconds);
+    print_run_time_stats();
+    display_backend_log_metrics();
+    if (opts->panel) {
+        print_panel_stats();
+    }
+    print_power_stats();
+    wifi_dump();
+    diag_dump();
+    if (opts->trace) {
+        tracer_dump();
+    }
+    fflush(stdout);
+    exit(0);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-t seconds] [-p press_interval_ms] "
+            "[-d press_duration_ms] [-C (no flush coalescing)] "
+            "[-S (no solid fill)] [-T (dump the event trace)] "
+            "[-P (emulated panel)] [-s spi_mhz] [-F (pipelined flush)] "
+            "[-H (frame diff on every screen)]\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    static host_options_t opts = {
+        .run_seconds = 10,
+        .press_interval_ms = 2000,
+        .press_duration_ms = 150,
+        .coalescing = true,
+        .solid_fill = true,
+        .spi_hz = 40 * 1000 * 1000};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:p:d:CSTPs:FHh")) != -1) {
+        switch (opt) {
+            case 't':
+                opts.run_seconds = atoi(optarg);
+                break;
+            case 'p':
+                opts.press_interval_ms = atoi(optarg);
+                break;
+            case 'd':
+                opts.press_duration_ms = atoi(optarg);
+                break;
+            case 'C':
+                opts.coalescing = false;
+                break;
+            case 'S':
+                opts.solid_fill = false;
+                break;
+            case 'T':
+                opts.trace = true;
+                break;
+            case 'P':
+                opts.panel = true;
+                break;
+            case 's':
+                opts.spi_hz = atof(optarg) * 1000 * 1000;
+                break;
+            case 'F':
+                opts.pipelined = true;
+                break;
+            case 'H':
+                opts.frame_diff = true;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    display_backend_set_coalescing(opts.coalescing);
+    display_backend_set_solid_fill(opts.solid_fill);
+    // One core on the host, so this checks the handoff rather than the gain
+    display_backend_set_pipelined(opts.pipelined);
+    if (opts.frame_diff) {
+        display_backend_force_frame_diff(true);
+    }
+    if (opts.panel) {
+        display_backend_set_default(&st7789_backend);
+        display_backend_set_mirror(true);
+        host_st7789_set_spi_clock(opts.spi_hz);
+    }
+
+    // IDF's main task: 3584 byte stack, priority 1
+    xTaskCreate(&main_task, "main", 3584, NULL, 1, NULL);
+    xTaskCreate(&stimulus_task, "host_stimulus", 4096, &opts,
+                configMAX_PRIORITIES - 2, NULL);
+
+    vTaskStartScheduler();
+    return 0;
+}
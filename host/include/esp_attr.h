@@ -0,0 +1,8 @@
+#pragma once
+
+// There's no IRAM/DRAM split on the host.
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define DMA_ATTR
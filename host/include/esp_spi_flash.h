@@ -0,0 +1,4 @@
+#pragma once
+
+// Nothing in main/ uses the flash API directly yet.
+#include "esp_err.h"
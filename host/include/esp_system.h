@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "esp_attr.h"
+#include "esp_err.h"
+
+#define ESP_INTR_FLAG_LEVEL1 (1 << 1)
+#define ESP_INTR_FLAG_IRAM (1 << 10)
+#define ESP_INTR_FLAG_EDGE (1 << 9)
+
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+uint32_t esp_random(void);
+void esp_restart(void) __attribute__((noreturn));
@@ -0,0 +1,28 @@
+#pragma once
+
+// ESP-IDF ships the kernel headers under freertos/, the upstream kernel
+// doesn't.  Pull in the real header from the kernel include path and paper
+// over the handful of IDF-only extensions main/ relies on.
+#include <FreeRTOS.h>
+
+#include "esp_attr.h"
+
+#ifndef portNUM_PROCESSORS
+#define portNUM_PROCESSORS 1
+#endif
+
+// IDF's portYIELD_FROM_ISR takes no arguments, the POSIX port's takes one.
+#undef portYIELD_FROM_ISR
+#define portYIELD_FROM_ISR(...) portYIELD()
+
+#define xPortGetCoreID() 0
+
+// IDF's critical sections take a spinlock for the other core.
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#undef portENTER_CRITICAL
+#undef portEXIT_CRITICAL
+#define portENTER_CRITICAL(mux) vPortEnterCritical()
+#define portEXIT_CRITICAL(mux) vPortExitCritical()
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical()
+#define portEXIT_CRITICAL_ISR(mux) vPortExitCritical()
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#include <semphr.h>
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#include <task.h>
+
+// There's only one core on the host, so the affinity is dropped.
+#define xTaskCreatePinnedToCore(fn, name, stack, param, prio, handle, core) \
+    xTaskCreate(fn, name, stack, param, prio, handle)
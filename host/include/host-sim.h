@@ -0,0 +1,62 @@
+#pragma once
+
+// Controls for the host stand-ins.  None of this exists on the board; it's
+// how the host build drives the inputs the hardware would normally provide.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driver/adc.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "lvgl/lvgl.h"
+
+// Drive an input pin.  If the level changes and an ISR is attached with a
+// matching interrupt type, the ISR runs in the caller's context.
+void host_gpio_set_input(gpio_num_t gpio_num, int level);
+// Last level main/ wrote to an output pin.
+int host_gpio_get_output(gpio_num_t gpio_num);
+// Whether a pin armed with gpio_wakeup_enable() is at its wake level.
+bool host_gpio_wake_pending(void);
+
+// Raw ADC value returned by adc1_get_raw(), +/- up to noise counts.
+void host_adc_set_raw(adc1_channel_t channel, int raw, int noise);
+
+// Whether esp_wifi_connect() finds the AP and how long it takes.
+void host_wifi_set_ap_present(bool present, int64_t connect_time_us);
+
+uint32_t host_run_time_counter(void);
+
+// The clock esp_pm would have the CPU at: max_freq_mhz while any
+// ESP_PM_CPU_FREQ_MAX lock is held, min_freq_mhz otherwise.
+uint32_t host_pm_cpu_freq_mhz(void);
+// Duty an LEDC channel was last set or faded to.  Fades land at once.
+uint32_t host_ledc_get_duty(ledc_channel_t channel);
+
+// Detach esp_timer_get_time() from the real clock.  While virtual, time only
+// moves when host_clock_set() moves it forward; it starts from the current
+// real time.
+void host_clock_set_virtual(bool enable);
+void host_clock_set(int64_t now_us);
+
+// The emulated ST7789 behind st7789_backend.  Bus time is what the SPI
+// transactions would take at clock_hz (40MHz unless set), plus a fixed 10us
+// each for CS, DC and queueing.
+typedef struct host_st7789_stats {
+    uint32_t transactions;
+    uint32_t windows; // RAMWR commands
+    uint64_t command_bytes;
+    uint64_t param_bytes;
+    uint64_t pixel_bytes;
+    uint64_t bus_ns;
+    uint32_t errors; // Unknown commands, writes off GRAM or while asleep
+} host_st7789_stats_t;
+
+void host_st7789_set_spi_clock(uint32_t clock_hz);
+void host_st7789_get_stats(host_st7789_stats_t *stats);
+// RGB565 on the glass where an LVGL coordinate should be for
+// CONFIG_LV_DISPLAY_ORIENTATION
+uint16_t host_st7789_pixel(lv_coord_t x, lv_coord_t y);
+// Pixels on the panel that differ from an LV_HOR_RES_MAX x LV_VER_RES_MAX
+// framebuffer, e.g. display_headless_framebuffer() while mirroring
+uint32_t host_st7789_mismatches(const lv_color_t *fb);
@@ -0,0 +1,52 @@
+#pragma once
+
+// LVGL configuration for the host build, matching what lv_port_esp32
+// generates from the board's sdkconfig: a 135x240 (portrait) ST7789 in RGB565
+// with the bytes swapped for SPI, the empty theme with Montserrat 12, and a
+// 32 KB LVGL heap.  Anything not set here takes LVGL's default.
+
+#include <stdint.h>
+
+#define LV_HOR_RES_MAX 135
+#define LV_VER_RES_MAX 240
+
+#define LV_COLOR_DEPTH 16
+#define LV_COLOR_16_SWAP 1
+#define LV_COLOR_SCREEN_TRANSP 0
+
+#define LV_ANTIALIAS 1
+#define LV_DISP_DEF_REFR_PERIOD 30
+#define LV_INDEV_DEF_READ_PERIOD 30
+#define LV_DPI 130
+
+#define LV_MEM_CUSTOM 0
+#define LV_MEM_SIZE (32U * 1024U)
+
+#define LV_TICK_CUSTOM 0
+
+#define LV_USE_LOG 0
+#define LV_USE_DEBUG 1
+#define LV_USE_ASSERT_NULL 1
+#define LV_USE_ASSERT_MEM 1
+#define LV_USE_PERF_MONITOR 0
+#define LV_USE_GPU 1
+#define LV_USE_FILESYSTEM 0
+#define LV_USE_USER_DATA 1
+
+#define LV_FONT_MONTSERRAT_12 1
+#define LV_FONT_MONTSERRAT_14 0
+#define LV_FONT_DEFAULT &lv_font_montserrat_12
+
+#define LV_USE_THEME_EMPTY 1
+#define LV_USE_THEME_TEMPLATE 0
+#define LV_USE_THEME_MATERIAL 0
+#define LV_USE_THEME_MONO 0
+#define LV_THEME_DEFAULT_INCLUDE <stdint.h>
+#define LV_THEME_DEFAULT_INIT lv_theme_empty_init
+#define LV_THEME_DEFAULT_COLOR_PRIMARY lv_color_hex(0x000000)
+#define LV_THEME_DEFAULT_COLOR_SECONDARY lv_color_hex(0x008000)
+#define LV_THEME_DEFAULT_FLAG 0
+#define LV_THEME_DEFAULT_FONT_SMALL &lv_font_montserrat_12
+#define LV_THEME_DEFAULT_FONT_NORMAL &lv_font_montserrat_12
+#define LV_THEME_DEFAULT_FONT_SUBTITLE &lv_font_montserrat_12
+#define LV_THEME_DEFAULT_FONT_TITLE &lv_font_montserrat_12
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "lvgl/lvgl.h"
+
+void lvgl_driver_init(void);
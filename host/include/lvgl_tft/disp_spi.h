@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Host stand-in for lvgl_esp32_drivers' SPI layer, feeding the emulated
+// ST7789.  Every send is done by the time it returns, whatever the flags,
+// so there's never anything pending, and DISP_SPI_SIGNAL_FLUSH calls
+// flush-ready straight away.  Reads, addresses and dummy bits aren't
+// supported.
+
+typedef enum _disp_spi_send_flag_t {
+    DISP_SPI_SEND_QUEUED = 0x00000000,
+    DISP_SPI_SEND_POLLING = 0x00000001,
+    DISP_SPI_SIGNAL_FLUSH = 0x00000004,
+} disp_spi_send_flag_t;
+
+void disp_spi_transaction(const uint8_t *data, size_t length,
+                          disp_spi_send_flag_t flags, uint8_t *out,
+                          uint64_t addr, uint8_t dummy_bits);
+void disp_wait_for_pending_transactions(void);
+
+static inline void disp_spi_send_data(uint8_t *data, size_t length) {
+    disp_spi_transaction(data, length, DISP_SPI_SEND_POLLING, NULL, 0, 0);
+}
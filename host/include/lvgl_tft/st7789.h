@@ -0,0 +1,38 @@
+#pragma once
+
+#include "lvgl/lvgl.h"
+#include "sdkconfig.h"
+
+// Host stand-in for lvgl_esp32_drivers' ST7789 driver.  Flushes go to an
+// emulated panel (see host-sim.h) and are acknowledged straight away.
+
+#define ST7789_DC CONFIG_LV_DISP_PIN_DC
+#define ST7789_RST CONFIG_LV_DISP_PIN_RST
+
+#define ST7789_SWRESET 0x01
+#define ST7789_SLPIN 0x10
+#define ST7789_SLPOUT 0x11
+#define ST7789_NORON 0x13
+#define ST7789_INVOFF 0x20
+#define ST7789_INVON 0x21
+#define ST7789_DISPOFF 0x28
+#define ST7789_DISPON 0x29
+#define ST7789_CASET 0x2A
+#define ST7789_RASET 0x2B
+#define ST7789_RAMWR 0x2C
+#define ST7789_MADCTL 0x36
+#define ST7789_COLMOD 0x3A
+#define ST7789_RAMWRC 0x3C
+#define ST7789_PORCTRL 0xB2
+#define ST7789_GCTRL 0xB7
+#define ST7789_VCOMS 0xBB
+#define ST7789_LCMCTRL 0xC0
+#define ST7789_VDVVRHEN 0xC2
+#define ST7789_VRHS 0xC3
+#define ST7789_VDVSET 0xC4
+#define ST7789_FRCTRL2 0xC6
+#define ST7789_PWCTRL1 0xD0
+
+void st7789_init(void);
+void st7789_flush(lv_disp_drv_t *drv, const lv_area_t *area,
+                  lv_color_t *color_map);
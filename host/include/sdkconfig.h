@@ -0,0 +1,19 @@
+#pragma once
+
+// The subset of the board's sdkconfig main/ reads, for the host build.
+
+#define CONFIG_IDF_TARGET_ESP32 1
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ 160
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+
+#define CONFIG_LV_DISPLAY_WIDTH 135
+#define CONFIG_LV_DISPLAY_HEIGHT 240
+#define CONFIG_LV_PREDEFINED_DISPLAY_TTGO 1
+#define CONFIG_LV_DISPLAY_ORIENTATION 1
+#define CONFIG_LV_TFT_DISPLAY_OFFSETS 1
+#define CONFIG_LV_TFT_DISPLAY_X_OFFSET 53
+#define CONFIG_LV_TFT_DISPLAY_Y_OFFSET 40
+#define CONFIG_LV_DISP_PIN_DC 16
+#define CONFIG_LV_DISP_PIN_RST 23
+#define CONFIG_LV_DISP_PIN_BCKL 4
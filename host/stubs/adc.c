@@ -0,0 +1,78 @@
+#include <stdlib.h>
+
+#include "driver/adc.h"
+#include "esp_adc_cal.h"
+#include "host-sim.h"
+
+// Linear stand-in for the IDF's ADC characterization, with the same scale
+// IDF uses for its coefficients.
+#define LIN_COEFF_A_SCALE 65536
+#define HOST_COEFF_A 49612 // ~3100mV full scale at 11dB
+#define HOST_COEFF_B 142
+
+typedef struct host_adc_channel {
+    adc_atten_t atten;
+    int raw;
+    int noise;
+} host_adc_channel_t;
+
+// ~3.9V battery through the board's /2 divider
+static host_adc_channel_t channels[ADC1_CHANNEL_MAX] = {
+    [ADC1_CHANNEL_6] = {.raw = 2388, .noise = 8},
+};
+static adc_bits_width_t width = ADC_WIDTH_BIT_12;
+
+esp_err_t adc1_config_width(adc_bits_width_t width_bit) {
+    width = width_bit;
+    return ESP_OK;
+}
+
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten) {
+    if (channel >= ADC1_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+    channels[channel].atten = atten;
+    return ESP_OK;
+}
+
+int adc1_get_raw(adc1_channel_t channel) {
+    if (channel >= ADC1_CHANNEL_MAX) return -1;
+
+    host_adc_channel_t *chan = &channels[channel];
+    int raw = chan->raw;
+    if (chan->noise > 0) {
+        raw += (rand() % (2 * chan->noise + 1)) - chan->noise;
+    }
+
+    int max = (1 << (9 + width)) - 1;
+    if (raw < 0) raw = 0;
+    if (raw > max) raw = max;
+    return raw;
+}
+
+esp_adc_cal_value_t esp_adc_cal_characterize(
+    adc_unit_t adc_num, adc_atten_t atten, adc_bits_width_t bit_width,
+    uint32_t default_vref, esp_adc_cal_characteristics_t *chars) {
+    chars->adc_num = adc_num;
+    chars->atten = atten;
+    chars->bit_width = bit_width;
+    chars->vref = default_vref;
+    chars->coeff_a = HOST_COEFF_A;
+    chars->coeff_b = HOST_COEFF_B;
+    chars->low_curve = NULL;
+    chars->high_curve = NULL;
+    return ESP_ADC_CAL_VAL_DEFAULT_VREF;
+}
+
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t adc_reading,
+                                    const esp_adc_cal_characteristics_t *chars) {
+    // Readings are always scaled up to 12 bits before conversion
+    adc_reading <<= (ADC_WIDTH_BIT_12 - chars->bit_width);
+    return ((chars->coeff_a * adc_reading) + (LIN_COEFF_A_SCALE / 2)) /
+               LIN_COEFF_A_SCALE +
+           chars->coeff_b;
+}
+
+void host_adc_set_raw(adc1_channel_t channel, int raw, int noise) {
+    if (channel >= ADC1_CHANNEL_MAX) return;
+    channels[channel].raw = raw;
+    channels[channel].noise = noise;
+}
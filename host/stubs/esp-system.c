@@ -0,0 +1,90 @@
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+uint32_t esp_log_timestamp(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    (void)tag;
+    (void)level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) {
+    (void)level;
+    (void)tag;
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK:
+            return "ESP_OK";
+        case ESP_FAIL:
+            return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:
+            return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:
+            return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:
+            return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:
+            return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:
+            return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED:
+            return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:
+            return "ESP_ERR_TIMEOUT";
+    }
+    return "UNKNOWN ERROR";
+}
+
+// main/ allocates straight from libc, so heap figures are the board's
+// usable DRAM heap minus what malloc has handed out.
+#define HOST_HEAP_SIZE (280 * 1024)
+
+static uint32_t minimum_free = HOST_HEAP_SIZE;
+
+uint32_t esp_get_free_heap_size(void) {
+    struct mallinfo2 info = mallinfo2();
+    uint32_t used = info.uordblks;
+    uint32_t free_size = used < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - used : 0;
+    if (free_size < minimum_free) {
+        minimum_free = free_size;
+    }
+    return free_size;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    esp_get_free_heap_size();
+    return minimum_free;
+}
+
+// glibc can always grow the heap, so there's no fragmentation to report.
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    (void)caps;
+    return esp_get_free_heap_size();
+}
+
+uint32_t esp_random(void) { return (uint32_t)rand(); }
+
+void esp_restart(void) { exit(0); }
+
+void vAssertCalled(const char *file, unsigned long line) {
+    fprintf(stderr, "configASSERT failed at %s:%lu\n", file, line);
+    abort();
+}
@@ -0,0 +1,212 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host-sim.h"
+
+// IDF runs esp_timer callbacks from a dedicated high priority task, so does
+// this.  The task can only sleep in whole ticks, so a timer shorter than a
+// tick fires in bursts to catch up, exactly like it does on the board.
+
+struct esp_timer {
+    struct esp_timer *next;
+    esp_timer_cb_t callback;
+    void *arg;
+    const char *name;
+    int64_t alarm;
+    uint64_t period;
+    bool armed;
+};
+
+static const char *tag = "esp_timer";
+
+static struct esp_timer *timer_head;
+static TaskHandle_t timer_task;
+static struct timespec boot_time;
+static volatile bool virtual_clock;
+static volatile int64_t virtual_now;
+
+static int64_t real_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (boot_time.tv_sec == 0 && boot_time.tv_nsec == 0) {
+        boot_time = now;
+    }
+    return (int64_t)(now.tv_sec - boot_time.tv_sec) * 1000000LL +
+           (now.tv_nsec - boot_time.tv_nsec) / 1000;
+}
+
+int64_t esp_timer_get_time(void) {
+    if (virtual_clock) {
+        return virtual_now;
+    }
+    return real_time();
+}
+
+// Task run time is CPU time actually spent, so it always uses the real clock
+uint32_t host_run_time_counter(void) {
+    return (uint32_t)real_time();
+}
+
+void host_clock_set_virtual(bool enable) {
+    virtual_now = real_time();
+    virtual_clock = enable;
+}
+
+void host_clock_set(int64_t now_us) {
+    if (!virtual_clock || now_us <= virtual_now) {
+        return;
+    }
+    virtual_now = now_us;
+
+    // Let any timers that just came due run
+    if (timer_task != NULL) {
+        xTaskNotifyGive(timer_task);
+    }
+}
+
+static struct esp_timer *next_due(int64_t now, int64_t *next_alarm) {
+    struct esp_timer *due = NULL;
+    *next_alarm = INT64_MAX;
+
+    taskENTER_CRITICAL();
+    for (struct esp_timer *t = timer_head; t != NULL; t = t->next) {
+        if (!t->armed) {
+            continue;
+        }
+        if (t->alarm <= now && (due == NULL || t->alarm < due->alarm)) {
+            due = t;
+        }
+        if (t->alarm < *next_alarm) {
+            *next_alarm = t->alarm;
+        }
+    }
+
+    if (due != NULL) {
+        if (due->period) {
+            due->alarm += due->period;
+        } else {
+            due->armed = false;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return due;
+}
+
+static void esp_timer_task(void *param) {
+    (void)param;
+    while (true) {
+        int64_t next_alarm;
+        struct esp_timer *due;
+        while ((due = next_due(esp_timer_get_time(), &next_alarm)) != NULL) {
+            due->callback(due->arg);
+        }
+
+        TickType_t wait = portMAX_DELAY;
+        if (next_alarm != INT64_MAX) {
+            int64_t us = next_alarm - esp_timer_get_time();
+            int64_t tick_us = 1000000 / configTICK_RATE_HZ;
+            wait = us <= 0 ? 0 : (TickType_t)((us + tick_us - 1) / tick_us);
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args,
+                           esp_timer_handle_t *out_handle) {
+    if (create_args == NULL || create_args->callback == NULL ||
+        out_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (timer_task == NULL) {
+        BaseType_t ret = xTaskCreate(&esp_timer_task, tag, 4096, NULL,
+                                     configMAX_PRIORITIES - 3, &timer_task);
+        if (ret != pdTRUE) {
+            ESP_LOGE(tag, "Failed to create the esp_timer task");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    struct esp_timer *timer = calloc(1, sizeof(struct esp_timer));
+    if (timer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    timer->name = create_args->name;
+
+    taskENTER_CRITICAL();
+    timer->next = timer_head;
+    timer_head = timer;
+    taskEXIT_CRITICAL();
+
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t arm(esp_timer_handle_t timer, uint64_t timeout,
+                     uint64_t period) {
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (timer->armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    taskENTER_CRITICAL();
+    timer->alarm = esp_timer_get_time() + timeout;
+    timer->period = period;
+    timer->armed = true;
+    taskEXIT_CRITICAL();
+
+    xTaskNotifyGive(timer_task);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return arm(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    return arm(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!timer->armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (timer->armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    taskENTER_CRITICAL();
+    struct esp_timer **link = &timer_head;
+    while (*link != NULL && *link != timer) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        *link = timer->next;
+    }
+    taskEXIT_CRITICAL();
+
+    free(timer);
+    return ESP_OK;
+}
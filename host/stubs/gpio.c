@@ -0,0 +1,178 @@
+#include <string.h>
+
+#include "driver/gpio.h"
+#include "host-sim.h"
+
+typedef struct host_pin {
+    gpio_mode_t mode;
+    gpio_pull_mode_t pull;
+    gpio_int_type_t intr_type;
+    gpio_int_type_t wakeup_type; // GPIO_INTR_DISABLE when it can't wake
+    bool intr_enabled;
+    int level;
+    gpio_isr_t isr;
+    void *isr_arg;
+} host_pin_t;
+
+static host_pin_t pins[GPIO_NUM_MAX];
+static bool isr_service_installed;
+static bool pins_initialized;
+
+static host_pin_t *get_pin(gpio_num_t gpio_num) {
+    if (!pins_initialized) {
+        // Both buttons on the board have external pull-ups, so every input
+        // starts out high.
+        for (int i = 0; i < GPIO_NUM_MAX; i++) {
+            pins[i].level = 1;
+            pins[i].intr_enabled = true;
+        }
+        pins_initialized = true;
+    }
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) {
+        return NULL;
+    }
+    return &pins[gpio_num];
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return ESP_ERR_INVALID_ARG;
+    pin->mode = mode;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio_num, gpio_pull_mode_t pull) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return ESP_ERR_INVALID_ARG;
+    pin->pull = pull;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return ESP_ERR_INVALID_ARG;
+    pin->intr_type = intr_type;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return ESP_ERR_INVALID_ARG;
+    pin->intr_enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return ESP_ERR_INVALID_ARG;
+    pin->intr_enabled = false;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return ESP_ERR_INVALID_ARG;
+    pin->level = level ? 1 : 0;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return 0;
+    return pin->level;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags) {
+    (void)intr_alloc_flags;
+    if (isr_service_installed) return ESP_ERR_INVALID_STATE;
+    isr_service_installed = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler,
+                               void *args) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return ESP_ERR_INVALID_ARG;
+    if (!isr_service_installed) return ESP_ERR_INVALID_STATE;
+    pin->isr = isr_handler;
+    pin->isr_arg = args;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return ESP_ERR_INVALID_ARG;
+    pin->isr = NULL;
+    pin->isr_arg = NULL;
+    return ESP_OK;
+}
+
+// Like IDF, arming a wakeup also sets the pin's interrupt type
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return ESP_ERR_INVALID_ARG;
+    if (intr_type != GPIO_INTR_LOW_LEVEL && intr_type != GPIO_INTR_HIGH_LEVEL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pin->wakeup_type = intr_type;
+    pin->intr_type = intr_type;
+    return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return ESP_ERR_INVALID_ARG;
+    pin->wakeup_type = GPIO_INTR_DISABLE;
+    return ESP_OK;
+}
+
+bool host_gpio_wake_pending(void) {
+    for (int i = 0; i < GPIO_NUM_MAX; i++) {
+        host_pin_t *pin = get_pin(i);
+        if ((pin->wakeup_type == GPIO_INTR_HIGH_LEVEL && pin->level) ||
+            (pin->wakeup_type == GPIO_INTR_LOW_LEVEL && !pin->level)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void host_gpio_set_input(gpio_num_t gpio_num, int level) {
+    host_pin_t *pin = get_pin(gpio_num);
+    if (pin == NULL) return;
+
+    level = level ? 1 : 0;
+    if (pin->level == level) {
+        return;
+    }
+    pin->level = level;
+
+    if (pin->isr == NULL || !pin->intr_enabled) {
+        return;
+    }
+
+    bool fire = false;
+    switch (pin->intr_type) {
+        case GPIO_INTR_POSEDGE:
+        case GPIO_INTR_HIGH_LEVEL:
+            fire = level;
+            break;
+        case GPIO_INTR_NEGEDGE:
+        case GPIO_INTR_LOW_LEVEL:
+            fire = !level;
+            break;
+        case GPIO_INTR_ANYEDGE:
+            fire = true;
+            break;
+        case GPIO_INTR_DISABLE:
+            break;
+    }
+
+    if (fire) {
+        pin->isr(pin->isr_arg);
+    }
+}
+
+int host_gpio_get_output(gpio_num_t gpio_num) {
+    return gpio_get_level(gpio_num);
+}
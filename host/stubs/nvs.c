@@ -0,0 +1,113 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "nvs_flash.h"
+
+// RAM-backed NVS.  Contents don't survive the process, which is what a freshly
+// erased board looks like.
+
+#define HOST_NVS_ENTRIES 32
+#define HOST_NVS_NAMESPACES 8
+#define HOST_NVS_KEY_LEN 16
+#define HOST_NVS_BLOB_LEN 2048
+
+typedef struct host_nvs_entry {
+    nvs_handle_t ns;
+    char key[HOST_NVS_KEY_LEN];
+    size_t length;
+    uint8_t value[HOST_NVS_BLOB_LEN];
+} host_nvs_entry_t;
+
+static bool initialized;
+static char namespaces[HOST_NVS_NAMESPACES][HOST_NVS_KEY_LEN];
+static host_nvs_entry_t entries[HOST_NVS_ENTRIES];
+
+esp_err_t nvs_flash_init(void) {
+    initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    memset(namespaces, 0, sizeof(namespaces));
+    memset(entries, 0, sizeof(entries));
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode,
+                   nvs_handle_t *out_handle) {
+    (void)open_mode;
+    if (!initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+    if (strlen(name) >= HOST_NVS_KEY_LEN) return ESP_ERR_INVALID_ARG;
+
+    for (int i = 0; i < HOST_NVS_NAMESPACES; i++) {
+        if (namespaces[i][0] == '\0') {
+            strcpy(namespaces[i], name);
+        }
+        if (strcmp(namespaces[i], name) == 0) {
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle) { (void)handle; }
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    (void)handle;
+    return ESP_OK;
+}
+
+static host_nvs_entry_t *find_entry(nvs_handle_t handle, const char *key,
+                                    bool create) {
+    host_nvs_entry_t *free_entry = NULL;
+    for (int i = 0; i < HOST_NVS_ENTRIES; i++) {
+        if (entries[i].ns == handle && strcmp(entries[i].key, key) == 0) {
+            return &entries[i];
+        }
+        if (entries[i].ns == 0 && free_entry == NULL) {
+            free_entry = &entries[i];
+        }
+    }
+    if (create && free_entry != NULL) {
+        free_entry->ns = handle;
+        strncpy(free_entry->key, key, HOST_NVS_KEY_LEN - 1);
+        return free_entry;
+    }
+    return NULL;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value,
+                       size_t *length) {
+    host_nvs_entry_t *entry = find_entry(handle, key, false);
+    if (entry == NULL) return ESP_ERR_NVS_NOT_FOUND;
+
+    if (out_value == NULL) {
+        *length = entry->length;
+        return ESP_OK;
+    }
+    if (*length < entry->length) return ESP_ERR_INVALID_SIZE;
+
+    memcpy(out_value, entry->value, entry->length);
+    *length = entry->length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value,
+                       size_t length) {
+    if (length > HOST_NVS_BLOB_LEN) return ESP_ERR_INVALID_SIZE;
+
+    host_nvs_entry_t *entry = find_entry(handle, key, true);
+    if (entry == NULL) return ESP_ERR_NO_MEM;
+
+    memcpy(entry->value, value, length);
+    entry->length = length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    host_nvs_entry_t *entry = find_entry(handle, key, false);
+    if (entry == NULL) return ESP_ERR_NVS_NOT_FOUND;
+    memset(entry, 0, sizeof(host_nvs_entry_t));
+    return ESP_OK;
+}
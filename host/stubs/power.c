@@ -0,0 +1,166 @@
+#include <stdlib.h>
+
+#include "driver/ledc.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host-sim.h"
+#include "sdkconfig.h"
+
+// Frequency scaling, light sleep and the LEDC, as far as main/ can see them.
+// Nothing here changes how fast the host runs.  Light sleep only stops the
+// task that asked for it: it waits out the timer wakeup, checking each tick
+// for a wake pin, while every other task carries on.
+
+struct esp_pm_lock {
+    esp_pm_lock_type_t type;
+    const char *name;
+    int count;
+};
+
+static esp_pm_config_esp32_t pm_config = {
+    .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+    .min_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ};
+static int cpu_max_locks;
+
+static uint64_t timer_wakeup_us;
+static bool gpio_wakeup;
+static esp_sleep_wakeup_cause_t wakeup_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+
+static uint32_t ledc_duty[LEDC_CHANNEL_MAX];
+
+esp_err_t esp_pm_configure(const void *config) {
+    const esp_pm_config_esp32_t *cfg = config;
+    if (cfg == NULL || cfg->min_freq_mhz > cfg->max_freq_mhz) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pm_config = *cfg;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg,
+                             const char *name,
+                             esp_pm_lock_handle_t *out_handle) {
+    (void)arg;
+    struct esp_pm_lock *lock = calloc(1, sizeof(struct esp_pm_lock));
+    if (lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    lock->type = lock_type;
+    lock->name = name;
+    *out_handle = lock;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle) {
+    if (handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    taskENTER_CRITICAL();
+    if (handle->count++ == 0 && handle->type == ESP_PM_CPU_FREQ_MAX) {
+        cpu_max_locks++;
+    }
+    taskEXIT_CRITICAL();
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle) {
+    if (handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->count == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    taskENTER_CRITICAL();
+    if (--handle->count == 0 && handle->type == ESP_PM_CPU_FREQ_MAX) {
+        cpu_max_locks--;
+    }
+    taskEXIT_CRITICAL();
+    return ESP_OK;
+}
+
+uint32_t host_pm_cpu_freq_mhz(void) {
+    return cpu_max_locks > 0 ? pm_config.max_freq_mhz
+                             : pm_config.min_freq_mhz;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us) {
+    timer_wakeup_us = time_in_us;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup(void) {
+    gpio_wakeup = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_light_sleep_start(void) {
+    int64_t tick_us = 1000000 / configTICK_RATE_HZ;
+    TickType_t ticks = (timer_wakeup_us + tick_us - 1) / tick_us;
+
+    wakeup_cause = ESP_SLEEP_WAKEUP_TIMER;
+    for (TickType_t t = 0; timer_wakeup_us == 0 || t < ticks; t++) {
+        if (gpio_wakeup && host_gpio_wake_pending()) {
+            wakeup_cause = ESP_SLEEP_WAKEUP_GPIO;
+            break;
+        }
+        vTaskDelay(1);
+    }
+    return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void) {
+    return wakeup_cause;
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf) {
+    if (timer_conf == NULL || timer_conf->timer_num >= LEDC_TIMER_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf) {
+    if (ledc_conf == NULL || ledc_conf->channel >= LEDC_CHANNEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_duty[ledc_conf->channel] = ledc_conf->duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags) {
+    (void)intr_alloc_flags;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty_and_update(ledc_mode_t speed_mode,
+                                   ledc_channel_t channel, uint32_t duty,
+                                   uint32_t hpoint) {
+    (void)speed_mode;
+    (void)hpoint;
+    if (channel >= LEDC_CHANNEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_duty[channel] = duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_fade_time_and_start(ledc_mode_t speed_mode,
+                                       ledc_channel_t channel,
+                                       uint32_t target_duty,
+                                       uint32_t max_fade_time_ms,
+                                       ledc_fade_mode_t fade_mode) {
+    (void)max_fade_time_ms;
+    (void)fade_mode;
+    return ledc_set_duty_and_update(speed_mode, channel, target_duty, 0);
+}
+
+uint32_t ledc_get_duty(ledc_mode_t speed_mode, ledc_channel_t channel) {
+    (void)speed_mode;
+    return channel < LEDC_CHANNEL_MAX ? ledc_duty[channel] : 0;
+}
+
+uint32_t host_ledc_get_duty(ledc_channel_t channel) {
+    return ledc_get_duty(LEDC_LOW_SPEED_MODE, channel);
+}
@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "host-sim.h"
+#include "lvgl_helpers.h"
+#include "lvgl_tft/disp_spi.h"
+#include "lvgl_tft/st7789.h"
+#include "sdkconfig.h"
+
+// Host stand-in for lvgl_esp32_drivers' ST7789 driver, talking to an
+// emulated panel.  The driver half sends the same command stream the real
+// one does, each command or data block its own SPI transaction with the DC
+// pin set first.  The panel half decodes it into a GRAM and keeps count of
+// what went over the wire and how long it would have taken.
+
+#define MADCTL_MY 0x80
+#define MADCTL_MX 0x40
+#define MADCTL_MV 0x20
+
+#define COLMOD_16BIT 0x55
+
+// st7789_set_orientation()'s table in lvgl_esp32_drivers, indexed by
+// CONFIG_LV_DISPLAY_ORIENTATION: portrait, portrait inverted, landscape,
+// landscape inverted
+static const uint8_t orientation_madctl[] = {
+#if CONFIG_LV_PREDEFINED_DISPLAY_TTGO
+    0x00, MADCTL_MX | MADCTL_MY, MADCTL_MX | MADCTL_MV, MADCTL_MY | MADCTL_MV
+#else
+    MADCTL_MX | MADCTL_MY, 0x00, MADCTL_MX | MADCTL_MV, MADCTL_MY | MADCTL_MV
+#endif
+};
+
+// The controller's memory, whatever part of it the glass shows
+#define GRAM_WIDTH 240
+#define GRAM_HEIGHT 320
+
+// The T-Display's 135x240 glass, in GRAM with MADCTL 0.  Fixed by how the
+// panel is built, so it doesn't move with the orientation or offsets set in
+// sdkconfig and host_st7789_pixel() can check them.
+#define GLASS_X 52
+#define GLASS_Y 40
+#define GLASS_WIDTH 135
+#define GLASS_HEIGHT 240
+
+#if CONFIG_LV_TFT_DISPLAY_OFFSETS
+#define X_OFFSET CONFIG_LV_TFT_DISPLAY_X_OFFSET
+#define Y_OFFSET CONFIG_LV_TFT_DISPLAY_Y_OFFSET
+#else
+#define X_OFFSET 0
+#define Y_OFFSET 0
+#endif
+
+// SPI_TFT_CLOCK_SPEED_HZ in lvgl_esp32_drivers
+#define DEFAULT_SPI_CLOCK_HZ (40 * 1000 * 1000)
+// CS setup, the DC switch and queueing the transaction on the board
+#define TRANSACTION_NS 10000
+
+typedef struct panel {
+    uint16_t gram[GRAM_WIDTH * GRAM_HEIGHT];
+    uint8_t madctl;
+    uint8_t colmod;
+    bool sleeping;
+    bool display_on;
+
+    uint16_t xs, xe, ys, ye;
+    uint16_t col, row;
+
+    uint8_t cmd;
+    uint8_t param[4];
+    uint8_t param_cnt;
+    uint8_t pixel_hi;
+    bool have_hi;
+
+    uint32_t clock_hz;
+    host_st7789_stats_t stats;
+} panel_t;
+
+static const char *tag = "st7789";
+
+static panel_t panel = {.clock_hz = DEFAULT_SPI_CLOCK_HZ};
+
+static void panel_reset(void) {
+    panel.madctl = 0;
+    panel.colmod = 0;
+    panel.sleeping = true;
+    panel.display_on = false;
+    panel.xs = panel.ys = 0;
+    panel.xe = GRAM_WIDTH - 1;
+    panel.ye = GRAM_HEIGHT - 1;
+    panel.cmd = 0;
+}
+
+// Window coordinates are in the orientation MADCTL selects, GRAM isn't
+static int32_t gram_index(uint16_t col, uint16_t row) {
+    uint16_t x = col, y = row;
+    if (panel.madctl & MADCTL_MV) {
+        x = row;
+        y = col;
+    }
+    if (x >= GRAM_WIDTH || y >= GRAM_HEIGHT) {
+        return -1;
+    }
+    if (panel.madctl & MADCTL_MX) {
+        x = GRAM_WIDTH - 1 - x;
+    }
+    if (panel.madctl & MADCTL_MY) {
+        y = GRAM_HEIGHT - 1 - y;
+    }
+    return y * GRAM_WIDTH + x;
+}
+
+static void panel_pixel(uint16_t color) {
+    int32_t index = gram_index(panel.col, panel.row);
+    if (index < 0) {
+        panel.stats.errors++;
+    } else {
+        panel.gram[index] = color;
+    }
+
+    // Past the end of a row goes to the start of the next, past the end of
+    // the window back to its start
+    if (panel.col++ >= panel.xe) {
+        panel.col = panel.xs;
+        if (panel.row++ >= panel.ye) {
+            panel.row = panel.ys;
+        }
+    }
+}
+
+static void panel_command(uint8_t cmd) {
+    panel.cmd = cmd;
+    panel.param_cnt = 0;
+    panel.have_hi = false;
+    panel.stats.command_bytes++;
+
+    switch (cmd) {
+        case ST7789_SWRESET:
+            panel_reset();
+            break;
+        case ST7789_SLPIN:
+            panel.sleeping = true;
+            break;
+        case ST7789_SLPOUT:
+            panel.sleeping = false;
+            break;
+        case ST7789_DISPOFF:
+            panel.display_on = false;
+            break;
+        case ST7789_DISPON:
+            panel.display_on = true;
+            break;
+        case ST7789_RAMWR:
+            panel.col = panel.xs;
+            panel.row = panel.ys;
+            panel.stats.windows++;
+            // fall through
+        case ST7789_RAMWRC:
+            if (panel.sleeping || panel.colmod != COLMOD_16BIT) {
+                ESP_LOGW(tag, "Memory write while asleep or not in RGB565");
+                panel.stats.errors++;
+            }
+            break;
+        case ST7789_NORON:
+        case ST7789_INVOFF:
+        case ST7789_INVON:
+        case ST7789_CASET:
+        case ST7789_RASET:
+        case ST7789_MADCTL:
+        case ST7789_COLMOD:
+        case ST7789_PORCTRL:
+        case ST7789_GCTRL:
+        case ST7789_VCOMS:
+        case ST7789_LCMCTRL:
+        case ST7789_VDVVRHEN:
+        case ST7789_VRHS:
+        case ST7789_VDVSET:
+        case ST7789_FRCTRL2:
+        case ST7789_PWCTRL1:
+            break;
+        default:
+            ESP_LOGW(tag, "Unknown command 0x%02x", cmd);
+            panel.stats.errors++;
+            break;
+    }
+}
+
+static void panel_data(uint8_t byte) {
+    if (panel.cmd == ST7789_RAMWR || panel.cmd == ST7789_RAMWRC) {
+        panel.stats.pixel_bytes++;
+        // RGB565 goes high byte first
+        if (!panel.have_hi) {
+            panel.pixel_hi = byte;
+            panel.have_hi = true;
+        } else {
+            panel_pixel(panel.pixel_hi << 8 | byte);
+            panel.have_hi = false;
+        }
+        return;
+    }
+
+    panel.stats.param_bytes++;
+    if (panel.param_cnt < sizeof(panel.param)) {
+        panel.param[panel.param_cnt] = byte;
+    }
+    panel.param_cnt++;
+
+    switch (panel.cmd) {
+        case ST7789_CASET:
+            if (panel.param_cnt == 4) {
+                panel.xs = panel.param[0] << 8 | panel.param[1];
+                panel.xe = panel.param[2] << 8 | panel.param[3];
+            }
+            break;
+        case ST7789_RASET:
+            if (panel.param_cnt == 4) {
+                panel.ys = panel.param[0] << 8 | panel.param[1];
+                panel.ye = panel.param[2] << 8 | panel.param[3];
+            }
+            break;
+        case ST7789_MADCTL:
+            panel.madctl = byte;
+            break;
+        case ST7789_COLMOD:
+            panel.colmod = byte;
+            break;
+    }
+}
+
+// One SPI transaction, the panel samples DC for all of it
+void disp_spi_transaction(const uint8_t *data, size_t length,
+                          disp_spi_send_flag_t flags, uint8_t *out,
+                          uint64_t addr, uint8_t dummy_bits) {
+    bool dc = host_gpio_get_output(ST7789_DC);
+    for (size_t i = 0; i < length; i++) {
+        if (dc) {
+            panel_data(data[i]);
+        } else {
+            panel_command(data[i]);
+        }
+    }
+
+    panel.stats.transactions++;
+    panel.stats.bus_ns += TRANSACTION_NS +
+                          (uint64_t)length * 8 * 1000000000ULL / panel.clock_hz;
+
+    // The driver signals whichever display is refreshing; there's only one
+    if (flags & DISP_SPI_SIGNAL_FLUSH) {
+        lv_disp_flush_ready(&lv_disp_get_default()->driver);
+    }
+}
+
+void disp_wait_for_pending_transactions(void) {}
+
+static void st7789_send_cmd(uint8_t cmd) {
+    gpio_set_level(ST7789_DC, 0);
+    disp_spi_send_data(&cmd, 1);
+}
+
+static void st7789_send_data(void *data, size_t len) {
+    gpio_set_level(ST7789_DC, 1);
+    disp_spi_send_data(data, len);
+}
+
+void lvgl_driver_init(void) { st7789_init(); }
+
+void st7789_init(void) {
+    static const struct {
+        uint8_t cmd;
+        uint8_t data[5];
+        uint8_t len;
+    } init_cmds[] = {
+        {ST7789_SLPOUT, {0}, 0},
+        {ST7789_COLMOD, {COLMOD_16BIT}, 1},
+        {ST7789_PORCTRL, {0x0c, 0x0c, 0x00, 0x33, 0x33}, 5},
+        {ST7789_GCTRL, {0x35}, 1},
+        {ST7789_VCOMS, {0x2b}, 1},
+        {ST7789_LCMCTRL, {0x2c}, 1},
+        {ST7789_VDVVRHEN, {0x01, 0xff}, 2},
+        {ST7789_VRHS, {0x11}, 1},
+        {ST7789_VDVSET, {0x20}, 1},
+        {ST7789_FRCTRL2, {0x0f}, 1},
+        {ST7789_PWCTRL1, {0xa4, 0xa1}, 2},
+        {ST7789_INVON, {0}, 0},
+        {ST7789_NORON, {0}, 0},
+        {ST7789_DISPON, {0}, 0},
+    };
+
+    gpio_set_direction(ST7789_DC, GPIO_MODE_OUTPUT);
+    gpio_set_direction(ST7789_RST, GPIO_MODE_OUTPUT);
+
+    // Hardware reset, then the same soft reset the panel gets on the board
+    gpio_set_level(ST7789_RST, 0);
+    panel_reset();
+    gpio_set_level(ST7789_RST, 1);
+    st7789_send_cmd(ST7789_SWRESET);
+
+    for (size_t i = 0; i < sizeof(init_cmds) / sizeof(init_cmds[0]); i++) {
+        st7789_send_cmd(init_cmds[i].cmd);
+        if (init_cmds[i].len > 0) {
+            st7789_send_data((void *)init_cmds[i].data, init_cmds[i].len);
+        }
+    }
+
+    // Sent last by the driver too, from st7789_set_orientation()
+    uint8_t madctl = orientation_madctl[CONFIG_LV_DISPLAY_ORIENTATION];
+    st7789_send_cmd(ST7789_MADCTL);
+    st7789_send_data(&madctl, 1);
+}
+
+void st7789_flush(lv_disp_drv_t *drv, const lv_area_t *area,
+                  lv_color_t *color_map) {
+    uint16_t x1 = area->x1 + X_OFFSET, x2 = area->x2 + X_OFFSET;
+    uint16_t y1 = area->y1 + Y_OFFSET, y2 = area->y2 + Y_OFFSET;
+
+    uint8_t data[4] = {x1 >> 8, x1 & 0xff, x2 >> 8, x2 & 0xff};
+    st7789_send_cmd(ST7789_CASET);
+    st7789_send_data(data, 4);
+
+    data[0] = y1 >> 8;
+    data[1] = y1 & 0xff;
+    data[2] = y2 >> 8;
+    data[3] = y2 & 0xff;
+    st7789_send_cmd(ST7789_RASET);
+    st7789_send_data(data, 4);
+
+    // LV_COLOR_16_SWAP already has the pixels in wire order
+    st7789_send_cmd(ST7789_RAMWR);
+    st7789_send_data(color_map, lv_area_get_size(area) * sizeof(lv_color_t));
+
+    lv_disp_flush_ready(drv);
+}
+
+void host_st7789_set_spi_clock(uint32_t clock_hz) {
+    if (clock_hz > 0) {
+        panel.clock_hz = clock_hz;
+    }
+}
+
+void host_st7789_get_stats(host_st7789_stats_t *stats) {
+    *stats = panel.stats;
+}
+
+// Where an LVGL pixel has to land on the glass for the orientation in
+// sdkconfig, worked out without MADCTL or the offsets, so a wrong table entry
+// or offset shows up as mismatches
+uint16_t host_st7789_pixel(lv_coord_t x, lv_coord_t y) {
+    lv_coord_t gx = x, gy = y;
+    switch (CONFIG_LV_DISPLAY_ORIENTATION) {
+        case 1: // Portrait inverted
+            gx = GLASS_WIDTH - 1 - x;
+            gy = GLASS_HEIGHT - 1 - y;
+            break;
+        case 2: // Landscape, turned a quarter clockwise
+            gx = GLASS_WIDTH - 1 - y;
+            gy = x;
+            break;
+        case 3: // Landscape inverted
+            gx = y;
+            gy = GLASS_HEIGHT - 1 - x;
+            break;
+    }
+    if (gx < 0 || gx >= GLASS_WIDTH || gy < 0 || gy >= GLASS_HEIGHT) {
+        return 0;
+    }
+    return panel.gram[(GLASS_Y + gy) * GRAM_WIDTH + GLASS_X + gx];
+}
+
+uint32_t host_st7789_mismatches(const lv_color_t *fb) {
+    uint32_t mismatches = 0;
+    for (lv_coord_t y = 0; y < LV_VER_RES_MAX; y++) {
+        for (lv_coord_t x = 0; x < LV_HOR_RES_MAX; x++) {
+            uint16_t expected = fb[y * LV_HOR_RES_MAX + x].full;
+#if LV_COLOR_16_SWAP
+            expected = expected >> 8 | expected << 8;
+#endif
+            if (host_st7789_pixel(x, y) != expected) {
+                mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
@@ -0,0 +1,225 @@
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "host-sim.h"
+
+// Enough of the default event loop and the station state machine to drive
+// task-wifi.c: start -> connect -> either got-ip or disconnected, with the
+// outcome and timing set through host_wifi_set_ap_present().
+
+#define HOST_EVENT_DATA_LEN 64
+#define HOST_EVENT_HANDLERS 8
+
+ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
+ESP_EVENT_DEFINE_BASE(IP_EVENT);
+
+typedef struct host_event {
+    esp_event_base_t base;
+    int32_t id;
+    uint8_t data[HOST_EVENT_DATA_LEN];
+} host_event_t;
+
+typedef struct host_event_handler {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+} host_event_handler_t;
+
+static const char *tag = "host_wifi";
+
+static QueueHandle_t event_queue;
+static host_event_handler_t handlers[HOST_EVENT_HANDLERS];
+
+static wifi_config_t sta_config;
+static esp_timer_handle_t connect_timer;
+static bool ap_present = false;
+static int64_t connect_time_us = 2000000;
+
+static void event_task(void *param) {
+    (void)param;
+    host_event_t evt;
+    while (true) {
+        if (xQueueReceive(event_queue, &evt, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        for (int i = 0; i < HOST_EVENT_HANDLERS; i++) {
+            host_event_handler_t *h = &handlers[i];
+            if (h->handler == NULL || h->base != evt.base) continue;
+            if (h->id != ESP_EVENT_ANY_ID && h->id != evt.id) continue;
+            h->handler(h->arg, evt.base, evt.id, evt.data);
+        }
+    }
+}
+
+esp_err_t esp_event_loop_create_default(void) {
+    if (event_queue != NULL) return ESP_ERR_INVALID_STATE;
+
+    event_queue = xQueueCreate(32, sizeof(host_event_t));
+    if (event_queue == NULL) return ESP_ERR_NO_MEM;
+
+    if (xTaskCreate(&event_task, "sys_evt", 4096, NULL, 20, NULL) != pdTRUE) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base,
+                                     int32_t event_id,
+                                     esp_event_handler_t event_handler,
+                                     void *event_handler_arg) {
+    for (int i = 0; i < HOST_EVENT_HANDLERS; i++) {
+        if (handlers[i].handler == NULL) {
+            handlers[i] = (host_event_handler_t){.base = event_base,
+                                                 .id = event_id,
+                                                 .handler = event_handler,
+                                                 .arg = event_handler_arg};
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_event_handler_unregister(esp_event_base_t event_base,
+                                       int32_t event_id,
+                                       esp_event_handler_t event_handler) {
+    for (int i = 0; i < HOST_EVENT_HANDLERS; i++) {
+        if (handlers[i].base == event_base && handlers[i].id == event_id &&
+            handlers[i].handler == event_handler) {
+            memset(&handlers[i], 0, sizeof(host_event_handler_t));
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id,
+                         void *event_data, size_t event_data_size,
+                         TickType_t ticks_to_wait) {
+    if (event_queue == NULL) return ESP_ERR_INVALID_STATE;
+    if (event_data_size > HOST_EVENT_DATA_LEN) return ESP_ERR_INVALID_ARG;
+
+    host_event_t evt = {.base = event_base, .id = event_id};
+    if (event_data != NULL) {
+        memcpy(evt.data, event_data, event_data_size);
+    }
+    if (xQueueSend(event_queue, &evt, ticks_to_wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_init(void) { return ESP_OK; }
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void) {
+    static int netif;
+    return (esp_netif_t *)&netif;
+}
+
+// Locally administered, so it can't be anyone's real AP
+static const uint8_t host_bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+static void connect_done(void *arg) {
+    (void)arg;
+    if (ap_present) {
+        wifi_event_sta_connected_t connected = {.channel = 6};
+        memcpy(connected.bssid, host_bssid, sizeof(host_bssid));
+        memcpy(connected.ssid, sta_config.sta.ssid, sizeof(connected.ssid));
+        esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &connected,
+                       sizeof(connected), portMAX_DELAY);
+
+        // 192.168.4.2, stored in network order like lwip does
+        ip_event_got_ip_t got_ip = {.ip_info.ip.addr = 0x0204a8c0};
+        esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip, sizeof(got_ip),
+                       portMAX_DELAY);
+    } else {
+        wifi_event_sta_disconnected_t disconnected = {
+            .reason = WIFI_REASON_NO_AP_FOUND};
+        memcpy(disconnected.ssid, sta_config.sta.ssid,
+               sizeof(disconnected.ssid));
+        esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnected,
+                       sizeof(disconnected), portMAX_DELAY);
+    }
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) {
+    (void)config;
+    const esp_timer_create_args_t timer_args = {.callback = &connect_done,
+                                                .name = "host_wifi_connect"};
+    return esp_timer_create(&timer_args, &connect_timer);
+}
+
+esp_err_t esp_wifi_deinit(void) {
+    if (connect_timer != NULL) {
+        esp_timer_stop(connect_timer);
+        esp_timer_delete(connect_timer);
+        connect_timer = NULL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) {
+    (void)mode;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t *conf) {
+    (void)interface;
+    memcpy(conf, &sta_config, sizeof(wifi_config_t));
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf) {
+    (void)interface;
+    memcpy(&sta_config, conf, sizeof(wifi_config_t));
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void) {
+    return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0,
+                          portMAX_DELAY);
+}
+
+esp_err_t esp_wifi_stop(void) {
+    esp_timer_stop(connect_timer);
+    return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_STOP, NULL, 0,
+                          portMAX_DELAY);
+}
+
+esp_err_t esp_wifi_connect(void) {
+    int64_t delay = connect_time_us;
+    // A pinned BSSID and channel skips the scan
+    if (sta_config.sta.bssid_set && sta_config.sta.channel) {
+        delay /= 4;
+    }
+    ESP_LOGD(tag, "connect in %" PRId64 "us", delay);
+    return esp_timer_start_once(connect_timer, delay);
+}
+
+esp_err_t esp_wifi_disconnect(void) {
+    esp_timer_stop(connect_timer);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info) {
+    if (!ap_present) return ESP_ERR_NOT_FOUND;
+    memset(ap_info, 0, sizeof(wifi_ap_record_t));
+    memcpy(ap_info->ssid, sta_config.sta.ssid, sizeof(sta_config.sta.ssid));
+    memcpy(ap_info->bssid, host_bssid, sizeof(host_bssid));
+    ap_info->primary = 6;
+    ap_info->rssi = -58;
+    ap_info->authmode = WIFI_AUTH_WPA2_PSK;
+    return ESP_OK;
+}
+
+void host_wifi_set_ap_present(bool present, int64_t connect_time) {
+    ap_present = present;
+    connect_time_us = connect_time;
+}
@@ -0,0 +1,483 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "button-trace.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host-sim.h"
+#include "task-button.h"
+
+// Replays raw button edges through task-button's ISR, debounce filter and
+// button_worker on a virtual clock, as fast as the host can go.  Edges come
+// from a trace recorded on the board (-r) or a synthetic one with bounce,
+// chords and long holds.  For synthetic traces every gesture's expected
+// PRESS/HELD/RELEASE callbacks are known up front and checked.
+//
+// Latency is the real time from handing an edge (or a timer wakeup) to the
+// worker until the callback runs.
+
+#define BUTTON1 GPIO_NUM_35
+#define BUTTON2 GPIO_NUM_0
+#define BUTTON_CNT 2
+
+// Same gestures and filter the board uses, plus a chord and a held callback
+#define MIN_TIME 100000
+#define MAX_TIME 2000000
+#define HELD_INTERVAL 200000
+#define DEBOUNCE_TIME 20000
+#define DEBOUNCE_SAMPLES 3
+
+// How long to keep running the worker's timers after the last edge
+#define DRAIN_TIME 10000000
+
+enum { CB_BUTTON1, CB_BUTTON2, CB_CHORD, CB_CNT };
+#define EVENT_CNT 3
+
+typedef struct gesture {
+    int64_t start;
+    uint8_t expected[CB_CNT][EVENT_CNT];
+    uint8_t actual[CB_CNT][EVENT_CNT];
+} gesture_t;
+
+typedef struct bench {
+    const char *replay_path;
+    const char *write_path;
+    const char *log_path;
+    int gesture_cnt;
+    uint32_t seed;
+
+    uint8_t *trace;
+    size_t trace_len;
+
+    gesture_t *gestures; // Only for synthetic traces
+    int current;
+    int64_t base;
+    FILE *log;
+
+    int64_t handoff_ns;
+    uint32_t *latency_ns;
+    size_t latency_cnt;
+    size_t latency_size;
+    uint64_t callbacks;
+    uint32_t unknown_buttons;
+} bench_t;
+
+static const char *tag = "button_bench";
+static const gpio_num_t button_gpio[BUTTON_CNT] = {BUTTON1, BUTTON2};
+static const char event_names[EVENT_CNT] = {'P', 'H', 'R'};
+static bench_t bench;
+
+static int64_t real_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// xorshift32, so a seed gives the same trace everywhere
+static uint32_t next_rand(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int64_t rand_range(uint32_t *state, int64_t lo, int64_t hi) {
+    return lo + next_rand(state) % (uint32_t)(hi - lo + 1);
+}
+
+static void put_edge(button_trace_writer_t *writer, int64_t time, int button,
+                     int level) {
+    button_trace_rec_t rec = {.edge_time = time, .button = button,
+                              .level = level};
+    if (!button_trace_put(writer, &rec)) {
+        size_t size = writer->size * 2;
+        uint8_t *buf = realloc(writer->buf, size);
+        if (buf == NULL) {
+            ESP_LOGE(tag, "ENOMEM growing trace to %zu bytes", size);
+            exit(1);
+        }
+        writer->buf = buf;
+        writer->size = size;
+        writer->dropped--;
+        button_trace_put(writer, &rec);
+    }
+}
+
+// A clean transition at time followed by up to 6 bounces, all well inside
+// the debounce time, ending back at level.
+static void put_transition(button_trace_writer_t *writer, uint32_t *rng,
+                           int64_t time, int button, int level) {
+    put_edge(writer, time, button, level);
+
+    int bounces = rand_range(rng, 0, 3) * 2;
+    for (int i = 0; i < bounces; i++) {
+        time += rand_range(rng, 50, 800);
+        put_edge(writer, time, button, (i & 1) ? level : !level);
+    }
+}
+
+// HELD fires once the press is min_time + 1us old, then every interval
+static uint8_t expected_held(int64_t duration) {
+    if (duration <= MIN_TIME + 1) {
+        return 0;
+    }
+    return (duration - MIN_TIME - 2) / HELD_INTERVAL + 1;
+}
+
+static void expect_press(uint8_t *counts, int64_t duration, int64_t release) {
+    if (duration <= MIN_TIME) {
+        return;
+    }
+    counts[PRESS] = 1;
+    counts[HELD] = expected_held(duration);
+    counts[RELEASE] = release < MAX_TIME;
+}
+
+// Taps on either button, and chords where the first button is released
+// last.  Durations land on +500us so nothing ties with a timer deadline.
+static void generate(bench_t *b) {
+    button_trace_writer_t writer;
+    size_t size = BUTTON_TRACE_HEADER_SIZE + b->gesture_cnt * 64;
+    uint8_t *buf = malloc(size);
+    uint32_t rng = b->seed ? b->seed : 1;
+
+    b->gestures = calloc(b->gesture_cnt, sizeof(gesture_t));
+    if (buf == NULL || b->gestures == NULL) {
+        ESP_LOGE(tag, "ENOMEM allocating %d gestures", b->gesture_cnt);
+        exit(1);
+    }
+    button_trace_writer_init(&writer, buf, size);
+
+    int64_t t = 1000000;
+    for (int i = 0; i < b->gesture_cnt; i++) {
+        gesture_t *g = &b->gestures[i];
+        int first = rand_range(&rng, 0, 1);
+        g->start = t;
+
+        if (rand_range(&rng, 0, 9) > 0) {
+            int64_t duration = rand_range(&rng, 25, 3000) * 1000 + 500;
+            put_transition(&writer, &rng, t, first, 0);
+            put_transition(&writer, &rng, t + duration, first, 1);
+            expect_press(g->expected[first], duration, duration);
+            t += duration;
+        } else {
+            int second = !first;
+            int64_t skew = rand_range(&rng, 10, 60) * 1000;
+            int64_t duration = rand_range(&rng, 150, 2500) * 1000 + 500;
+            int64_t lag = rand_range(&rng, 10, 150) * 1000;
+
+            put_transition(&writer, &rng, t, first, 0);
+            put_transition(&writer, &rng, t + skew, second, 0);
+            put_transition(&writer, &rng, t + duration, second, 1);
+            put_transition(&writer, &rng, t + duration + lag, first, 1);
+
+            expect_press(g->expected[CB_CHORD], duration, duration);
+            // Once the second button lets go the first is held on its own,
+            // already older than min_time, so it gets one HELD right away
+            g->expected[first][PRESS] = 1;
+            g->expected[first][HELD] = 1;
+            g->expected[first][RELEASE] = duration + lag < MAX_TIME;
+            t += duration + lag;
+        }
+        t += rand_range(&rng, 100, 1000) * 1000;
+    }
+
+    b->trace = writer.buf;
+    b->trace_len = writer.len;
+    ESP_LOGI(tag, "Generated %d gestures, %"PRIu32" edges, %zu bytes",
+             b->gesture_cnt, writer.records, writer.len);
+}
+
+static bool load(bench_t *b) {
+    FILE *f = fopen(b->replay_path, "rb");
+    if (f == NULL) {
+        ESP_LOGE(tag, "Can't open %s", b->replay_path);
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    b->trace = malloc(len > 0 ? len : 1);
+    if (b->trace == NULL || fread(b->trace, 1, len, f) != (size_t)len) {
+        ESP_LOGE(tag, "Failed to read %s", b->replay_path);
+        fclose(f);
+        return false;
+    }
+    b->trace_len = len;
+    fclose(f);
+    return true;
+}
+
+static bool save(bench_t *b) {
+    FILE *f = fopen(b->write_path, "wb");
+    if (f == NULL ||
+        fwrite(b->trace, 1, b->trace_len, f) != b->trace_len) {
+        ESP_LOGE(tag, "Failed to write %s", b->write_path);
+        if (f != NULL) fclose(f);
+        return false;
+    }
+    fclose(f);
+    return true;
+}
+
+static void button_cb(int64_t event_time, event_t evt,
+                      button_callback_param_t param) {
+    bench_t *b = &bench;
+    int cb = (intptr_t)param;
+    int64_t latency = real_ns() - b->handoff_ns;
+
+    if (b->latency_cnt == b->latency_size) {
+        b->latency_size = b->latency_size ? b->latency_size * 2 : 4096;
+        b->latency_ns = realloc(b->latency_ns,
+                                b->latency_size * sizeof(uint32_t));
+        if (b->latency_ns == NULL) {
+            ESP_LOGE(tag, "ENOMEM growing latency samples");
+            exit(1);
+        }
+    }
+    b->latency_ns[b->latency_cnt++] =
+        latency > UINT32_MAX ? UINT32_MAX : latency;
+    b->callbacks++;
+
+    if (b->gestures != NULL) {
+        uint8_t *count = &b->gestures[b->current].actual[cb][evt];
+        if (*count < UINT8_MAX) {
+            (*count)++;
+        }
+    }
+
+    if (b->log != NULL) {
+        fprintf(b->log, "%"PRId64" %d %c\n", event_time - b->base, cb,
+                event_names[evt]);
+    }
+}
+
+static void setup(buttons_handle_t buttons) {
+    setup_interrupts(buttons);
+
+    for (int i = 0; i < BUTTON_CNT; i++) {
+        button_spec_t spec = {.active_level = LOW,
+                              .gpio_num = button_gpio[i],
+                              .pull_mode = GPIO_FLOATING,
+                              .debounce_time = DEBOUNCE_TIME,
+                              .samples = DEBOUNCE_SAMPLES};
+        setup_button_gpio(buttons, &spec);
+    }
+
+    for (int cb = 0; cb < CB_CNT; cb++) {
+        uint64_t mask = cb == CB_CHORD ? 3 : 1ULL << cb;
+        button_callback_t callback = {
+            .button_mask = mask,
+            .ignore_mask = 3 & ~mask,
+            .min_time = MIN_TIME,
+            .max_time = MAX_TIME,
+            .callback_interval = HELD_INTERVAL,
+            .press_cb = button_cb,
+            .press_param = (void *)(intptr_t)cb,
+            .held_cb = button_cb,
+            .held_param = (void *)(intptr_t)cb,
+            .release_cb = button_cb,
+            .release_param = (void *)(intptr_t)cb};
+        attach_callback(buttons, &callback);
+    }
+}
+
+// button_worker runs at a higher priority, so by the time a wake or an edge
+// returns here it has already dealt with it and blocked again.
+static void run_until(bench_t *b, buttons_handle_t buttons, int64_t limit) {
+    int64_t wakeup;
+    while ((wakeup = button_next_wakeup(buttons)) != 0 && wakeup <= limit) {
+        host_clock_set(wakeup);
+        b->handoff_ns = real_ns();
+        button_wake(buttons);
+    }
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(bench_t *b, int pct) {
+    if (b->latency_cnt == 0) {
+        return 0;
+    }
+    return b->latency_ns[(b->latency_cnt - 1) * pct / 100];
+}
+
+static int check(bench_t *b) {
+    if (b->gestures == NULL) {
+        return 0;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < b->gesture_cnt; i++) {
+        gesture_t *g = &b->gestures[i];
+        if (memcmp(g->expected, g->actual, sizeof(g->expected)) == 0) {
+            continue;
+        }
+        if (failed++ < 10) {
+            printf("gesture %d at %"PRId64"us:", i, g->start);
+            for (int cb = 0; cb < CB_CNT; cb++) {
+                for (int e = 0; e < EVENT_CNT; e++) {
+                    printf(" %d%c %u/%u", cb, event_names[e],
+                           g->actual[cb][e], g->expected[cb][e]);
+                }
+            }
+            printf(" (actual/expected)\n");
+        }
+    }
+    printf("Gestures: %d checked, %d wrong\n", b->gesture_cnt, failed);
+    return failed;
+}
+
+static void bench_task(void *param) {
+    bench_t *b = param;
+    button_trace_reader_t reader;
+    button_trace_rec_t rec;
+
+    if (!button_trace_reader_init(&reader, b->trace, b->trace_len)) {
+        ESP_LOGE(tag, "Not a button trace");
+        exit(1);
+    }
+
+    buttons_handle_t buttons = init_buttons(BUTTON_CNT);
+    setup(buttons);
+    // Let button_worker block for the first time
+    vTaskDelay(1);
+
+    host_clock_set_virtual(true);
+    b->base = esp_timer_get_time() + 1000;
+
+    uint64_t edges = 0;
+    int64_t offset = 0;
+    int64_t last = b->base;
+    int64_t started = real_ns();
+    while (button_trace_get(&reader, &rec)) {
+        if (edges == 0) {
+            // Recorded traces start at the board's uptime
+            offset = b->base - rec.edge_time;
+        }
+        if (rec.button >= BUTTON_CNT) {
+            b->unknown_buttons++;
+            continue;
+        }
+
+        last = rec.edge_time + offset;
+        run_until(b, buttons, last);
+        if (b->gestures != NULL) {
+            while (b->current + 1 < b->gesture_cnt &&
+                   b->gestures[b->current + 1].start + offset <= last) {
+                b->current++;
+            }
+        }
+
+        host_clock_set(last);
+        b->handoff_ns = real_ns();
+        host_gpio_set_input(button_gpio[rec.button], rec.level);
+        edges++;
+    }
+    run_until(b, buttons, last + DRAIN_TIME);
+    double seconds = (real_ns() - started) / 1e9;
+
+    button_stats_t stats;
+    button_get_stats(buttons, &stats);
+    qsort(b->latency_ns, b->latency_cnt, sizeof(uint32_t), compare_u32);
+
+    printf("Edges: %"PRIu64" in %.3fs (%.0f/s), %.1fs simulated\n", edges,
+           seconds, edges / seconds, (last - b->base) / 1e6);
+    printf("Filter: %"PRIu32" queued, %"PRIu32" rejected, %"PRIu32
+           " overflowed, high water %"PRIu32"\n",
+           stats.events, stats.rejected, stats.overflows, stats.high_water);
+    if (b->unknown_buttons) {
+        printf("Skipped %"PRIu32" edges for unknown buttons\n",
+               b->unknown_buttons);
+    }
+    printf("Callbacks: %"PRIu64", latency us p50 %.1f p90 %.1f p99 %.1f "
+           "max %.1f\n",
+           b->callbacks, percentile(b, 50) / 1e3, percentile(b, 90) / 1e3,
+           percentile(b, 99) / 1e3, percentile(b, 100) / 1e3);
+
+    int failed = check(b);
+    if (b->log != NULL) {
+        fclose(b->log);
+    }
+    fflush(stdout);
+    exit(failed ? 2 : 0);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-r trace (replay)] [-g gestures (generate)] "
+            "[-s seed] [-w trace (save)] [-l callback_log]\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    bench.gesture_cnt = 100000;
+    bench.seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:g:s:w:l:h")) != -1) {
+        switch (opt) {
+            case 'r':
+                bench.replay_path = optarg;
+                break;
+            case 'g':
+                bench.gesture_cnt = atoi(optarg);
+                break;
+            case 's':
+                bench.seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                bench.write_path = optarg;
+                break;
+            case 'l':
+                bench.log_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (bench.replay_path != NULL) {
+        if (!load(&bench)) {
+            return 1;
+        }
+    } else {
+        if (bench.gesture_cnt <= 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        generate(&bench);
+    }
+
+    if (bench.write_path != NULL && !save(&bench)) {
+        return 1;
+    }
+
+    if (bench.log_path != NULL) {
+        bench.log = fopen(bench.log_path, "w");
+        if (bench.log == NULL) {
+            ESP_LOGE(tag, "Can't open %s", bench.log_path);
+            return 1;
+        }
+    }
+
+    // Below button_worker (priority 2) so every hand-off runs to completion
+    xTaskCreate(&bench_task, "button_bench", 8192, &bench, 1, NULL);
+
+    vTaskStartScheduler();
+    return 0;
+}
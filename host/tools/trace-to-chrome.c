@@ -0,0 +1,314 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Turns a tracer_dump() out of a serial log (or the host build's stdout) into
+// Chrome trace JSON, for chrome://tracing or ui.perfetto.dev.
+//
+// Begin/end pairs are matched per task and written as complete events on the
+// core they began on, so each core is a process and each task a thread in
+// the viewer.  Ends whose begin was overwritten in the ring, and begins that
+// never ended, are dropped.  ISR instants land on an "isr" thread per core.
+
+#define MAX_EVENTS 64
+#define MAX_TASKS 64
+#define MAX_DEPTH 16
+#define MAX_CORES 2
+
+typedef struct open_span {
+    int event;
+    int64_t time;
+    unsigned core;
+    uint32_t arg;
+} open_span_t;
+
+typedef struct task {
+    uintptr_t handle;
+    char name[32];
+    open_span_t stack[MAX_DEPTH];
+    int depth;
+} task_t;
+
+typedef struct converter {
+    char *event_names[MAX_EVENTS];
+    task_t tasks[MAX_TASKS];
+    int task_cnt;
+
+    int64_t base;
+    int64_t wraps;
+    uint32_t last_raw;
+    bool started;
+
+    FILE *out;
+    bool first_event;
+    uint32_t records;
+    uint32_t dropped;
+} converter_t;
+
+static const char *event_name(converter_t *conv, int event) {
+    if (event < 0 || event >= MAX_EVENTS || conv->event_names[event] == NULL) {
+        return "unknown";
+    }
+    return conv->event_names[event];
+}
+
+// Task ids start at 1, 0 is the ISR thread
+static int task_id(converter_t *conv, uintptr_t handle) {
+    if (handle == 0) {
+        return 0;
+    }
+    for (int i = 0; i < conv->task_cnt; i++) {
+        if (conv->tasks[i].handle == handle) {
+            return i + 1;
+        }
+    }
+    if (conv->task_cnt == MAX_TASKS) {
+        return -1;
+    }
+
+    task_t *task = &conv->tasks[conv->task_cnt++];
+    memset(task, 0, sizeof(task_t));
+    task->handle = handle;
+    snprintf(task->name, sizeof(task->name), "%" PRIxPTR, handle);
+    return conv->task_cnt;
+}
+
+// The board only records the low 32 bits of esp_timer
+static int64_t unwrap(converter_t *conv, uint32_t raw) {
+    if (!conv->started) {
+        conv->started = true;
+        conv->base = raw;
+    } else if (raw < conv->last_raw && conv->last_raw - raw > 0x80000000u) {
+        conv->wraps += 1LL << 32;
+    }
+    conv->last_raw = raw;
+    return conv->wraps + raw - conv->base;
+}
+
+static void begin_event(converter_t *conv) {
+    fprintf(conv->out, conv->first_event ? "\n  " : ",\n  ");
+    conv->first_event = false;
+}
+
+static void write_complete(converter_t *conv, int tid, const open_span_t *span,
+                           int64_t end, uint32_t end_arg) {
+    begin_event(conv);
+    fprintf(conv->out,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%" PRId64
+            ",\"dur\":%" PRId64 ",\"pid\":%u,\"tid\":%d,"
+            "\"args\":{\"begin\":%" PRIu32 ",\"end\":%" PRIu32 "}}",
+            event_name(conv, span->event), span->time, end - span->time,
+            span->core, tid, span->arg, end_arg);
+}
+
+static void write_instant(converter_t *conv, int tid, int event, int64_t time,
+                          unsigned core, uint32_t arg) {
+    begin_event(conv);
+    fprintf(conv->out,
+            "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRId64
+            ",\"pid\":%u,\"tid\":%d,\"args\":{\"arg\":%" PRIu32 "}}",
+            event_name(conv, event), time, core, tid, arg);
+}
+
+static void write_metadata(converter_t *conv) {
+    for (unsigned core = 0; core < MAX_CORES; core++) {
+        begin_event(conv);
+        fprintf(conv->out,
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,"
+                "\"args\":{\"name\":\"core %u\"}}",
+                core, core);
+        begin_event(conv);
+        fprintf(conv->out,
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,"
+                "\"tid\":0,\"args\":{\"name\":\"isr\"}}",
+                core);
+        for (int i = 0; i < conv->task_cnt; i++) {
+            begin_event(conv);
+            fprintf(conv->out,
+                    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,"
+                    "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    core, i + 1, conv->tasks[i].name);
+        }
+    }
+}
+
+static void record(converter_t *conv, uint32_t raw, char phase, unsigned core,
+                   uintptr_t handle, int event, uint32_t arg) {
+    int64_t time = unwrap(conv, raw);
+    int tid = task_id(conv, handle);
+    conv->records++;
+    if (tid < 0 || core >= MAX_CORES) {
+        conv->dropped++;
+        return;
+    }
+
+    if (phase == 'i') {
+        write_instant(conv, tid, event, time, core, arg);
+        return;
+    }
+    if (tid == 0) {
+        conv->dropped++;
+        return;
+    }
+
+    task_t *task = &conv->tasks[tid - 1];
+    if (phase == 'B') {
+        if (task->depth == MAX_DEPTH) {
+            conv->dropped++;
+            return;
+        }
+        task->stack[task->depth++] =
+            (open_span_t){.event = event, .time = time, .core = core,
+                          .arg = arg};
+        return;
+    }
+
+    // An end closes the innermost matching begin; anything opened inside it
+    // and never closed goes with it.
+    for (int d = task->depth - 1; d >= 0; d--) {
+        if (task->stack[d].event == event) {
+            write_complete(conv, tid, &task->stack[d], time, arg);
+            conv->dropped += task->depth - d - 1;
+            task->depth = d;
+            return;
+        }
+    }
+    conv->dropped++;
+}
+
+// Leaves the file at the start of the wanted dump, counting from 0 (or the
+// last one for -1).  Returns false if there isn't one.
+static bool seek_dump(FILE *in, int wanted) {
+    char line[256];
+    long found = -1;
+    int index = 0;
+
+    while (true) {
+        long pos = ftell(in);
+        if (fgets(line, sizeof(line), in) == NULL) {
+            break;
+        }
+        if (strncmp(line, "TRACE ", 6) == 0 && strncmp(line, "TRACE end", 9)) {
+            if (wanted < 0 || index == wanted) {
+                found = pos;
+            }
+            index++;
+        }
+    }
+
+    if (found < 0) {
+        return false;
+    }
+    fseek(in, found, SEEK_SET);
+    return true;
+}
+
+static bool convert(converter_t *conv, FILE *in) {
+    char line[256];
+    bool in_dump = false;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (strncmp(line, "TRACE end", 9) == 0) {
+            break;
+        } else if (strncmp(line, "TRACE ", 6) == 0) {
+            if (in_dump) {
+                break;
+            }
+            in_dump = true;
+        } else if (strncmp(line, "TN ", 3) == 0) {
+            int event;
+            char name[64];
+            if (sscanf(line + 3, "%d %63s", &event, name) == 2 && event >= 0 &&
+                event < MAX_EVENTS) {
+                free(conv->event_names[event]);
+                conv->event_names[event] = strdup(name);
+            }
+        } else if (strncmp(line, "TK ", 3) == 0) {
+            uintptr_t handle;
+            char name[32];
+            if (sscanf(line + 3, "%" SCNxPTR " %31s", &handle, name) == 2) {
+                int tid = task_id(conv, handle);
+                if (tid > 0) {
+                    strcpy(conv->tasks[tid - 1].name, name);
+                }
+            }
+        } else if (strncmp(line, "TR ", 3) == 0) {
+            uint32_t raw, arg;
+            char phase;
+            unsigned core;
+            uintptr_t handle;
+            int event;
+            if (sscanf(line + 3,
+                       "%" SCNu32 " %c %u %" SCNxPTR " %d %" SCNu32, &raw,
+                       &phase, &core, &handle, &event, &arg) == 6) {
+                record(conv, raw, phase, core, handle, event, arg);
+            }
+        }
+    }
+    return in_dump;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-n dump (default last)] [-o out.json] log\n", prog);
+}
+
+int main(int argc, char **argv) {
+    static converter_t conv = {.first_event = true};
+    const char *out_path = NULL;
+    int wanted = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:o:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                wanted = atoi(optarg);
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[optind], "r");
+    if (in == NULL) {
+        fprintf(stderr, "Can't open %s\n", argv[optind]);
+        return 1;
+    }
+    if (!seek_dump(in, wanted)) {
+        fprintf(stderr, "No trace dump in %s\n", argv[optind]);
+        return 1;
+    }
+
+    conv.out = stdout;
+    if (out_path != NULL) {
+        conv.out = fopen(out_path, "w");
+        if (conv.out == NULL) {
+            fprintf(stderr, "Can't open %s\n", out_path);
+            return 1;
+        }
+    }
+
+    fprintf(conv.out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    convert(&conv, in);
+    write_metadata(&conv);
+    fprintf(conv.out, "\n]}\n");
+    fclose(in);
+    if (conv.out != stdout) {
+        fclose(conv.out);
+    }
+
+    fprintf(stderr, "%" PRIu32 " records, %" PRIu32 " dropped\n",
+            conv.records, conv.dropped);
+    return 0;
+}
@@ -1,14 +1,17 @@
+#include <stdlib.h>
+
 #include "demo-screen-color-rotate.h"
+#include "diagnostics.h"
 
 // Color rotate
 typedef struct {
     lv_obj_t *win;
     uint8_t color_index;
-    int64_t last_call;
 } color_rotate_demo_t;
 
 void *color_rotate_screen_init(lv_obj_t *screen) {
-    color_rotate_demo_t *priv = calloc(1, sizeof(color_rotate_demo_t));
+    color_rotate_demo_t *priv =
+        diag_calloc(DIAG_TAG_SCREEN, 1, sizeof(color_rotate_demo_t));
     
     priv->win = lv_win_create(screen, NULL);
     lv_win_set_title(priv->win, "Color Cycle!");
@@ -18,11 +21,6 @@ void *color_rotate_screen_init(lv_obj_t *screen) {
 
 void color_rotate_screen_worker(lv_obj_t *screen, void *priv) {
     color_rotate_demo_t *pdata = priv;
-    
-    int64_t now = esp_timer_get_time();
-    if ((now - pdata->last_call) < UPDATE_INTERVAL_US) {
-        return;
-    }
 
     lv_color_t new_color;
     switch (++pdata->color_index) {
@@ -84,5 +82,13 @@ void color_rotate_screen_worker(lv_obj_t *screen, void *priv) {
 
     lv_obj_set_style_local_bg_color(screen, LV_OBJ_PART_MAIN,
                                     LV_STATE_DEFAULT, new_color);
-    pdata->last_call = now;
-}
\ No newline at end of file
+}
+
+// One color a second
+const screen_desc_t color_rotate_screen = {
+    .name = "color-rotate",
+    .init_cb = color_rotate_screen_init,
+    .tick_cb = color_rotate_screen_worker,
+    .tick_period_ms = 1000,
+    .mem_budget = 2 * 1024,
+};
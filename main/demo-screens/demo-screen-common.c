@@ -1,14 +1,19 @@
+#include <stdlib.h>
+
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 
 #include "demo-screen-common.h"
-#include "demo-screen-hello-world.h"
-#include "demo-screen-color-rotate.h"
-#include "demo-screen-voltage.h"
-#include "demo-screen-wifi.h"
 
 #include "freertos/task.h"
 
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "lvgl_helpers.h"
 #include "lvgl_tft/st7789.h"
+#include "diagnostics.h"
+#include "tracer.h"
 
 #define TFT_MOSI GPIO_NUM_19
 #define TFT_SCLK GPIO_NUM_18
@@ -17,16 +22,34 @@
 #define TFT_RST GPIO_NUM_23
 #define TFT_BL GPIO_NUM_4
 
+// Backlight PWM.  80MHz APB / 2^10 leaves plenty of room for 5kHz, and
+// task-power keeps APB at 80MHz while it's lit.
+#define BACKLIGHT_MODE LEDC_LOW_SPEED_MODE
+#define BACKLIGHT_TIMER LEDC_TIMER_0
+#define BACKLIGHT_CHANNEL LEDC_CHANNEL_0
+#define BACKLIGHT_RESOLUTION LEDC_TIMER_10_BIT
+#define BACKLIGHT_MAX_DUTY ((1 << 10) - 1)
+#define BACKLIGHT_FREQ_HZ 5000
+
+// Content worker period when no screen asks for anything faster
+#define CONTENT_PERIOD_MS 100
+
+// Runtime state for a screen_registry entry.  Screens are built the first
+// time they're shown.  Ones with a release_cb are torn down again once
+// they've been hidden for idle_timeout_us, and rebuilt the next time they're
+// shown.
 typedef struct screen_data {
+    const screen_desc_t *desc;
     lv_obj_t *screen;
-    tick_callback_t tick_cb;
-    tick_callback_t unload_cb;
-    tick_callback_t load_cb;
+    int64_t unloaded_at;
+    uint32_t ticked_at; // lv_tick_get()
+    int32_t mem_used;
     void *priv;
 } screen_data_t;
 
 typedef struct display_content_worker_data {
     uint8_t mode;
+    const display_backend_t *backend;
     QueueHandle_t display_event_queue;
     lv_style_t *my_style;
 
@@ -42,82 +65,237 @@ typedef struct display_data {
 
 static const char *display_tag = "display_tag";
 
-void tick_task(void *arg) { lv_tick_inc(10); }
+static TaskHandle_t display_task;
+static int64_t lv_tick_last_us;
+// What display_set_backlight() asked for before backlight_init() ran
+static uint8_t backlight_percent = 100;
+static bool backlight_ready;
+
+// LVGL's clock follows esp_timer instead of counting timer interrupts, so
+// it stays right however long the display task sleeps.
+static void update_lv_tick(void) {
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed_ms = (now - lv_tick_last_us) / 1000;
+    if (elapsed_ms > 0) {
+        lv_tick_inc(elapsed_ms);
+        lv_tick_last_us += elapsed_ms * 1000;
+    }
+}
+
+// How long the display task can sleep before LVGL next has work to do.
+static TickType_t ticks_until(uint32_t next_ms) {
+    if (next_ms == LV_NO_TASK_READY) {
+        return portMAX_DELAY;
+    }
+    return (next_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+}
+
+void display_notify(void) {
+    if (display_task != NULL) {
+        xTaskNotifyGive(display_task);
+    }
+}
+
+static int32_t mem_free(void) {
+    lv_mem_monitor_t mon;
+    lv_mem_monitor(&mon);
+    return (int32_t)esp_get_free_heap_size() + (int32_t)mon.free_size;
+}
+
+static void screen_prepare(display_content_worker_data_t *wdata,
+                           screen_data_t *sdata) {
+    if (sdata->screen != NULL) {
+        return;
+    }
+
+    // Other tasks allocate too, so this is only a rough figure, but it's
+    // enough to catch a screen that's grown well past what it was given.
+    int32_t before = mem_free();
+
+    sdata->screen = lv_obj_create(NULL, NULL);
+    lv_obj_add_style(sdata->screen, LV_OBJ_PART_MAIN, wdata->my_style);
+    if (sdata->desc->init_cb != NULL) {
+        sdata->priv = sdata->desc->init_cb(sdata->screen);
+    }
+    sdata->ticked_at = lv_tick_get();
+
+    sdata->mem_used = before - mem_free();
+    if (sdata->desc->mem_budget != 0 &&
+        sdata->mem_used > (int32_t)sdata->desc->mem_budget) {
+        ESP_LOGW(display_tag, "Screen %s took %d bytes, budget %u",
+                 sdata->desc->name, sdata->mem_used,
+                 (unsigned)sdata->desc->mem_budget);
+    }
+}
+
+static void screen_release_idle(display_content_worker_data_t *wdata) {
+    int64_t now = esp_timer_get_time();
+
+    for (int i = 0; i < wdata->screen_cnt; i++) {
+        screen_data_t *sdata = &wdata->screen[i];
+        const screen_desc_t *desc = sdata->desc;
+        if (i == wdata->mode || sdata->screen == NULL ||
+            desc->release_cb == NULL || desc->idle_timeout_us == 0 ||
+            now - sdata->unloaded_at < desc->idle_timeout_us) {
+            continue;
+        }
+
+        ESP_LOGI(display_tag, "Releasing idle screen %s", desc->name);
+        desc->release_cb(sdata->screen, sdata->priv);
+        lv_obj_del(sdata->screen);
+        display_backend_drop_snapshot(i);
+        sdata->screen = NULL;
+        sdata->priv = NULL;
+    }
+}
 
 void display_content_worker(lv_task_t *param) {
     display_content_worker_data_t *wdata =
         (display_content_worker_data_t *)param->user_data;
-    display_mode_t new_mode = MAX_DISPLAY_MODE;
-    if (xQueueReceive(wdata->display_event_queue, &new_mode, 0) == pdTRUE) {
-        if(new_mode != wdata->mode) {
-            lv_scr_load_anim_t anim = LV_SCR_LOAD_ANIM_MOVE_RIGHT;
-            if (wdata->mode < new_mode) {
-                anim = LV_SCR_LOAD_ANIM_MOVE_LEFT;
-            }
-
-            lv_scr_load_anim(wdata->screen[new_mode].screen, anim, 100, 10, false);
-
-            if (wdata->screen[wdata->mode].unload_cb != NULL) {
-                wdata->screen[wdata->mode].unload_cb(
-                    wdata->screen[wdata->mode].screen,
-                    wdata->screen[wdata->mode].priv);
-            }
-
-            if (wdata->screen[new_mode].load_cb != NULL) {
-                wdata->screen[new_mode].load_cb(
-                    wdata->screen[new_mode].screen,
-                    wdata->screen[new_mode].priv);
-            }
-
-            wdata->mode = new_mode;
+    TRACE_BEGIN(TRACE_CONTENT_WORKER, wdata->mode);
+
+    display_mode_t new_mode;
+    if (xQueueReceive(wdata->display_event_queue, &new_mode, 0) == pdTRUE &&
+        new_mode < wdata->screen_cnt && new_mode != wdata->mode) {
+        screen_data_t *old = &wdata->screen[wdata->mode];
+        screen_data_t *new = &wdata->screen[new_mode];
+
+        bool forward = wdata->mode < new_mode;
+        lv_scr_load_anim_t anim = LV_SCR_LOAD_ANIM_MOVE_RIGHT;
+        if (forward) {
+            anim = LV_SCR_LOAD_ANIM_MOVE_LEFT;
+        }
+
+        // Slide cached images of both screens if there are any, so LVGL
+        // only renders the final frame.  Otherwise it animates the real
+        // thing, which also leaves the new screen cached for next time.
+        screen_prepare(wdata, new);
+        if (display_backend_transition(wdata->mode, new_mode, forward)) {
+            lv_scr_load(new->screen);
+        } else {
+            lv_scr_load_anim(new->screen, anim, 100, 10, false);
+        }
+
+        TRACE_BEGIN(TRACE_SCREEN_UNLOAD, wdata->mode);
+        if (old->desc->unload_cb != NULL) {
+            old->desc->unload_cb(old->screen, old->priv);
         }
-    } 
+        old->unloaded_at = esp_timer_get_time();
+        TRACE_END(TRACE_SCREEN_UNLOAD, wdata->mode);
 
-    if(wdata->screen[wdata->mode].tick_cb != NULL) {
-        wdata->screen[wdata->mode].tick_cb(wdata->screen[wdata->mode].screen,
-                                           wdata->screen[wdata->mode].priv);
+        TRACE_BEGIN(TRACE_SCREEN_LOAD, new_mode);
+        if (new->desc->load_cb != NULL) {
+            new->desc->load_cb(new->screen, new->priv);
+        }
+        TRACE_END(TRACE_SCREEN_LOAD, new_mode);
+
+        // Tick straight away so the screen doesn't sit empty for a period
+        new->ticked_at = lv_tick_get() - new->desc->tick_period_ms;
+
+        wdata->mode = new_mode;
+        display_backend_set_screen(new_mode);
+        display_backend_set_frame_diff(new->desc->frame_diff);
     }
+
+    screen_release_idle(wdata);
+    diag_sample_lvgl();
+
+    screen_data_t *sdata = &wdata->screen[wdata->mode];
+    uint32_t period = sdata->desc->tick_period_ms;
+    if (sdata->desc->tick_cb != NULL &&
+        (period == 0 || lv_tick_elaps(sdata->ticked_at) >= period)) {
+        sdata->ticked_at = lv_tick_get();
+        sdata->desc->tick_cb(sdata->screen, sdata->priv);
+    }
+    TRACE_END(TRACE_CONTENT_WORKER, wdata->mode);
 }
 
 void show_display(display_handle_t disp_handle, display_mode_t disp) {
     display_data_t *ddata = (display_data_t *)disp_handle;
+    TRACE_INSTANT(TRACE_SHOW_DISPLAY, disp);
     xQueueSend(ddata->display_event_queue, &disp, pdMS_TO_TICKS(100));
+    display_notify();
+}
+
+static uint32_t backlight_duty(uint8_t percent) {
+    return (uint32_t)LV_MATH_MIN(percent, 100) * BACKLIGHT_MAX_DUTY / 100;
+}
+
+// The panel driver only switches the backlight on, take the pin over for PWM
+static void backlight_init(void) {
+    ledc_timer_config_t timer = {.speed_mode = BACKLIGHT_MODE,
+                                 .duty_resolution = BACKLIGHT_RESOLUTION,
+                                 .timer_num = BACKLIGHT_TIMER,
+                                 .freq_hz = BACKLIGHT_FREQ_HZ};
+    ledc_channel_config_t channel = {.gpio_num = TFT_BL,
+                                     .speed_mode = BACKLIGHT_MODE,
+                                     .channel = BACKLIGHT_CHANNEL,
+                                     .intr_type = LEDC_INTR_DISABLE,
+                                     .timer_sel = BACKLIGHT_TIMER,
+                                     .duty = backlight_duty(backlight_percent)};
+
+    if (ledc_timer_config(&timer) != ESP_OK ||
+        ledc_channel_config(&channel) != ESP_OK) {
+        ESP_LOGW(display_tag, "No backlight PWM, leaving it on");
+        return;
+    }
+    ledc_fade_func_install(0);
+    backlight_ready = true;
+}
+
+void display_set_backlight(uint8_t percent, uint32_t fade_ms) {
+    backlight_percent = percent;
+    if (!backlight_ready) {
+        return;
+    }
+
+    uint32_t duty = backlight_duty(percent);
+    if (fade_ms == 0) {
+        ledc_set_duty_and_update(BACKLIGHT_MODE, BACKLIGHT_CHANNEL, duty, 0);
+    } else {
+        ledc_set_fade_time_and_start(BACKLIGHT_MODE, BACKLIGHT_CHANNEL, duty,
+                                     fade_ms, LEDC_FADE_NO_WAIT);
+    }
 }
 
 void display_worker(void *param) {
     display_content_worker_data_t *dwdata = param;
+    display_task = xTaskGetCurrentTaskHandle();
 
     ESP_LOGI(display_tag, "Initializing Display");
     lv_init();
     lvgl_driver_init();
+    backlight_init();
 
 #define DISPLAY_BUF_SIZE (LV_HOR_RES_MAX * 40)
     ESP_LOGI(display_tag, "Initializing Framebuffers for %ix%i display",
              CONFIG_LV_DISPLAY_WIDTH, CONFIG_LV_DISPLAY_HEIGHT);
 
     static lv_color_t *buf[2];
-    buf[0] = calloc(DISPLAY_BUF_SIZE, sizeof(lv_color_t));
-    buf[1] = calloc(DISPLAY_BUF_SIZE, sizeof(lv_color_t));
+    buf[0] =
+        diag_calloc(DIAG_TAG_DISPLAY, DISPLAY_BUF_SIZE, sizeof(lv_color_t));
+    buf[1] =
+        diag_calloc(DIAG_TAG_DISPLAY, DISPLAY_BUF_SIZE, sizeof(lv_color_t));
 
-    lv_disp_buf_t *disp_buf = calloc(1, sizeof(lv_disp_buf_t));
+    lv_disp_buf_t *disp_buf =
+        diag_calloc(DIAG_TAG_DISPLAY, 1, sizeof(lv_disp_buf_t));
     lv_disp_buf_init(disp_buf, buf[0], buf[1], DISPLAY_BUF_SIZE);
 
-    lv_disp_drv_t *display_drv = calloc(1, sizeof(lv_disp_drv_t));
+    lv_disp_drv_t *display_drv =
+        diag_calloc(DIAG_TAG_DISPLAY, 1, sizeof(lv_disp_drv_t));
     lv_disp_drv_init(display_drv);
 
-    display_drv->flush_cb = st7789_flush;
+    display_backend_install(display_drv, dwdata->backend);
     display_drv->buffer = disp_buf;
     lv_disp_drv_register(display_drv);
 
-    const esp_timer_create_args_t periodic_timer_args = {
-        .callback = &tick_task, .name = "gui_tick_task"};
-    esp_timer_handle_t periodic_timer;
-    ESP_ERROR_CHECK(esp_timer_create(&periodic_timer_args, &periodic_timer));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(periodic_timer, 1000));
+    lv_tick_last_us = esp_timer_get_time();
 
-    dwdata->mode = HELLO_WORLD;
+    dwdata->mode = 0;
+    display_backend_set_screen(0);
+    display_backend_set_frame_diff(dwdata->screen[0].desc->frame_diff);
 
-    lv_style_t *style = calloc(1, sizeof(lv_style_t));
+    lv_style_t *style = diag_calloc(DIAG_TAG_DISPLAY, 1, sizeof(lv_style_t));
 
     dwdata->my_style = style;
     lv_style_init(style);
@@ -126,56 +304,47 @@ void display_worker(void *param) {
     lv_style_set_bg_color(style, LV_STATE_DEFAULT,
                             LV_COLOR_BLACK);
     
-    lv_obj_t *hello_world_screen = lv_obj_create(NULL, NULL);
-    lv_obj_add_style(hello_world_screen, LV_OBJ_PART_MAIN, style);
-    dwdata->screen[HELLO_WORLD].priv =
-        hello_world_screen_init(hello_world_screen);
-    dwdata->screen[HELLO_WORLD].screen = hello_world_screen;
-    dwdata->screen[HELLO_WORLD].tick_cb = hello_world_screen_worker;
-
-    lv_obj_t *color_rotate_screen = lv_obj_create(NULL, NULL);
-    lv_obj_add_style(color_rotate_screen, LV_OBJ_PART_MAIN, style);
-    dwdata->screen[COLOR_ROTATE].priv =
-        color_rotate_screen_init(color_rotate_screen);
-    dwdata->screen[COLOR_ROTATE].screen = color_rotate_screen;
-    dwdata->screen[COLOR_ROTATE].tick_cb = color_rotate_screen_worker;
-
-    lv_obj_t *voltage_screen = lv_obj_create(NULL, NULL);
-    lv_obj_add_style(voltage_screen, LV_OBJ_PART_MAIN, style);
-    dwdata->screen[VOLTAGE].priv = voltage_screen_init(voltage_screen);
-    dwdata->screen[VOLTAGE].screen = voltage_screen;
-    dwdata->screen[VOLTAGE].tick_cb = voltage_screen_worker;
-    dwdata->screen[VOLTAGE].load_cb = voltage_screen_load;
-    dwdata->screen[VOLTAGE].unload_cb = voltage_screen_unload;
-
-    lv_obj_t *wifi_screen = lv_obj_create(NULL, NULL);
-    lv_obj_add_style(wifi_screen, LV_OBJ_PART_MAIN, style);
-    dwdata->screen[WIFI].priv = wifi_screen_init(wifi_screen);
-    dwdata->screen[WIFI].screen = wifi_screen;
-    dwdata->screen[WIFI].tick_cb = wifi_screen_worker;
-
-    // wifi_screen_init(worker_d);
-
-    lv_scr_load(dwdata->screen[HELLO_WORLD].screen);
+    // The worker runs as often as the most demanding screen wants ticking
+    uint32_t period = CONTENT_PERIOD_MS;
+    for (int i = 0; i < dwdata->screen_cnt; i++) {
+        uint32_t tick_period = dwdata->screen[i].desc->tick_period_ms;
+        if (tick_period != 0 && tick_period < period) {
+            period = tick_period;
+        }
+    }
+
+    screen_prepare(dwdata, &dwdata->screen[0]);
+    lv_scr_load(dwdata->screen[0].screen);
     lv_task_t *task =
-        lv_task_create(display_content_worker, 100, LV_TASK_PRIO_LOW, dwdata);
+        lv_task_create(display_content_worker, period, LV_TASK_PRIO_LOW, dwdata);
 
     while (true) {
-        vTaskDelay(pdMS_TO_TICKS(10));
-        lv_task_handler();
+        update_lv_tick();
+        uint32_t next_ms = display_backend_task_handler();
+
+        // Sleep until LVGL's next deadline, unless a new screen or new data
+        // for the current one shows up first.
+        if (ulTaskNotifyTake(pdTRUE, ticks_until(next_ms)) > 0) {
+            lv_task_ready(task);
+        }
     }
 
     lv_task_del(task);
 }
 
-display_handle_t init_display(int screen_count) {
+display_handle_t init_display(void) {
+    return init_display_backend(display_backend_default());
+}
+
+display_handle_t init_display_backend(const display_backend_t *backend) {
     display_content_worker_data_t *dwdata =
-        calloc(1, sizeof(display_content_worker_data_t));
+        diag_calloc(DIAG_TAG_DISPLAY, 1, sizeof(display_content_worker_data_t));
     if (dwdata == NULL) {
         ESP_LOGE(display_tag, "Failed to create dwdata");
         vTaskDelay(portMAX_DELAY);
     }
-    
+
+    dwdata->backend = backend;
 
     dwdata->display_event_queue = xQueueCreate(10, sizeof(display_mode_t));
     if (dwdata->display_event_queue == NULL) {
@@ -183,7 +352,8 @@ display_handle_t init_display(int screen_count) {
         vTaskDelay(portMAX_DELAY);
     }
 
-    display_data_t *ddata = calloc(1, sizeof(display_data_t));
+    display_data_t *ddata =
+        diag_calloc(DIAG_TAG_DISPLAY, 1, sizeof(display_data_t));
     if (ddata == NULL) {
         ESP_LOGE(display_tag, "Failed to create ddata");
         vTaskDelay(portMAX_DELAY);
@@ -192,20 +362,27 @@ display_handle_t init_display(int screen_count) {
     ddata->workerdata = dwdata;
     ddata->display_event_queue = dwdata->display_event_queue;
 
-    ddata->workerdata->screen_cnt = screen_count;
-    ddata->workerdata->screen = calloc(screen_count, sizeof(screen_data_t));
+    ddata->workerdata->screen_cnt = screen_registry_count;
+    ddata->workerdata->screen =
+        diag_calloc(DIAG_TAG_DISPLAY,
+                    screen_registry_count, sizeof(screen_data_t));
 
     if (ddata->workerdata->screen == NULL) {
         ESP_LOGE(display_tag, "Failed to create the ddata->workerdata->screen");
         vTaskDelay(portMAX_DELAY);
     }
 
+    for (int i = 0; i < screen_registry_count; i++) {
+        ddata->workerdata->screen[i].desc = screen_registry[i];
+    }
+
     BaseType_t ret = xTaskCreatePinnedToCore(&display_worker, display_tag, 4 * 1024,
                                     dwdata, 3, &ddata->display_task, 1);
     if (ret != pdTRUE) {
         ESP_LOGE(display_tag, "Failed to create the display_task");
         vTaskDelay(portMAX_DELAY);
     }
+    diag_register_task(ddata->display_task, display_tag, 4 * 1024);
 
     return ddata;
 }
\ No newline at end of file
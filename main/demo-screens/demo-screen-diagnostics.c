@@ -0,0 +1,109 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+
+#include "demo-screen-diagnostics.h"
+
+#include "diagnostics.h"
+
+#define DIAG_TEXT_SIZE 512
+
+typedef struct diagnostics_screen {
+    lv_obj_t *win;
+    lv_obj_t *label;
+    char text[DIAG_TEXT_SIZE];
+} diagnostics_screen_t;
+
+static const char *tag = "diagnostics_screen";
+
+void *diagnostics_screen_init(lv_obj_t *screen) {
+    diagnostics_screen_t *priv =
+        diag_calloc(DIAG_TAG_SCREEN, 1, sizeof(diagnostics_screen_t));
+    if (priv == NULL) {
+        ESP_LOGE(tag, "ENOMEM allocating diagnostics screen");
+        vTaskDelay(portMAX_DELAY);
+    }
+
+    priv->win = lv_win_create(screen, NULL);
+    lv_win_set_title(priv->win, "Diagnostics");
+
+    priv->label = lv_label_create(priv->win, NULL);
+    lv_label_set_text(priv->label, "Collecting...");
+    return priv;
+}
+
+// snprintf onto the end of text, dropping whatever doesn't fit
+static size_t appendf(char *text, size_t size, size_t used, const char *fmt,
+                      ...) {
+    if (used >= size - 1) {
+        return used;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(text + used, size - used, fmt, args);
+    va_end(args);
+
+    if (len < 0 || used + len >= size) {
+        text[used] = '\0';
+        return used;
+    }
+    return used + len;
+}
+
+void diagnostics_screen_worker(lv_obj_t *screen, void *priv) {
+    diagnostics_screen_t *pdata = priv;
+    char *text = pdata->text;
+    size_t size = sizeof(pdata->text);
+    size_t used = 0;
+
+    // Everything in KB except stacks, or it doesn't fit across the panel
+    diag_heap_stats_t heap;
+    diag_get_heap(&heap);
+    used = appendf(text, size, used, "Heap %uK min %uK blk %uK\n",
+                   (unsigned)(heap.free / 1024),
+                   (unsigned)(heap.minimum_free / 1024),
+                   (unsigned)(heap.largest_block / 1024));
+    used = appendf(text, size, used, "LVGL %uK/%uK peak %uK frag %u%%\n",
+                   (unsigned)((heap.lv_total - heap.lv_free) / 1024),
+                   (unsigned)(heap.lv_total / 1024),
+                   (unsigned)(heap.lv_max_used / 1024), heap.lv_frag_pct);
+
+    diag_task_stats_t tasks[DIAG_MAX_TASKS];
+    size_t task_cnt = diag_get_tasks(tasks, DIAG_MAX_TASKS);
+    for (size_t i = 0; i < task_cnt; i++) {
+        used = appendf(text, size, used, "%.14s %u/%u free\n", tasks[i].name,
+                       (unsigned)tasks[i].stack_free,
+                       (unsigned)tasks[i].stack_size);
+    }
+
+    for (diag_tag_t t = 0; t < DIAG_TAG_MAX; t++) {
+        diag_alloc_stats_t stats;
+        diag_get_allocs(t, &stats);
+        used = appendf(text, size, used, "%s %uK peak %uK%s\n",
+                       diag_tag_name(t), (unsigned)(stats.bytes / 1024),
+                       (unsigned)(stats.peak / 1024),
+                       stats.failures ? " FAILED" : "");
+    }
+
+    lv_label_set_text(pdata->label, text);
+}
+
+void diagnostics_screen_release(lv_obj_t *screen, void *priv) {
+    diag_free(priv);
+}
+
+// Cheap to rebuild, so it doesn't hang around
+const screen_desc_t diagnostics_screen = {
+    .name = "diagnostics",
+    .init_cb = diagnostics_screen_init,
+    .tick_cb = diagnostics_screen_worker,
+    .release_cb = diagnostics_screen_release,
+    .tick_period_ms = 1000,
+    .idle_timeout_us = 10 * 1000000LL,
+    .mem_budget = 3 * 1024,
+    // The whole label is set every second, most of it to the same text
+    .frame_diff = true,
+};
@@ -1,25 +1,37 @@
+#include <stdlib.h>
+
 #include "demo-screen-hello-world.h"
+#include "diagnostics.h"
+#include "text-field.h"
 
 typedef struct hello_world_data {
     uint32_t call_cnt;
     lv_obj_t *window;
-    lv_obj_t *text_area;
+    text_field_t count;
 } hello_world_data_t;
 
+// Mostly only the last digit changes, so that's mostly all that's redrawn
 void hello_world_screen_worker(lv_obj_t *screen, void *priv) {
     hello_world_data_t *pdata = priv;
-    char cnt[] = "0xFFFFFFFF";
-    sprintf(cnt, "0x%x", pdata->call_cnt++);
-    lv_textarea_set_text(pdata->text_area, cnt);
+    text_field_printf(&pdata->count, "0x%x", pdata->call_cnt++);
 }
 
 void *hello_world_screen_init(lv_obj_t *screen) {
-    hello_world_data_t *priv = calloc(1, sizeof(hello_world_data_t));
+    hello_world_data_t *priv =
+        diag_calloc(DIAG_TAG_SCREEN, 1, sizeof(hello_world_data_t));
 
     priv->window = lv_win_create(screen, NULL);
     lv_win_set_title(priv->window, "Hello World!");
 
-    priv->text_area = lv_textarea_create(priv->window, NULL);
-    lv_textarea_set_text(priv->text_area, "Counting starting...");
+    text_field_init(&priv->count, priv->window, lv_win_get_width(priv->window),
+                    "Counting starting...");
     return priv;
 }
+
+const screen_desc_t hello_world_screen = {
+    .name = "hello-world",
+    .init_cb = hello_world_screen_init,
+    .tick_cb = hello_world_screen_worker,
+    .tick_period_ms = 100,
+    .mem_budget = 3 * 1024,
+};
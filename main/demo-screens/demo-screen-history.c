@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "demo-screen-history.h"
+
+#include "battery-history.h"
+#include "task-voltage.h"
+#include "diagnostics.h"
+
+// Points pulled from the history per redraw, then LTTB'd down to what's
+// drawn.  The query buffer only exists while redrawing.
+#define HISTORY_QUERY_POINTS 256
+#define HISTORY_CHART_POINTS 48
+#define HISTORY_CHART_WIDTH (LV_HOR_RES_MAX - 20)
+#define HISTORY_CHART_HEIGHT 120
+#define HISTORY_SPAN (24 * 60 * 60)
+#define HISTORY_REDRAW_US (5 * 1000000)
+
+typedef struct history_screen {
+    lv_obj_t *win;
+    lv_obj_t *line;
+    lv_obj_t *range;
+    lv_obj_t *span;
+    uint32_t version;
+    int64_t drawn_at;
+    lv_point_t points[HISTORY_CHART_POINTS];
+    adc_handle_t adc_data;
+} history_screen_t;
+
+static const char *tag = "history_screen";
+
+void *history_screen_init(lv_obj_t *screen) {
+    history_screen_t *priv =
+        diag_calloc(DIAG_TAG_SCREEN, 1, sizeof(history_screen_t));
+    if (priv == NULL) {
+        ESP_LOGE(tag, "ENOMEM allocating history screen");
+        vTaskDelay(portMAX_DELAY);
+    }
+
+    // Make sure something is recording
+    voltage_worker_init(&priv->adc_data);
+
+    priv->win = lv_win_create(screen, NULL);
+    lv_win_set_title(priv->win, "Battery");
+
+    priv->range = lv_label_create(priv->win, NULL);
+    lv_label_set_text(priv->range, "No readings yet");
+
+    priv->line = lv_line_create(priv->win, NULL);
+    lv_line_set_auto_size(priv->line, false);
+    lv_obj_set_size(priv->line, HISTORY_CHART_WIDTH, HISTORY_CHART_HEIGHT);
+    lv_obj_align(priv->line, priv->range, LV_ALIGN_OUT_BOTTOM_LEFT, 0, 4);
+
+    priv->span = lv_label_create(priv->win, NULL);
+    lv_label_set_text(priv->span, "");
+    lv_obj_align(priv->span, priv->line, LV_ALIGN_OUT_BOTTOM_LEFT, 0, 4);
+    return priv;
+}
+
+static void redraw(history_screen_t *pdata, battery_history_handle_t history) {
+    battery_point_t *query =
+        diag_malloc(DIAG_TAG_SCREEN,
+                    HISTORY_QUERY_POINTS * sizeof(battery_point_t));
+    battery_point_t picked[HISTORY_CHART_POINTS];
+    if (query == NULL) {
+        ESP_LOGE(tag, "ENOMEM allocating history query");
+        return;
+    }
+
+    size_t n = battery_history_get(history, HISTORY_SPAN, query,
+                                   HISTORY_QUERY_POINTS);
+    n = battery_history_lttb(query, n, picked, HISTORY_CHART_POINTS);
+    diag_free(query);
+    if (n < 2) {
+        return;
+    }
+
+    uint16_t lo = UINT16_MAX, hi = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (picked[i].mv < lo) lo = picked[i].mv;
+        if (picked[i].mv > hi) hi = picked[i].mv;
+    }
+    // Keep flat lines in the middle, and noise from filling the chart
+    if (hi - lo < 100) {
+        int mid = (hi + lo) / 2;
+        lo = mid > 50 ? mid - 50 : 0;
+        hi = mid + 50;
+    }
+
+    int32_t t0 = picked[0].time;
+    int32_t span = picked[n - 1].time - t0;
+    for (size_t i = 0; i < n; i++) {
+        pdata->points[i].x = span ? (int64_t)(picked[i].time - t0) *
+                                        (HISTORY_CHART_WIDTH - 1) / span
+                                  : 0;
+        pdata->points[i].y = (int32_t)(hi - picked[i].mv) *
+                             (HISTORY_CHART_HEIGHT - 1) / (hi - lo);
+    }
+    lv_line_set_points(pdata->line, pdata->points, n);
+
+    char text[] = "00.00V - 00.00V";
+    snprintf(text, sizeof(text), "%d.%02dV - %d.%02dV", lo / 1000,
+             (lo % 1000) / 10, hi / 1000, (hi % 1000) / 10);
+    lv_label_set_text(pdata->range, text);
+
+    char span_text[] = "Last 0000h00m";
+    snprintf(span_text, sizeof(span_text), "Last %dh%02dm",
+             (int)(span / 3600) % 10000, (int)(span / 60) % 60);
+    lv_label_set_text(pdata->span, span_text);
+}
+
+void history_screen_worker(lv_obj_t *screen, void *priv) {
+    history_screen_t *pdata = priv;
+    battery_history_handle_t history = voltage_task_history();
+    if (history == NULL) {
+        return;
+    }
+
+    // New readings come in every few seconds at most, and a redraw walks
+    // the whole history, so don't chase every one of them.
+    uint32_t version = battery_history_version(history);
+    int64_t now = esp_timer_get_time();
+    if (version == pdata->version ||
+        (pdata->drawn_at && now - pdata->drawn_at < HISTORY_REDRAW_US)) {
+        return;
+    }
+
+    pdata->version = version;
+    pdata->drawn_at = now;
+    redraw(pdata, history);
+}
+
+void history_screen_release(lv_obj_t *screen, void *priv) {
+    diag_free(priv);
+}
+
+// Redraws are rate limited by the worker anyway
+const screen_desc_t history_screen = {
+    .name = "battery-history",
+    .init_cb = history_screen_init,
+    .tick_cb = history_screen_worker,
+    .release_cb = history_screen_release,
+    .tick_period_ms = 1000,
+    .idle_timeout_us = 30 * 1000000LL,
+    .mem_budget = 16 * 1024,
+};
@@ -1,24 +1,32 @@
 #include "demo-screen-voltage.h"
 
 #include "task-voltage.h"
+#include "diagnostics.h"
+#include "text-field.h"
 
 typedef struct voltage_screen {
     lv_obj_t *win;
-    lv_obj_t *text_area;
+    text_field_t volts;
+    text_field_t state;
     adc_handle_t adc_data;
     QueueHandle_t readings;
 } voltage_screen_t;
 
 void *voltage_screen_init(lv_obj_t *screen) {
-    voltage_screen_t *priv = calloc(1, sizeof(voltage_screen_t));
+    voltage_screen_t *priv =
+        diag_calloc(DIAG_TAG_SCREEN, 1, sizeof(voltage_screen_t));
 
     priv->win = lv_win_create(screen, NULL);
     lv_win_set_title(priv->win, "Voltage!");
 
-    priv->text_area = lv_textarea_create(priv->win, NULL);
-    lv_textarea_set_text(priv->text_area, "Voltage starting...");
+    lv_coord_t width = lv_win_get_width(priv->win);
+    text_field_init(&priv->volts, priv->win, width, "Voltage starting...");
+    text_field_init(&priv->state, priv->win, width, "");
+    lv_obj_align(priv->state.label, priv->volts.label,
+                 LV_ALIGN_OUT_BOTTOM_LEFT, 0, 0);
 
     priv->readings = voltage_worker_init(&priv->adc_data);
+    voltage_task_set_notify(priv->adc_data, display_notify);
     return priv;
 }
 
@@ -26,14 +34,10 @@ void voltage_screen_worker(lv_obj_t *screen, void *priv) {
     voltage_screen_t *pdata = priv;
     adc_reading_t newval = {0};
     if(xQueueReceive(pdata->readings, &newval, 0) == pdTRUE) {
-        char volts[] = "-0.000V";
-        sprintf(volts, "%0.3fV", newval.reading);
-        lv_textarea_set_text(pdata->text_area, volts);
-        if(newval.charging) {
-            lv_textarea_add_text(pdata->text_area, "\nCharging");
-        } else {
-            lv_textarea_add_text(pdata->text_area, "\nDischarging");
-        }
+        text_field_printf(&pdata->volts, "%0.3fV +/-%umV", newval.reading,
+                          (unsigned)(newval.noise * 1000 + 0.5f) % 10000);
+        text_field_set(&pdata->state,
+                       newval.charging ? "Charging" : "Discharging");
     }
 }
 
@@ -45,4 +49,23 @@ void voltage_screen_load(lv_obj_t *screen, void *priv) {
 void voltage_screen_unload(lv_obj_t *screen, void *priv) {
     voltage_screen_t *pdata = priv;
     voltage_task_stop(pdata->adc_data);
-}
\ No newline at end of file
+}
+
+// The ADC worker keeps running for the battery history, only the screen's
+// own state goes.
+void voltage_screen_release(lv_obj_t *screen, void *priv) {
+    diag_free(priv);
+}
+
+// Ticks whenever the ADC worker posts a reading.  Building it the first time
+// also starts the ADC worker.
+const screen_desc_t voltage_screen = {
+    .name = "voltage",
+    .init_cb = voltage_screen_init,
+    .load_cb = voltage_screen_load,
+    .unload_cb = voltage_screen_unload,
+    .tick_cb = voltage_screen_worker,
+    .release_cb = voltage_screen_release,
+    .idle_timeout_us = 30 * 1000000LL,
+    .mem_budget = 16 * 1024,
+};
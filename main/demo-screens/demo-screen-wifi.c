@@ -1,35 +1,79 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
 
+#include "esp_netif.h"
 
 #include "demo-screen-common.h"
 
 #include "task-wifi.h"
+#include "diagnostics.h"
+#include "log-view.h"
 
 typedef struct wifi_screen {
     lv_obj_t *win;
-    lv_obj_t *text_area;
     QueueHandle_t msg_queue;
+    log_view_t log;
 } wifi_screen_t;
 
 void *wifi_screen_init(lv_obj_t *screen) {
-    wifi_screen_t *priv = calloc(1, sizeof(wifi_screen_t));
+    wifi_screen_t *priv =
+        diag_calloc(DIAG_TAG_SCREEN, 1, sizeof(wifi_screen_t));
 
     priv->win = lv_win_create(screen, NULL);
     lv_win_set_title(priv->win, "WiFi!");
 
-    priv->text_area = lv_textarea_create(priv->win, NULL);
-    lv_textarea_set_text(priv->text_area, "Wifi starting...");
+    log_view_init(&priv->log, priv->win, lv_win_get_width(priv->win),
+                  lv_obj_get_height_fit(lv_win_get_content(priv->win)));
+    log_view_add(&priv->log, "Wifi starting...");
 
+    wifi_set_notify(display_notify);
     priv->msg_queue = wifi_init("SomeSSID", "SomePASS");
     return priv;
 }
 
 void wifi_screen_worker(lv_obj_t *screen, void *priv) {
     wifi_screen_t *pdata = priv;
-    char *msg = NULL;
-    if(xQueueReceive(pdata->msg_queue, &msg, pdMS_TO_TICKS(10)) == pdTRUE) {
-        lv_textarea_add_text(pdata->text_area, "\n");
-        lv_textarea_add_text(pdata->text_area, msg);
-        free(msg);
+    wifi_status_t status;
+    // Notifications collapse into one wakeup, so take everything queued
+    while (xQueueReceive(pdata->msg_queue, &status, 0) == pdTRUE) {
+        char line[] = "retry 00000 in 00.0s r000";
+        switch (status.state) {
+            case WIFI_STATE_CONNECTING:
+                snprintf(line, sizeof(line), "try AP connect");
+                break;
+            case WIFI_STATE_CONNECTED:
+                snprintf(line, sizeof(line), "connected ch %u %ddBm",
+                         status.channel, status.rssi);
+                break;
+            case WIFI_STATE_DISCONNECTED:
+                snprintf(line, sizeof(line),
+                         "retry %u in %" PRIu32 ".%" PRIu32 "s r%u",
+                         status.retries, status.backoff_ms / 1000,
+                         (status.backoff_ms % 1000) / 100, status.reason);
+                break;
+            case WIFI_STATE_GOT_IP: {
+                esp_ip4_addr_t ip = {.addr = status.ip};
+                snprintf(line, sizeof(line), IPSTR, IP2STR(&ip));
+            } break;
+        }
+        log_view_add(&pdata->log, line);
     }
-    
-}
\ No newline at end of file
+}
+
+void wifi_screen_release(lv_obj_t *screen, void *priv) {
+    wifi_screen_t *pdata = priv;
+    wifi_deinit(pdata->msg_queue);
+    diag_free(pdata);
+}
+
+// Brings up NVS, netif and the whole Wi-Fi stack, so only while it's being
+// looked at (and for a minute after).
+const screen_desc_t wifi_screen = {
+    .name = "wifi",
+    .init_cb = wifi_screen_init,
+    .tick_cb = wifi_screen_worker,
+    .release_cb = wifi_screen_release,
+    .idle_timeout_us = 60 * 1000000LL,
+    .mem_budget = 96 * 1024,
+};
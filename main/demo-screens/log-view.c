@@ -0,0 +1,79 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log-view.h"
+
+static uint32_t kept(const log_view_t *view) {
+    return view->added < LOG_VIEW_HISTORY ? view->added : LOG_VIEW_HISTORY;
+}
+
+// Newest line at the bottom row.  Rows whose text didn't change aren't
+// touched.
+static void render(log_view_t *view) {
+    for (int row = 0; row < view->row_cnt; row++) {
+        uint32_t back = view->scroll + (view->row_cnt - 1 - row);
+        const char *text = "";
+        if (back < kept(view)) {
+            uint32_t line = view->added - 1 - back;
+            text = view->lines[line & (LOG_VIEW_HISTORY - 1)];
+        }
+        text_field_set(&view->rows[row], text);
+    }
+}
+
+void log_view_init(log_view_t *view, lv_obj_t *parent, lv_coord_t width,
+                   lv_coord_t height) {
+    memset(view, 0, sizeof(log_view_t));
+
+    for (int row = 0; row < LOG_VIEW_MAX_ROWS; row++) {
+        text_field_t *field = &view->rows[row];
+        text_field_init(field, parent, width, "");
+
+        lv_coord_t line_height = lv_obj_get_height(field->label);
+        lv_obj_set_pos(field->label, 0, row * line_height);
+        view->row_cnt++;
+
+        if ((row + 2) * line_height > height) {
+            break;
+        }
+    }
+}
+
+void log_view_add(log_view_t *view, const char *line) {
+    char *slot = view->lines[view->added & (LOG_VIEW_HISTORY - 1)];
+    strncpy(slot, line, TEXT_FIELD_SIZE - 1);
+    slot[TEXT_FIELD_SIZE - 1] = '\0';
+    view->added++;
+
+    if (view->scroll != 0) {
+        // Stay on the same lines, as long as they're still kept
+        log_view_scroll(view, 1);
+        return;
+    }
+    render(view);
+}
+
+void log_view_printf(log_view_t *view, const char *fmt, ...) {
+    char line[TEXT_FIELD_SIZE];
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    log_view_add(view, line);
+}
+
+void log_view_scroll(log_view_t *view, int lines) {
+    int64_t scroll = (int64_t)view->scroll + lines;
+    int64_t max = kept(view) > view->row_cnt ? kept(view) - view->row_cnt : 0;
+
+    if (scroll < 0) {
+        scroll = 0;
+    } else if (scroll > max) {
+        scroll = max;
+    }
+    view->scroll = scroll;
+    render(view);
+}
@@ -0,0 +1,25 @@
+#include "demo-screen-common.h"
+#include "demo-screen-color-rotate.h"
+#include "demo-screen-diagnostics.h"
+#include "demo-screen-hello-world.h"
+#include "demo-screen-history.h"
+#include "demo-screen-voltage.h"
+#include "demo-screen-wifi.h"
+
+// Button order.  A new screen only needs its descriptor added here.
+const screen_desc_t *const screen_registry[] = {
+    &hello_world_screen,
+    &color_rotate_screen,
+    &voltage_screen,
+    &wifi_screen,
+    &history_screen,
+    &diagnostics_screen,
+};
+
+#define SCREEN_REGISTRY_COUNT \
+    (sizeof(screen_registry) / sizeof(screen_registry[0]))
+
+_Static_assert(SCREEN_REGISTRY_COUNT <= DISPLAY_MAX_SCREENS,
+               "more screens than display metrics slots");
+
+const uint8_t screen_registry_count = SCREEN_REGISTRY_COUNT;
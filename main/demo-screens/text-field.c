@@ -0,0 +1,65 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "text-field.h"
+
+void text_field_init(text_field_t *field, lv_obj_t *parent, lv_coord_t width,
+                     const char *text) {
+    memset(field, 0, sizeof(text_field_t));
+
+    field->label = lv_label_create(parent, NULL);
+    // Cropped to a fixed size, so a new value never resizes (and re-lays
+    // out) the label or anything aligned to it.
+    lv_label_set_long_mode(field->label, LV_LABEL_LONG_CROP);
+    const lv_font_t *font =
+        lv_obj_get_style_text_font(field->label, LV_LABEL_PART_MAIN);
+    if (width == 0) {
+        width = lv_obj_get_width_fit(parent);
+    }
+    lv_obj_set_size(field->label, width, lv_font_get_line_height(font));
+
+    lv_label_set_text_static(field->label, field->text);
+    text_field_set(field, text);
+}
+
+bool text_field_set(text_field_t *field, const char *text) {
+    size_t len = strnlen(text, TEXT_FIELD_SIZE - 1);
+
+    size_t first = 0;
+    while (first < len && first < field->len &&
+           text[first] == field->text[first]) {
+        first++;
+    }
+    if (first == len && len == field->len) {
+        return false;
+    }
+
+    memcpy(field->text, text, len);
+    field->text[len] = '\0';
+    field->len = len;
+
+    // Glyphs after the first change can move if widths differ, so the rest
+    // of the line goes too.  Everything before it is untouched.
+    lv_point_t pos;
+    lv_label_get_letter_pos(field->label, first, &pos);
+
+    lv_area_t area;
+    lv_obj_get_coords(field->label, &area);
+    area.x1 += pos.x;
+    if (area.x1 <= area.x2) {
+        lv_obj_invalidate_area(field->label, &area);
+    }
+    return true;
+}
+
+bool text_field_printf(text_field_t *field, const char *fmt, ...) {
+    char text[TEXT_FIELD_SIZE];
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    return text_field_set(field, text);
+}
@@ -0,0 +1,949 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "lvgl_tft/disp_spi.h"
+#include "lvgl_tft/st7789.h"
+
+#include "sdkconfig.h"
+
+#include "demo-screen-common.h"
+#include "display-backend.h"
+#include "display-coalesce.h"
+#include "display-diff.h"
+#include "display-snapshot.h"
+#include "display-solid.h"
+#include "diagnostics.h"
+#include "tracer.h"
+
+#define METRICS_SCREENS DISPLAY_MAX_SCREENS
+
+typedef enum flush_job_kind {
+    FLUSH_JOB_FLUSH,
+    FLUSH_JOB_FILL,
+    FLUSH_JOB_SKIP, // Already on the panel, only needs flush_ready
+    FLUSH_JOB_WINDOWS,
+} flush_job_kind_t;
+
+typedef struct flush_job {
+    flush_job_kind_t kind;
+    bool last;
+    uint8_t screen;
+    bool frame_diff;
+    bool solid_fill;
+    lv_area_t area;
+    lv_color_t *color_map;
+    lv_color_t color;
+    display_diff_windows_t windows; // FLUSH_JOB_WINDOWS only
+} flush_job_t;
+
+// What the display task can ask of whoever runs the jobs
+#define STAGE_RESET_DIFF (1 << 0)
+#define STAGE_RESET_SOLID (1 << 1)
+#define STAGE_ACTIVATE (1 << 2) // display_snapshot_activate(activate_screen)
+
+typedef struct display_backend_data {
+    const display_backend_t *backend;
+    lv_disp_drv_t *drv;
+    SemaphoreHandle_t metrics_lock;
+    bool coalescing;
+    bool solid_fill;
+    bool mirror;
+    bool pipelined;
+    bool frame_diff;
+    bool frame_diff_forced;
+
+    // Stage state: the diff table, solid cache, snapshots and these.  Owned
+    // by whoever runs the jobs, the flush task when pipelined.  The display
+    // task only touches them with the flush task idle, once LVGL's buffer
+    // is back, and otherwise asks through stage_requests.
+    display_solid_cache_t solid_cache;
+    // Changed windows gathered out of LVGL's buffer, one buffer's worth.
+    // Free again by the next flush, LVGL waits for flush-ready first.
+    lv_color_t *window_buf;
+    // What the jobs sent this frame, folded into pending by commit_frame
+    display_frame_stats_t job_stats;
+
+    QueueHandle_t flush_queue;
+    SemaphoreHandle_t frame_sent; // The flush task is done with the frame
+
+    // Under sent_mux, also taken in the flush-ready interrupt
+    int64_t send_started_at; // Of the area being sent, 0 when none is
+    bool send_last;
+    int64_t sent_us;       // Flush calls to flush-ready, this frame
+    int64_t frame_sent_at; // Flush-ready of its last area
+    // Also under sent_mux, applied before the next job
+    uint32_t stage_requests;
+    uint32_t snapshot_drops; // Bit per screen
+    uint8_t activate_screen;
+
+    uint8_t screen;
+    uint32_t handler_calls;
+    int64_t invalidated_at;
+    int64_t frame_invalidated_at;
+    int64_t handler_started_at;
+    int64_t frame_started_at;
+
+    // For utilization, since install
+    int64_t installed_at;
+    int64_t render_busy_us; // In lv_task_handler() on the display task
+    int64_t flush_busy_us;  // Sending, wherever that happens
+    bool frame_done;
+    display_frame_stats_t pending;
+    display_metrics_t metrics[METRICS_SCREENS];
+} display_backend_data_t;
+
+static const char *backend_tag = "display_backend";
+static const char *flush_tag = "display_flush";
+static const display_backend_t *default_backend = &DISPLAY_DEFAULT_BACKEND;
+static display_backend_data_t backend_data = {
+    .coalescing = true, .solid_fill = true, .pipelined = DISPLAY_PIPELINE};
+
+static portMUX_TYPE sent_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static lv_color_t *headless_fb;
+
+static void headless_init(void) {
+    if (headless_fb != NULL) {
+        return;
+    }
+    headless_fb =
+        diag_calloc(DIAG_TAG_DISPLAY,
+                    LV_HOR_RES_MAX * LV_VER_RES_MAX, sizeof(lv_color_t));
+    if (headless_fb == NULL) {
+        ESP_LOGE(backend_tag, "ENOMEM allocating headless framebuffer");
+        vTaskDelay(portMAX_DELAY);
+    }
+}
+
+static void headless_copy(const lv_area_t *area, const lv_color_t *color_map) {
+    lv_area_t screen = {0, 0, LV_HOR_RES_MAX - 1, LV_VER_RES_MAX - 1};
+    lv_area_t clipped;
+    if (_lv_area_intersect(&clipped, area, &screen)) {
+        uint32_t src_width = lv_area_get_width(area);
+        uint32_t width = lv_area_get_width(&clipped);
+        for (lv_coord_t y = clipped.y1; y <= clipped.y2; y++) {
+            const lv_color_t *src = color_map +
+                                    (y - area->y1) * src_width +
+                                    (clipped.x1 - area->x1);
+            memcpy(&headless_fb[y * LV_HOR_RES_MAX + clipped.x1], src,
+                   width * sizeof(lv_color_t));
+        }
+    }
+}
+
+static void headless_flush(lv_disp_drv_t *drv, const lv_area_t *area,
+                           lv_color_t *color_map) {
+    headless_copy(area, color_map);
+    lv_disp_flush_ready(drv);
+}
+
+static void headless_flush_windows(lv_disp_drv_t *drv,
+                                   const lv_area_t *windows, uint8_t count,
+                                   lv_color_t *color_map) {
+    for (uint8_t i = 0; i < count; i++) {
+        headless_copy(&windows[i], color_map);
+        color_map += lv_area_get_size(&windows[i]);
+    }
+    lv_disp_flush_ready(drv);
+}
+
+static void headless_fill(lv_disp_drv_t *drv, const lv_area_t *area,
+                          lv_color_t color) {
+    lv_area_t screen = {0, 0, LV_HOR_RES_MAX - 1, LV_VER_RES_MAX - 1};
+    lv_area_t clipped;
+    if (_lv_area_intersect(&clipped, area, &screen)) {
+        for (lv_coord_t y = clipped.y1; y <= clipped.y2; y++) {
+            lv_color_t *dst = &headless_fb[y * LV_HOR_RES_MAX];
+            for (lv_coord_t x = clipped.x1; x <= clipped.x2; x++) {
+                dst[x] = color;
+            }
+        }
+    }
+    lv_disp_flush_ready(drv);
+}
+
+#if CONFIG_LV_TFT_DISPLAY_OFFSETS
+#define ST7789_X_OFFSET CONFIG_LV_TFT_DISPLAY_X_OFFSET
+#define ST7789_Y_OFFSET CONFIG_LV_TFT_DISPLAY_Y_OFFSET
+#else
+#define ST7789_X_OFFSET 0
+#define ST7789_Y_OFFSET 0
+#endif
+
+// Solid areas go out from here rather than LVGL's buffer, repeated across
+// the window, so LVGL can have its buffer back before they're sent.
+#define ST7789_FILL_PIXELS (LV_HOR_RES_MAX * 8)
+static DMA_ATTR lv_color_t st7789_pattern[ST7789_FILL_PIXELS];
+
+// Polled, like the driver's own commands
+static void st7789_command(uint8_t cmd, const uint8_t *data, size_t len) {
+    gpio_set_level(ST7789_DC, 0);
+    disp_spi_send_data(&cmd, 1);
+    if (len > 0) {
+        gpio_set_level(ST7789_DC, 1);
+        disp_spi_send_data((uint8_t *)data, len);
+    }
+}
+
+// CASET/RASET/RAMWR, leaving DC set for the pixels.  DC can't change under
+// a queued transaction, so anything queued has to be out first.
+static void st7789_window(const lv_area_t *area) {
+    disp_wait_for_pending_transactions();
+
+    uint16_t x1 = area->x1 + ST7789_X_OFFSET, x2 = area->x2 + ST7789_X_OFFSET;
+    uint16_t y1 = area->y1 + ST7789_Y_OFFSET, y2 = area->y2 + ST7789_Y_OFFSET;
+    uint8_t cols[4] = {x1 >> 8, x1 & 0xff, x2 >> 8, x2 & 0xff};
+    uint8_t rows[4] = {y1 >> 8, y1 & 0xff, y2 >> 8, y2 & 0xff};
+    st7789_command(ST7789_CASET, cols, sizeof(cols));
+    st7789_command(ST7789_RASET, rows, sizeof(rows));
+    st7789_command(ST7789_RAMWR, NULL, 0);
+
+    gpio_set_level(ST7789_DC, 1);
+}
+
+// The panel has no fill command, the bytes on the wire are the same as a
+// flush.  One window, then the pattern queued as many times as it takes to
+// cover it.
+static void st7789_fill(lv_disp_drv_t *drv, const lv_area_t *area,
+                        lv_color_t color) {
+    // The last fill may still be going out of the pattern
+    disp_wait_for_pending_transactions();
+
+    uint32_t remaining = lv_area_get_size(area);
+    uint32_t chunk = LV_MATH_MIN(remaining, ST7789_FILL_PIXELS);
+    for (uint32_t i = 0; i < chunk; i++) {
+        st7789_pattern[i] = color;
+    }
+
+    st7789_window(area);
+    while (remaining > 0) {
+        uint32_t pixels = LV_MATH_MIN(remaining, chunk);
+        disp_spi_transaction((const uint8_t *)st7789_pattern,
+                             pixels * sizeof(lv_color_t),
+                             DISP_SPI_SEND_QUEUED, NULL, 0, 0);
+        remaining -= pixels;
+    }
+
+    // Nothing of LVGL's is being sent
+    lv_disp_flush_ready(drv);
+}
+
+// Each window's pixels are queued behind its commands; only the last one
+// signals flush-ready, from the SPI interrupt once it's out.
+static void st7789_flush_windows(lv_disp_drv_t *drv, const lv_area_t *windows,
+                                 uint8_t count, lv_color_t *color_map) {
+    for (uint8_t i = 0; i < count; i++) {
+        uint32_t pixels = lv_area_get_size(&windows[i]);
+        st7789_window(&windows[i]);
+        disp_spi_send_flag_t flags = DISP_SPI_SEND_QUEUED;
+        if (i == count - 1) {
+            flags |= DISP_SPI_SIGNAL_FLUSH;
+        }
+        disp_spi_transaction((const uint8_t *)color_map,
+                             pixels * sizeof(lv_color_t), flags, NULL, 0, 0);
+        color_map += pixels;
+    }
+}
+
+const display_backend_t st7789_backend = {
+    .name = "st7789",
+    .init = NULL, // lvgl_driver_init() already brought the panel up
+    .flush = st7789_flush,
+    .fill = st7789_fill,
+    .flush_windows = st7789_flush_windows,
+    .wait = disp_wait_for_pending_transactions,
+};
+
+const display_backend_t headless_backend = {
+    .name = "headless",
+    .init = headless_init,
+    .flush = headless_flush,
+    .fill = headless_fill,
+    .flush_windows = headless_flush_windows,
+};
+
+const lv_color_t *display_headless_framebuffer(void) { return headless_fb; }
+
+static void add_stats(display_frame_stats_t *total,
+                      const display_frame_stats_t *frame) {
+    total->handler_us += frame->handler_us;
+    total->handoff_us += frame->handoff_us;
+    total->flush_us += frame->flush_us;
+    total->frame_us += frame->frame_us;
+    total->latency_us += frame->latency_us;
+    total->areas += frame->areas;
+    total->pixels += frame->pixels;
+    total->bytes += frame->bytes;
+    total->transactions_saved += frame->transactions_saved;
+    total->bytes_saved += frame->bytes_saved;
+    total->solid_areas += frame->solid_areas;
+    total->solid_skipped += frame->solid_skipped;
+    total->diff_tiles += frame->diff_tiles;
+    total->diff_unchanged += frame->diff_unchanged;
+    total->diff_windows += frame->diff_windows;
+    total->diff_collisions += frame->diff_collisions;
+    total->diff_bytes_saved += frame->diff_bytes_saved;
+    total->diff_us += frame->diff_us;
+}
+
+static void max_stats(display_frame_stats_t *max,
+                      const display_frame_stats_t *frame) {
+    if (frame->handler_us > max->handler_us) max->handler_us = frame->handler_us;
+    if (frame->handoff_us > max->handoff_us) max->handoff_us = frame->handoff_us;
+    if (frame->flush_us > max->flush_us) max->flush_us = frame->flush_us;
+    if (frame->frame_us > max->frame_us) max->frame_us = frame->frame_us;
+    if (frame->latency_us > max->latency_us) max->latency_us = frame->latency_us;
+    if (frame->areas > max->areas) max->areas = frame->areas;
+    if (frame->pixels > max->pixels) max->pixels = frame->pixels;
+    if (frame->bytes > max->bytes) max->bytes = frame->bytes;
+    if (frame->transactions_saved > max->transactions_saved)
+        max->transactions_saved = frame->transactions_saved;
+    if (frame->bytes_saved > max->bytes_saved)
+        max->bytes_saved = frame->bytes_saved;
+    if (frame->solid_areas > max->solid_areas)
+        max->solid_areas = frame->solid_areas;
+    if (frame->solid_skipped > max->solid_skipped)
+        max->solid_skipped = frame->solid_skipped;
+    if (frame->diff_tiles > max->diff_tiles) max->diff_tiles = frame->diff_tiles;
+    if (frame->diff_unchanged > max->diff_unchanged)
+        max->diff_unchanged = frame->diff_unchanged;
+    if (frame->diff_windows > max->diff_windows)
+        max->diff_windows = frame->diff_windows;
+    if (frame->diff_collisions > max->diff_collisions)
+        max->diff_collisions = frame->diff_collisions;
+    if (frame->diff_bytes_saved > max->diff_bytes_saved)
+        max->diff_bytes_saved = frame->diff_bytes_saved;
+    if (frame->diff_us > max->diff_us) max->diff_us = frame->diff_us;
+}
+
+// Called by LVGL for every invalidated area.  It's the only hook LVGL v7
+// offers at invalidation time.  Areas are left alone unless frame diffing
+// wants them on its tile grid; LVGL then also sizes its stripes so they
+// stay on it.
+static void backend_rounder(lv_disp_drv_t *drv, lv_area_t *area) {
+    if (backend_data.invalidated_at == 0) {
+        backend_data.invalidated_at = esp_timer_get_time();
+    }
+    if (backend_data.frame_diff) {
+        display_diff_round(area);
+    }
+}
+
+void __real_lv_disp_flush_ready(lv_disp_drv_t *drv);
+
+// Linked with -Wl,--wrap=lv_disp_flush_ready, so every flush-ready comes
+// through here.  The ST7789's comes from lvgl_esp32_drivers' SPI
+// post-transaction interrupt once the DMA is done, so that's when an area
+// counts as sent, not when its flush returned.  A fill hands the buffer back
+// before it's sent; its DMA is counted in whichever send waits on it next.
+void IRAM_ATTR __wrap_lv_disp_flush_ready(lv_disp_drv_t *drv) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL_ISR(&sent_mux);
+    if (backend_data.send_started_at != 0) {
+        backend_data.sent_us += now - backend_data.send_started_at;
+        if (backend_data.send_last) {
+            backend_data.frame_sent_at = now;
+        }
+        backend_data.send_started_at = 0;
+    }
+    portEXIT_CRITICAL_ISR(&sent_mux);
+    __real_lv_disp_flush_ready(drv);
+}
+
+static void request_stage(uint32_t requests) {
+    portENTER_CRITICAL(&sent_mux);
+    backend_data.stage_requests |= requests;
+    portEXIT_CRITICAL(&sent_mux);
+}
+
+// Carries out what the display task asked for since the last job, on
+// whichever task owns the stage state now
+static void apply_stage_requests(void) {
+    portENTER_CRITICAL(&sent_mux);
+    uint32_t requests = backend_data.stage_requests;
+    uint32_t drops = backend_data.snapshot_drops;
+    uint8_t activate = backend_data.activate_screen;
+    backend_data.stage_requests = 0;
+    backend_data.snapshot_drops = 0;
+    portEXIT_CRITICAL(&sent_mux);
+
+    if (requests & STAGE_RESET_DIFF) {
+        display_diff_reset();
+    }
+    if (requests & STAGE_RESET_SOLID) {
+        memset(&backend_data.solid_cache, 0, sizeof(display_solid_cache_t));
+    }
+    for (uint8_t screen = 0; screen < DISPLAY_MAX_SCREENS; screen++) {
+        if (drops & (1u << screen)) {
+            display_snapshot_drop(screen);
+        }
+    }
+    if (requests & STAGE_ACTIVATE) {
+        display_snapshot_activate(activate);
+    }
+}
+
+// Allocated the first time frame diffing has several windows to send, NULL
+// if the backend can't take them or there wasn't room
+static lv_color_t *get_window_buf(void) {
+    static bool tried;
+    if (!tried && backend_data.backend->flush_windows != NULL) {
+        tried = true;
+        backend_data.window_buf =
+            diag_malloc(DIAG_TAG_DISPLAY,
+                        backend_data.drv->buffer->size * sizeof(lv_color_t));
+        if (backend_data.window_buf == NULL) {
+            ESP_LOGW(backend_tag, "No room for the window buffer, frame "
+                                  "diffs go out as one bounding box");
+        }
+    }
+    return backend_data.window_buf;
+}
+
+// Everything between LVGL handing over an area and sending it: snapshot,
+// mirror, cut it down to what changed and spot solid colors.  Decides
+// job->kind and counts into job_stats.
+static void prepare_job(flush_job_t *job) {
+    display_frame_stats_t *stats = &backend_data.job_stats;
+    lv_area_t area = job->area;
+    lv_color_t *color_map = job->color_map;
+    uint32_t rendered = lv_area_get_size(&area);
+    uint32_t pixels = rendered;
+    uint8_t windows = 1;
+
+    display_snapshot_capture(job->screen, &area, color_map);
+    if (backend_data.mirror) {
+        headless_copy(&area, color_map);
+    }
+
+    // Cut the area down to the tiles that differ from what's on the panel
+    if (job->frame_diff) {
+        int64_t diff_start = esp_timer_get_time();
+        display_diff_result_t diff = {0};
+        display_diff_windows_t *changed = &job->windows;
+        lv_color_t *window_buf;
+        if (!display_diff_area(&area, color_map, changed, &diff)) {
+            job->kind = FLUSH_JOB_SKIP;
+            windows = 0;
+        } else if (changed->count > 1 &&
+                   (window_buf = get_window_buf()) != NULL) {
+            display_diff_gather(&area, color_map, changed, window_buf);
+            job->kind = FLUSH_JOB_WINDOWS;
+            job->color_map = window_buf;
+            windows = changed->count;
+            pixels = 0;
+            for (uint8_t i = 0; i < windows; i++) {
+                pixels += lv_area_get_size(&changed->area[i]);
+            }
+        } else {
+            lv_area_t bounds = changed->area[0];
+            for (uint8_t i = 1; i < changed->count; i++) {
+                _lv_area_join(&bounds, &bounds, &changed->area[i]);
+            }
+            if (!_lv_area_is_in(&area, &bounds, 0)) {
+                display_diff_compact(&area, color_map, &bounds);
+                job->area = bounds;
+                pixels = lv_area_get_size(&bounds);
+            }
+        }
+        stats->diff_windows += windows;
+        stats->diff_tiles += diff.tiles;
+        stats->diff_unchanged += diff.unchanged;
+        stats->diff_collisions += diff.collisions;
+        stats->diff_us += esp_timer_get_time() - diff_start;
+    }
+
+    lv_color_t color;
+    if (job->kind == FLUSH_JOB_SKIP) {
+        stats->diff_bytes_saved +=
+            rendered * sizeof(lv_color_t) + DISPLAY_AREA_CMD_BYTES;
+    } else if (job->kind == FLUSH_JOB_WINDOWS) {
+        for (uint8_t i = 0; i < windows; i++) {
+            display_solid_cache_invalidate(&backend_data.solid_cache,
+                                           &job->windows.area[i]);
+        }
+    } else if (job->solid_fill &&
+               display_area_is_solid(color_map, pixels, &color)) {
+        stats->solid_areas++;
+        if (display_solid_cache_covers(&backend_data.solid_cache, &job->area,
+                                       color)) {
+            stats->solid_skipped++;
+            job->kind = FLUSH_JOB_SKIP;
+        } else if (backend_data.backend->fill != NULL) {
+            job->kind = FLUSH_JOB_FILL;
+            job->color = color;
+        }
+        display_solid_cache_add(&backend_data.solid_cache, &job->area, color);
+    } else {
+        display_solid_cache_invalidate(&backend_data.solid_cache, &job->area);
+    }
+    if (job->kind != FLUSH_JOB_SKIP && pixels != rendered) {
+        stats->diff_bytes_saved +=
+            (int64_t)(rendered - pixels) * sizeof(lv_color_t) -
+            (windows - 1) * DISPLAY_AREA_CMD_BYTES;
+    }
+
+    if (job->kind != FLUSH_JOB_SKIP) {
+        stats->pixels += pixels;
+        stats->bytes +=
+            pixels * sizeof(lv_color_t) + windows * DISPLAY_AREA_CMD_BYTES;
+    }
+}
+
+// Runs a flush job, on the display task or the flush task when pipelined.
+// LVGL's buffer stays put until flush-ready, so preparing it here still
+// overlaps rendering the next stripe when pipelined.
+static void run_job(flush_job_t *job) {
+    const display_backend_t *backend = backend_data.backend;
+    lv_disp_drv_t *drv = backend_data.drv;
+
+    apply_stage_requests();
+    prepare_job(job);
+
+    // Set before the backend runs, flush-ready can come before it returns
+    int64_t start = esp_timer_get_time();
+    portENTER_CRITICAL(&sent_mux);
+    backend_data.send_started_at = start;
+    backend_data.send_last = job->last;
+    portEXIT_CRITICAL(&sent_mux);
+
+    TRACE_BEGIN(TRACE_FLUSH_SEND, job->kind);
+    switch (job->kind) {
+        case FLUSH_JOB_SKIP:
+            lv_disp_flush_ready(drv);
+            break;
+        case FLUSH_JOB_FILL:
+            backend->fill(drv, &job->area, job->color);
+            break;
+        case FLUSH_JOB_FLUSH:
+            backend->flush(drv, &job->area, job->color_map);
+            break;
+        case FLUSH_JOB_WINDOWS:
+            backend->flush_windows(drv, job->windows.area,
+                                   job->windows.count, job->color_map);
+            break;
+    }
+    TRACE_END(TRACE_FLUSH_SEND, job->last);
+}
+
+static void flush_worker(void *param) {
+    flush_job_t job;
+    while (true) {
+        xQueueReceive(backend_data.flush_queue, &job, portMAX_DELAY);
+        run_job(&job);
+        if (job.last) {
+            xSemaphoreGive(backend_data.frame_sent);
+        }
+    }
+}
+
+static void backend_flush(lv_disp_drv_t *drv, const lv_area_t *area,
+                          lv_color_t *color_map) {
+    display_frame_stats_t *pending = &backend_data.pending;
+    // The settings as of now, they can change before a queued job runs
+    flush_job_t job = {.kind = FLUSH_JOB_FLUSH,
+                       .last = lv_disp_flush_is_last(drv),
+                       .screen = backend_data.screen,
+                       .frame_diff = backend_data.frame_diff,
+                       .solid_fill = backend_data.solid_fill,
+                       .area = *area,
+                       .color_map = color_map};
+
+    if (pending->areas == 0) {
+        backend_data.frame_started_at = backend_data.handler_started_at;
+    }
+
+    int64_t start = esp_timer_get_time();
+    TRACE_BEGIN(TRACE_FLUSH, lv_area_get_size(area));
+
+    // Pipelined, the hashing and encoding as well as the window commands
+    // and queueing the DMA happen on the other core, while LVGL renders the
+    // next stripe into its second buffer.
+    if (backend_data.pipelined) {
+        xQueueSend(backend_data.flush_queue, &job, portMAX_DELAY);
+    } else {
+        run_job(&job);
+    }
+
+    int64_t end = esp_timer_get_time();
+    pending->handoff_us += end - start;
+    TRACE_END(TRACE_FLUSH, job.last);
+
+    pending->areas++;
+    if (job.last) {
+        backend_data.frame_invalidated_at = backend_data.invalidated_at;
+        backend_data.invalidated_at = 0;
+        backend_data.frame_done = true;
+    }
+}
+
+// Waits for LVGL's buffer to come back from its last flush.  lv_refr spins
+// on this; here the backend's wait blocks until its queued sends are done,
+// or without one, a tick at a time.  The flush task has to be idle, as it
+// is between frames.
+static void wait_flushed(void) {
+    const display_backend_t *backend = backend_data.backend;
+    lv_disp_buf_t *buf = backend_data.drv->buffer;
+    while (buf->flushing) {
+        if (backend->wait != NULL) {
+            backend->wait();
+        }
+        if (buf->flushing) {
+            vTaskDelay(1);
+        }
+    }
+}
+
+static void commit_frame(void) {
+    display_metrics_t *metrics = &backend_data.metrics[backend_data.screen];
+    display_frame_stats_t *pending = &backend_data.pending;
+
+    // The frame is only on the panel once its last stripe's flush-ready has
+    // come, which can be after the flush task is done with it
+    if (backend_data.pipelined) {
+        xSemaphoreTake(backend_data.frame_sent, portMAX_DELAY);
+    }
+    wait_flushed();
+    add_stats(pending, &backend_data.job_stats);
+    memset(&backend_data.job_stats, 0, sizeof(display_frame_stats_t));
+
+    portENTER_CRITICAL(&sent_mux);
+    int64_t sent_us = backend_data.sent_us;
+    int64_t sent_at = backend_data.frame_sent_at;
+    backend_data.sent_us = 0;
+    portEXIT_CRITICAL(&sent_mux);
+
+    pending->flush_us = sent_us;
+    pending->frame_us = sent_at - backend_data.frame_started_at;
+    if (backend_data.frame_invalidated_at != 0) {
+        pending->latency_us = sent_at - backend_data.frame_invalidated_at;
+    }
+    backend_data.flush_busy_us += sent_us;
+
+    xSemaphoreTake(backend_data.metrics_lock, portMAX_DELAY);
+    metrics->frames++;
+    metrics->last = *pending;
+    add_stats(&metrics->total, pending);
+    max_stats(&metrics->max, pending);
+    xSemaphoreGive(backend_data.metrics_lock);
+
+    memset(pending, 0, sizeof(display_frame_stats_t));
+    backend_data.frame_done = false;
+}
+
+static void start_pipeline(void) {
+    backend_data.flush_queue = xQueueCreate(2, sizeof(flush_job_t));
+    backend_data.frame_sent = xSemaphoreCreateBinary();
+    if (backend_data.flush_queue == NULL || backend_data.frame_sent == NULL) {
+        ESP_LOGE(backend_tag, "Failed to create the flush pipeline");
+        vTaskDelay(portMAX_DELAY);
+    }
+
+    // Above the display task, so a handed off stripe starts going out
+    // straight away.  It logs from the snapshot and diff code, hence the
+    // stack.
+    TaskHandle_t task;
+    BaseType_t ret = xTaskCreatePinnedToCore(
+        &flush_worker, flush_tag, 4096, NULL, 4, &task, DISPLAY_FLUSH_CORE);
+    if (ret != pdTRUE) {
+        ESP_LOGE(backend_tag, "Failed to create the flush task");
+        vTaskDelay(portMAX_DELAY);
+    }
+    diag_register_task(task, flush_tag, 4096);
+}
+
+void display_backend_install(lv_disp_drv_t *drv,
+                             const display_backend_t *backend) {
+    backend_data.metrics_lock = xSemaphoreCreateMutex();
+    if (backend_data.metrics_lock == NULL) {
+        ESP_LOGE(backend_tag, "Failed to create metrics_lock");
+        vTaskDelay(portMAX_DELAY);
+    }
+
+    backend_data.backend = backend;
+    backend_data.drv = drv;
+    if (backend->init != NULL) {
+        backend->init();
+    }
+    if (backend_data.mirror) {
+        headless_init();
+    }
+
+    if (backend_data.pipelined) {
+        start_pipeline();
+    }
+
+    drv->flush_cb = backend_flush;
+    drv->rounder_cb = backend_rounder;
+    backend_data.installed_at = esp_timer_get_time();
+    ESP_LOGI(backend_tag, "Using %s display backend%s", backend->name,
+             backend_data.pipelined ? ", pipelined" : "");
+}
+
+uint32_t display_backend_task_handler(void) {
+    if (backend_data.coalescing) {
+        display_coalesce_result_t saved = {0};
+        display_coalesce_areas(lv_disp_get_default(), &saved);
+        backend_data.pending.transactions_saved += saved.transactions_saved;
+        backend_data.pending.bytes_saved += saved.bytes_saved;
+    }
+
+    uint32_t areas = backend_data.pending.areas;
+    backend_data.handler_calls++;
+
+    int64_t start = esp_timer_get_time();
+    backend_data.handler_started_at = start;
+    TRACE_BEGIN(TRACE_LV_TASK_HANDLER, areas);
+    uint32_t next = lv_task_handler();
+    TRACE_END(TRACE_LV_TASK_HANDLER, backend_data.pending.areas - areas);
+    int64_t elapsed = esp_timer_get_time() - start;
+    backend_data.render_busy_us += elapsed;
+
+    // Only calls that actually rendered something count towards a frame
+    if (backend_data.pending.areas != areas) {
+        backend_data.pending.handler_us += elapsed;
+    }
+    if (backend_data.frame_done) {
+        commit_frame();
+    }
+    return next;
+}
+
+const display_backend_t *display_backend_default(void) {
+    return default_backend;
+}
+
+void display_backend_set_default(const display_backend_t *backend) {
+    default_backend = backend;
+}
+
+void display_backend_set_frame_diff(bool enabled) {
+    enabled |= backend_data.frame_diff_forced;
+    if (enabled && !backend_data.frame_diff) {
+        // Nothing sent while it was off made it into the table
+        request_stage(STAGE_RESET_DIFF);
+    }
+    backend_data.frame_diff = enabled;
+}
+
+void display_backend_force_frame_diff(bool verify) {
+    backend_data.frame_diff_forced = true;
+    display_diff_set_verify(verify);
+    display_backend_set_frame_diff(true);
+}
+
+void display_backend_set_pipelined(bool enabled) {
+    backend_data.pipelined = enabled;
+}
+
+void display_backend_set_mirror(bool enabled) {
+    backend_data.mirror = enabled;
+}
+
+void display_backend_set_coalescing(bool enabled) {
+    backend_data.coalescing = enabled;
+}
+
+void display_backend_set_solid_fill(bool enabled) {
+    backend_data.solid_fill = enabled;
+    request_stage(STAGE_RESET_SOLID);
+}
+
+void display_backend_set_screen(uint8_t screen) {
+    if (screen < METRICS_SCREENS) {
+        backend_data.screen = screen;
+        portENTER_CRITICAL(&sent_mux);
+        backend_data.activate_screen = screen;
+        backend_data.stage_requests |= STAGE_ACTIVATE;
+        portEXIT_CRITICAL(&sent_mux);
+    }
+}
+
+void display_backend_drop_snapshot(uint8_t screen) {
+    if (screen < METRICS_SCREENS) {
+        portENTER_CRITICAL(&sent_mux);
+        backend_data.snapshot_drops |= 1u << screen;
+        portEXIT_CRITICAL(&sent_mux);
+    }
+}
+
+// Sends one area straight to the backend, outside of LVGL's refresh, and
+// waits for it to go out like lv_refr does.  Counted into moved.
+static void push_area(const lv_area_t *area, lv_color_t *color_map,
+                      display_frame_stats_t *moved) {
+    lv_disp_buf_t *buf = backend_data.drv->buffer;
+    uint32_t pixels = lv_area_get_size(area);
+
+    int64_t start = esp_timer_get_time();
+    buf->flushing = 1;
+    buf->flushing_last = 1;
+    backend_data.backend->flush(backend_data.drv, area, color_map);
+    wait_flushed();
+
+    moved->flush_us += esp_timer_get_time() - start;
+    moved->areas++;
+    moved->pixels += pixels;
+    moved->bytes += pixels * sizeof(lv_color_t) + DISPLAY_AREA_CMD_BYTES;
+}
+
+bool display_backend_transition(uint8_t from, uint8_t to, bool forward) {
+    // With LVGL's buffer back the flush task is idle, so the stage state
+    // is the display task's until the next flush
+    wait_flushed();
+    apply_stage_requests();
+    if (!display_snapshot_lookup(from, to)) {
+        return false;
+    }
+
+    // Draws into LVGL's own buffer, free once its last flush has finished
+    lv_disp_buf_t *buf = backend_data.drv->buffer;
+    lv_color_t *band = buf->buf1;
+    lv_coord_t band_rows = buf->size / LV_HOR_RES_MAX;
+
+    static lv_color_t from_line[LV_HOR_RES_MAX];
+    static lv_color_t to_line[LV_HOR_RES_MAX];
+    display_frame_stats_t moved = {0};
+
+    TRACE_BEGIN(TRACE_SNAPSHOT_TRANSITION, to);
+    // The last frame, with everything in place, is left to LVGL
+    for (int frame = 1; frame < DISPLAY_TRANSITION_FRAMES; frame++) {
+        lv_coord_t offset = LV_HOR_RES_MAX * frame / DISPLAY_TRANSITION_FRAMES;
+        int64_t frame_start = esp_timer_get_time();
+
+        for (lv_coord_t y1 = 0; y1 < LV_VER_RES_MAX; y1 += band_rows) {
+            lv_coord_t y2 = LV_MATH_MIN(y1 + band_rows, LV_VER_RES_MAX) - 1;
+            for (lv_coord_t y = y1; y <= y2; y++) {
+                display_snapshot_row(from, y, from_line);
+                display_snapshot_row(to, y, to_line);
+
+                // Forward slides both screens left, the new one coming in
+                // from the right, same as LV_SCR_LOAD_ANIM_MOVE_LEFT.
+                lv_color_t *dst = &band[(y - y1) * LV_HOR_RES_MAX];
+                lv_coord_t split = forward ? LV_HOR_RES_MAX - offset : offset;
+                if (forward) {
+                    memcpy(dst, &from_line[offset],
+                           split * sizeof(lv_color_t));
+                    memcpy(&dst[split], to_line, offset * sizeof(lv_color_t));
+                } else {
+                    memcpy(dst, &to_line[LV_HOR_RES_MAX - offset],
+                           split * sizeof(lv_color_t));
+                    memcpy(&dst[split], from_line,
+                           (LV_HOR_RES_MAX - offset) * sizeof(lv_color_t));
+                }
+            }
+
+            lv_area_t area = {0, y1, LV_HOR_RES_MAX - 1, y2};
+            push_area(&area, band, &moved);
+        }
+        moved.frame_us += esp_timer_get_time() - frame_start;
+    }
+    TRACE_END(TRACE_SNAPSHOT_TRANSITION, to);
+
+    backend_data.flush_busy_us += moved.flush_us;
+    if (to < METRICS_SCREENS) {
+        display_metrics_t *metrics = &backend_data.metrics[to];
+        xSemaphoreTake(backend_data.metrics_lock, portMAX_DELAY);
+        metrics->transition_frames += DISPLAY_TRANSITION_FRAMES - 1;
+        add_stats(&metrics->transition, &moved);
+        xSemaphoreGive(backend_data.metrics_lock);
+    }
+
+    // What's on the panel no longer matches anything LVGL drew
+    memset(&backend_data.solid_cache, 0, sizeof(display_solid_cache_t));
+    display_diff_reset();
+    return true;
+}
+
+bool display_backend_get_metrics(uint8_t screen, display_metrics_t *metrics) {
+    if (screen >= METRICS_SCREENS || backend_data.metrics_lock == NULL) {
+        return false;
+    }
+
+    xSemaphoreTake(backend_data.metrics_lock, portMAX_DELAY);
+    memcpy(metrics, &backend_data.metrics[screen], sizeof(display_metrics_t));
+    xSemaphoreGive(backend_data.metrics_lock);
+    return true;
+}
+
+void display_backend_log_metrics(void) {
+    ESP_LOGI(backend_tag, "%" PRIu32 " lv_task_handler calls",
+             backend_data.handler_calls);
+    for (uint8_t screen = 0; screen < METRICS_SCREENS; screen++) {
+        display_metrics_t m;
+        if (!display_backend_get_metrics(screen, &m) || m.frames == 0) {
+            continue;
+        }
+        ESP_LOGI(backend_tag,
+                 "screen %u: %" PRIu32 " frames, avg render %" PRId64
+                 "us (max %" PRId64 "us), flush %" PRId64
+                 "us, frame %" PRId64 "us (max %" PRId64
+                 "us), latency %" PRId64 "us (max %" PRId64 "us), %" PRIu32
+                 " areas/%" PRIu64 " px/%" PRIu64 " bytes per frame, "
+                 "coalescing saved %" PRIu32 " transactions/%" PRId64
+                 " bytes, %" PRIu32 " solid areas (%" PRIu32 " skipped)",
+                 screen, m.frames, m.total.handler_us / m.frames,
+                 m.max.handler_us, m.total.flush_us / m.frames,
+                 m.total.frame_us / m.frames, m.max.frame_us,
+                 m.total.latency_us / m.frames, m.max.latency_us,
+                 m.total.areas / m.frames, m.total.pixels / m.frames,
+                 m.total.bytes / m.frames, m.total.transactions_saved,
+                 m.total.bytes_saved, m.total.solid_areas,
+                 m.total.solid_skipped);
+        if (m.transition_frames > 0) {
+            ESP_LOGI(backend_tag,
+                     "screen %u: %" PRIu32 " transition frames, avg frame %"
+                     PRId64 "us, flush %" PRId64 "us, %" PRIu64
+                     " bytes per frame",
+                     screen, m.transition_frames,
+                     m.transition.frame_us / m.transition_frames,
+                     m.transition.flush_us / m.transition_frames,
+                     m.transition.bytes / m.transition_frames);
+        }
+        if (m.total.diff_tiles > 0) {
+            ESP_LOGI(backend_tag,
+                     "screen %u: frame diff %" PRIu32 "/%" PRIu32
+                     " tiles unchanged, sent as %" PRIu32 " windows, %" PRId64
+                     " bytes saved, %" PRId64 "us hashing per frame (max %"
+                     PRId64 "us), %" PRIu32 " collisions",
+                     screen, m.total.diff_unchanged, m.total.diff_tiles,
+                     m.total.diff_windows, m.total.diff_bytes_saved,
+                     m.total.diff_us / m.frames,
+                     m.max.diff_us, m.total.diff_collisions);
+        }
+    }
+
+    // Send is flush calls to flush-ready, mostly DMA, and overlaps render
+    // either way.  Pipelined, the diffing and encoding before it also move
+    // off core 1, which shows as less render time.
+    int64_t wall = esp_timer_get_time() - backend_data.installed_at;
+    if (wall > 0) {
+        ESP_LOGI(backend_tag,
+                 "%s: render %" PRId64 "us (%d%%), send %" PRId64
+                 "us (%d%%) over %" PRId64 "us",
+                 backend_data.pipelined ? "pipelined" : "serial",
+                 backend_data.render_busy_us,
+                 (int)(backend_data.render_busy_us * 100 / wall),
+                 backend_data.flush_busy_us,
+                 (int)(backend_data.flush_busy_us * 100 / wall), wall);
+    }
+
+    display_snapshot_stats_t snap;
+    display_snapshot_get_stats(&snap);
+    ESP_LOGI(backend_tag,
+             "snapshots: %" PRIu32 " hits, %" PRIu32 " misses, %" PRIu32
+             " evicted, %" PRIu32 " too big, %" PRIu32 " compactions, %" PRIu32
+             " cached in %" PRIu32 " bytes (%" PRIu32 " raw)",
+             snap.hits, snap.misses, snap.evictions, snap.oversize,
+             snap.compactions, snap.cached, snap.bytes, snap.raw_bytes);
+}
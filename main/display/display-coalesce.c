@@ -0,0 +1,83 @@
+#include <string.h>
+
+#include "display-coalesce.h"
+
+// LVGL only joins two invalidated areas when the joined area is smaller than
+// the two on their own, which ignores that every area is its own
+// CASET/RASET/RAMWR round trip on the wire.  This runs over LVGL's pending
+// invalidations before they're rendered and joins any pair that's cheaper to
+// send as one bounding box than as two transactions.
+
+int64_t display_area_cost(const lv_area_t *area) {
+    return DISPLAY_AREA_SETUP_COST + DISPLAY_AREA_CMD_BYTES +
+           (int64_t)lv_area_get_size(area) * sizeof(lv_color_t);
+}
+
+void display_coalesce_areas(lv_disp_t *disp,
+                            display_coalesce_result_t *result) {
+    bool merged;
+    do {
+        merged = false;
+        for (uint32_t i = 0; i < disp->inv_p; i++) {
+            if (disp->inv_area_joined[i]) {
+                continue;
+            }
+            for (uint32_t j = i + 1; j < disp->inv_p; j++) {
+                if (disp->inv_area_joined[j]) {
+                    continue;
+                }
+
+                lv_area_t *a = &disp->inv_areas[i];
+                lv_area_t *b = &disp->inv_areas[j];
+                lv_area_t joined;
+                _lv_area_join(&joined, a, b);
+
+                int64_t separate = display_area_cost(a) + display_area_cost(b);
+                int64_t together = display_area_cost(&joined);
+                if (together > separate) {
+                    continue;
+                }
+
+                // Only count what LVGL wouldn't have joined on its own
+                int64_t extra_px = (int64_t)lv_area_get_size(&joined) -
+                                   lv_area_get_size(a) - lv_area_get_size(b);
+                if (extra_px >= 0) {
+                    result->transactions_saved++;
+                    result->bytes_saved +=
+                        DISPLAY_AREA_CMD_BYTES -
+                        extra_px * (int64_t)sizeof(lv_color_t);
+                }
+
+                lv_area_copy(a, &joined);
+                disp->inv_area_joined[j] = 1;
+                merged = true;
+            }
+        }
+    } while (merged);
+}
+
+uint8_t display_coalesce_windows(lv_area_t *windows, uint8_t count) {
+    bool merged;
+    do {
+        merged = false;
+        for (uint8_t i = 0; i < count; i++) {
+            for (uint8_t j = i + 1; j < count; j++) {
+                lv_area_t joined;
+                _lv_area_join(&joined, &windows[i], &windows[j]);
+                if (display_area_cost(&joined) >
+                    display_area_cost(&windows[i]) +
+                        display_area_cost(&windows[j])) {
+                    continue;
+                }
+
+                lv_area_copy(&windows[i], &joined);
+                memmove(&windows[j], &windows[j + 1],
+                        (count - j - 1) * sizeof(lv_area_t));
+                count--;
+                j--;
+                merged = true;
+            }
+        }
+    } while (merged);
+    return count;
+}
@@ -0,0 +1,188 @@
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "display-coalesce.h"
+#include "display-diff.h"
+#include "diagnostics.h"
+
+#define TILE DISPLAY_DIFF_TILE
+#define TILE_COLS ((LV_HOR_RES_MAX + TILE - 1) / TILE)
+#define TILE_ROWS ((LV_VER_RES_MAX + TILE - 1) / TILE)
+
+// 0 marks a tile whose panel contents aren't known
+#define HASH_UNKNOWN 0
+
+static const char *diff_tag = "display_diff";
+
+static uint32_t tile_hash[TILE_ROWS][TILE_COLS];
+// Last frame sent, only when verifying.  Only tiles with a known hash are
+// compared against it, and those were copied in whole when it was taken.
+static lv_color_t *shadow;
+
+void display_diff_round(lv_area_t *area) {
+    area->x1 -= area->x1 % TILE;
+    area->y1 -= area->y1 % TILE;
+    area->x2 = LV_MATH_MIN(area->x2 - area->x2 % TILE + TILE - 1,
+                           LV_HOR_RES_MAX - 1);
+    area->y2 = LV_MATH_MIN(area->y2 - area->y2 % TILE + TILE - 1,
+                           LV_VER_RES_MAX - 1);
+}
+
+// The tile at (col, row) clipped to the screen
+static void tile_area(int col, int row, lv_area_t *tile) {
+    tile->x1 = col * TILE;
+    tile->y1 = row * TILE;
+    tile->x2 = LV_MATH_MIN(tile->x1 + TILE - 1, LV_HOR_RES_MAX - 1);
+    tile->y2 = LV_MATH_MIN(tile->y1 + TILE - 1, LV_VER_RES_MAX - 1);
+}
+
+static uint32_t hash_tile(const lv_area_t *area, const lv_color_t *color_map,
+                          const lv_area_t *tile) {
+    uint32_t stride = lv_area_get_width(area);
+    uint32_t hash = 2166136261u;
+    for (lv_coord_t y = tile->y1; y <= tile->y2; y++) {
+        const lv_color_t *px =
+            color_map + (y - area->y1) * stride + (tile->x1 - area->x1);
+        for (lv_coord_t x = tile->x1; x <= tile->x2; x++) {
+            // FNV-1a a pixel at a time rather than a byte at a time
+            hash = (hash ^ (px++)->full) * 16777619u;
+        }
+    }
+    return hash == HASH_UNKNOWN ? 1 : hash;
+}
+
+// Compares against, then updates, the shadow copy.  Returns whether the
+// tile's pixels changed.
+static bool shadow_update(const lv_area_t *area, const lv_color_t *color_map,
+                          const lv_area_t *tile) {
+    uint32_t stride = lv_area_get_width(area);
+    uint32_t width = lv_area_get_width(tile) * sizeof(lv_color_t);
+    bool changed = false;
+    for (lv_coord_t y = tile->y1; y <= tile->y2; y++) {
+        const lv_color_t *src =
+            color_map + (y - area->y1) * stride + (tile->x1 - area->x1);
+        lv_color_t *dst = &shadow[y * LV_HOR_RES_MAX + tile->x1];
+        if (memcmp(dst, src, width) != 0) {
+            memcpy(dst, src, width);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Ends the run of changed tiles in run, if there is one
+static void end_run(display_diff_windows_t *changed, lv_area_t *run,
+                    bool *in_run) {
+    if (!*in_run) {
+        return;
+    }
+    if (changed->count < DISPLAY_DIFF_MAX_WINDOWS) {
+        lv_area_copy(&changed->area[changed->count++], run);
+    } else {
+        lv_area_t *last = &changed->area[DISPLAY_DIFF_MAX_WINDOWS - 1];
+        _lv_area_join(last, last, run);
+    }
+    *in_run = false;
+}
+
+bool display_diff_area(const lv_area_t *area, const lv_color_t *color_map,
+                       display_diff_windows_t *changed,
+                       display_diff_result_t *result) {
+    changed->count = 0;
+
+    for (int row = area->y1 / TILE; row <= area->y2 / TILE; row++) {
+        lv_area_t run = {0};
+        bool in_run = false;
+
+        for (int col = area->x1 / TILE; col <= area->x2 / TILE; col++) {
+            lv_area_t tile;
+            tile_area(col, row, &tile);
+            bool tile_changed = true;
+
+            if (_lv_area_is_in(&tile, area, 0)) {
+                uint32_t hash = hash_tile(area, color_map, &tile);
+                result->tiles++;
+                tile_changed = hash != tile_hash[row][col];
+                tile_hash[row][col] = hash;
+
+                if (shadow != NULL) {
+                    bool pixels_changed =
+                        shadow_update(area, color_map, &tile);
+                    if (!tile_changed && pixels_changed) {
+                        result->collisions++;
+                        tile_changed = true;
+                    }
+                }
+                if (!tile_changed) {
+                    result->unchanged++;
+                    end_run(changed, &run, &in_run);
+                    continue;
+                }
+            } else {
+                // Part of it goes out, the rest of the tile is unknown now
+                tile_hash[row][col] = HASH_UNKNOWN;
+                _lv_area_intersect(&tile, &tile, area);
+            }
+
+            if (!in_run) {
+                lv_area_copy(&run, &tile);
+                in_run = true;
+            } else {
+                _lv_area_join(&run, &run, &tile);
+            }
+        }
+        end_run(changed, &run, &in_run);
+    }
+
+    changed->count = display_coalesce_windows(changed->area, changed->count);
+    return changed->count > 0;
+}
+
+void display_diff_compact(const lv_area_t *area, lv_color_t *color_map,
+                          const lv_area_t *sub) {
+    uint32_t stride = lv_area_get_width(area);
+    uint32_t width = lv_area_get_width(sub);
+    // Row by row the destination never overtakes the source
+    for (lv_coord_t y = sub->y1; y <= sub->y2; y++) {
+        memmove(&color_map[(y - sub->y1) * width],
+                &color_map[(y - area->y1) * stride + (sub->x1 - area->x1)],
+                width * sizeof(lv_color_t));
+    }
+}
+
+void display_diff_gather(const lv_area_t *area, const lv_color_t *color_map,
+                         const display_diff_windows_t *windows,
+                         lv_color_t *out) {
+    uint32_t stride = lv_area_get_width(area);
+    for (uint8_t i = 0; i < windows->count; i++) {
+        const lv_area_t *sub = &windows->area[i];
+        uint32_t width = lv_area_get_width(sub);
+        for (lv_coord_t y = sub->y1; y <= sub->y2; y++) {
+            memcpy(out,
+                   &color_map[(y - area->y1) * stride + (sub->x1 - area->x1)],
+                   width * sizeof(lv_color_t));
+            out += width;
+        }
+    }
+}
+
+void display_diff_reset(void) {
+    memset(tile_hash, 0, sizeof(tile_hash));
+}
+
+void display_diff_set_verify(bool enabled) {
+    if (enabled && shadow == NULL) {
+        shadow = diag_calloc(DIAG_TAG_DISPLAY,
+                             LV_HOR_RES_MAX * LV_VER_RES_MAX,
+                             sizeof(lv_color_t));
+        if (shadow == NULL) {
+            ESP_LOGW(diff_tag, "No room for the verify framebuffer");
+            return;
+        }
+        display_diff_reset();
+    } else if (!enabled && shadow != NULL) {
+        diag_free(shadow);
+        shadow = NULL;
+    }
+}
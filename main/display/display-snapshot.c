@@ -0,0 +1,341 @@
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "display-backend.h"
+#include "display-snapshot.h"
+#include "diagnostics.h"
+
+#define SNAPSHOT_WIDTH LV_HOR_RES_MAX
+#define SNAPSHOT_HEIGHT LV_VER_RES_MAX
+
+// Each run is a length (1-256, stored minus one) and an RGB565 color
+#define RUN_BYTES 3
+#define RUN_MAX 256
+// Rows whose runs would take at least this much are kept as plain pixels
+#define RAW_BYTES (SNAPSHOT_WIDTH * sizeof(lv_color_t))
+
+#define ARENA_SIZE DISPLAY_SNAPSHOT_BUDGET
+#if ARENA_SIZE > 0xfffe * 4
+#error "DISPLAY_SNAPSHOT_BUDGET is too big for the row offsets"
+#endif
+
+#define ROW_NONE 0xffff
+#define ROW_RAW 0x8000
+
+// Ahead of every row in the arena, so compaction can walk it and find the
+// row each segment belongs to
+typedef struct segment {
+    uint16_t y;
+    uint16_t cap; // Row bytes after the header, a multiple of 4
+    uint8_t screen;
+    uint8_t reserved[3];
+} segment_t;
+
+typedef struct snapshot_row {
+    uint16_t at;  // Segment offset in the arena / 4, ROW_NONE until kept
+    uint16_t len; // Bytes used, ROW_RAW if they're plain pixels
+} snapshot_row_t;
+
+typedef struct snapshot {
+    snapshot_row_t *rows; // SNAPSHOT_HEIGHT of them, NULL until first capture
+    uint16_t rows_present;
+    uint32_t bytes; // Segments in the arena plus the row table
+    uint32_t used_at;
+    bool oversize; // Doesn't fit, stop capturing until it's shown again
+} snapshot_t;
+
+static const char *snapshot_tag = "display_snapshot";
+
+static snapshot_t snapshots[DISPLAY_MAX_SCREENS];
+static uint32_t snapshot_clock;
+static display_snapshot_stats_t snapshot_stats;
+
+// Every kept row lives here.  Segments are handed out from the top; a row
+// that outgrows its segment moves to a new one and the old one is dead until
+// the next compaction slides the live ones down over it.
+static uint8_t *arena;
+static uint32_t arena_top;
+static uint32_t arena_dead;
+static bool arena_failed;
+
+// Scratch for patching and re-encoding a row, only used by the display task
+static lv_color_t row_line[SNAPSHOT_WIDTH];
+static uint8_t row_encoded[RAW_BYTES];
+
+// Returns 0 if the runs don't fit in limit bytes
+static uint16_t rle_encode(const lv_color_t *line, uint8_t *out,
+                           uint16_t limit) {
+    uint16_t len = 0;
+    lv_coord_t x = 0;
+    while (x < SNAPSHOT_WIDTH) {
+        lv_color_int_t color = line[x].full;
+        lv_coord_t run = 1;
+        while (x + run < SNAPSHOT_WIDTH && run < RUN_MAX &&
+               line[x + run].full == color) {
+            run++;
+        }
+        if (len + RUN_BYTES > limit) {
+            return 0;
+        }
+        out[len++] = run - 1;
+        out[len++] = color & 0xff;
+        out[len++] = color >> 8;
+        x += run;
+    }
+    return len;
+}
+
+static void rle_decode(const uint8_t *in, uint16_t len, lv_color_t *line) {
+    lv_coord_t x = 0;
+    for (uint16_t i = 0; i + RUN_BYTES <= len; i += RUN_BYTES) {
+        lv_coord_t run = in[i] + 1;
+        lv_color_t color;
+        color.full = in[i + 1] | (in[i + 2] << 8);
+        while (run-- > 0 && x < SNAPSHOT_WIDTH) {
+            line[x++] = color;
+        }
+    }
+}
+
+// Fills row_encoded from line, as runs unless anti-aliasing makes those
+// bigger than the pixels themselves
+static uint16_t encode_row(const lv_color_t *line) {
+    uint16_t len = rle_encode(line, row_encoded, RAW_BYTES - 1);
+    if (len == 0) {
+        memcpy(row_encoded, line, RAW_BYTES);
+        len = RAW_BYTES | ROW_RAW;
+    }
+    return len;
+}
+
+static segment_t *segment_at(uint16_t at) {
+    return (segment_t *)(arena + at * 4);
+}
+
+static uint8_t *row_data(const snapshot_row_t *row) {
+    return arena + row->at * 4 + sizeof(segment_t);
+}
+
+static uint32_t segment_size(uint16_t at) {
+    return sizeof(segment_t) + segment_at(at)->cap;
+}
+
+static void snapshot_free(snapshot_t *snap) {
+    if (snap->rows == NULL) {
+        return;
+    }
+    for (lv_coord_t y = 0; y < SNAPSHOT_HEIGHT; y++) {
+        if (snap->rows[y].at != ROW_NONE) {
+            arena_dead += segment_size(snap->rows[y].at);
+        }
+    }
+    diag_free(snap->rows);
+    snap->rows = NULL;
+    snap->rows_present = 0;
+    snap->bytes = 0;
+}
+
+// Slides the live segments down over the dead ones
+static void compact(void) {
+    uint32_t to = 0;
+    uint32_t from = 0;
+    while (from < arena_top) {
+        segment_t *seg = (segment_t *)(arena + from);
+        uint32_t size = sizeof(segment_t) + seg->cap;
+        snapshot_t *snap = &snapshots[seg->screen];
+        if (snap->rows != NULL && snap->rows[seg->y].at == from / 4) {
+            if (to != from) {
+                memmove(arena + to, arena + from, size);
+                snap->rows[seg->y].at = to / 4;
+            }
+            to += size;
+        }
+        from += size;
+    }
+    arena_top = to;
+    arena_dead = 0;
+    snapshot_stats.compactions++;
+}
+
+// Compacts, then drops least recently shown snapshots other than keep,
+// until there's room for need more bytes at the top of the arena.
+static bool make_room(uint8_t keep, uint32_t need) {
+    while (arena_top + need > ARENA_SIZE) {
+        if (arena_dead > 0) {
+            compact();
+            continue;
+        }
+        snapshot_t *victim = NULL;
+        for (uint8_t i = 0; i < DISPLAY_MAX_SCREENS; i++) {
+            snapshot_t *snap = &snapshots[i];
+            if (i != keep && snap->rows_present > 0 &&
+                (victim == NULL || snap->used_at < victim->used_at)) {
+                victim = snap;
+            }
+        }
+        if (victim == NULL) {
+            return false;
+        }
+        snapshot_free(victim);
+        snapshot_stats.evictions++;
+    }
+    return true;
+}
+
+static void give_up(uint8_t screen, snapshot_t *snap) {
+    ESP_LOGW(snapshot_tag, "Screen %u doesn't fit in the snapshot budget",
+             screen);
+    snapshot_free(snap);
+    snap->oversize = true;
+    snapshot_stats.oversize++;
+}
+
+static bool store_row(uint8_t screen, snapshot_t *snap, lv_coord_t y,
+                      uint16_t len) {
+    snapshot_row_t *row = &snap->rows[y];
+    uint16_t bytes = len & ~ROW_RAW;
+
+    if (row->at == ROW_NONE || bytes > segment_at(row->at)->cap) {
+        // Leave some slack so a row that keeps changing settles in place
+        uint16_t cap = LV_MATH_MIN(bytes + bytes / 4, RAW_BYTES);
+        cap = (cap + 3) & ~3;
+        uint32_t size = sizeof(segment_t) + cap;
+        if (!make_room(screen, size)) {
+            return false;
+        }
+
+        // Only look at the old segment now, compaction may have moved it
+        if (row->at == ROW_NONE) {
+            snap->rows_present++;
+        } else {
+            arena_dead += segment_size(row->at);
+            snap->bytes -= segment_size(row->at);
+        }
+        segment_t *seg = (segment_t *)(arena + arena_top);
+        seg->y = y;
+        seg->cap = cap;
+        seg->screen = screen;
+        row->at = arena_top / 4;
+        arena_top += size;
+        snap->bytes += size;
+    }
+    memcpy(row_data(row), row_encoded, bytes);
+    row->len = len;
+    return true;
+}
+
+void display_snapshot_capture(uint8_t screen, const lv_area_t *area,
+                              const lv_color_t *color_map) {
+    if (screen >= DISPLAY_MAX_SCREENS || arena_failed) {
+        return;
+    }
+    snapshot_t *snap = &snapshots[screen];
+    if (snap->oversize) {
+        return;
+    }
+
+    if (arena == NULL) {
+        arena = diag_malloc(DIAG_TAG_DISPLAY, ARENA_SIZE);
+        if (arena == NULL) {
+            ESP_LOGW(snapshot_tag, "No room for the snapshot arena");
+            arena_failed = true;
+            return;
+        }
+    }
+
+    if (snap->rows == NULL) {
+        snap->rows = diag_malloc(DIAG_TAG_DISPLAY,
+                                 SNAPSHOT_HEIGHT * sizeof(snapshot_row_t));
+        if (snap->rows == NULL) {
+            return;
+        }
+        for (lv_coord_t y = 0; y < SNAPSHOT_HEIGHT; y++) {
+            snap->rows[y].at = ROW_NONE;
+            snap->rows[y].len = 0;
+        }
+        snap->bytes = SNAPSHOT_HEIGHT * sizeof(snapshot_row_t);
+    }
+
+    lv_area_t bounds = {0, 0, SNAPSHOT_WIDTH - 1, SNAPSHOT_HEIGHT - 1};
+    lv_area_t clipped;
+    if (!_lv_area_intersect(&clipped, area, &bounds)) {
+        return;
+    }
+    bool full_width = clipped.x1 == 0 && clipped.x2 == SNAPSHOT_WIDTH - 1;
+    uint32_t src_width = lv_area_get_width(area);
+    uint32_t width = lv_area_get_width(&clipped);
+
+    for (lv_coord_t y = clipped.y1; y <= clipped.y2; y++) {
+        const lv_color_t *src =
+            color_map + (y - area->y1) * src_width + (clipped.x1 - area->x1);
+
+        uint16_t len;
+        if (full_width) {
+            len = encode_row(src);
+        } else if (snap->rows[y].at != ROW_NONE) {
+            display_snapshot_row(screen, y, row_line);
+            memcpy(&row_line[clipped.x1], src, width * sizeof(lv_color_t));
+            len = encode_row(row_line);
+        } else {
+            // Nothing to patch yet, wait for a full-width area
+            continue;
+        }
+
+        if (!store_row(screen, snap, y, len)) {
+            give_up(screen, snap);
+            return;
+        }
+    }
+}
+
+void display_snapshot_activate(uint8_t screen) {
+    if (screen < DISPLAY_MAX_SCREENS) {
+        snapshots[screen].used_at = ++snapshot_clock;
+        snapshots[screen].oversize = false;
+    }
+}
+
+void display_snapshot_drop(uint8_t screen) {
+    if (screen < DISPLAY_MAX_SCREENS) {
+        snapshot_free(&snapshots[screen]);
+    }
+}
+
+static bool snapshot_complete(uint8_t screen) {
+    return screen < DISPLAY_MAX_SCREENS &&
+           snapshots[screen].rows_present == SNAPSHOT_HEIGHT;
+}
+
+bool display_snapshot_lookup(uint8_t from, uint8_t to) {
+    if (snapshot_complete(from) && snapshot_complete(to)) {
+        snapshot_stats.hits++;
+        return true;
+    }
+    snapshot_stats.misses++;
+    return false;
+}
+
+void display_snapshot_row(uint8_t screen, lv_coord_t y, lv_color_t *line) {
+    const snapshot_row_t *row = &snapshots[screen].rows[y];
+    if (row->len & ROW_RAW) {
+        memcpy(line, row_data(row), RAW_BYTES);
+    } else {
+        rle_decode(row_data(row), row->len, line);
+    }
+}
+
+void display_snapshot_get_stats(display_snapshot_stats_t *stats) {
+    *stats = snapshot_stats;
+    stats->cached = 0;
+    stats->raw_bytes = 0;
+    stats->bytes = 0;
+    for (uint8_t i = 0; i < DISPLAY_MAX_SCREENS; i++) {
+        if (snapshot_complete(i)) {
+            stats->cached++;
+            stats->raw_bytes +=
+                SNAPSHOT_WIDTH * SNAPSHOT_HEIGHT * sizeof(lv_color_t);
+            stats->bytes += snapshots[i].bytes;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#include "display-solid.h"
+
+bool display_area_is_solid(const lv_color_t *color_map, uint32_t pixels,
+                           lv_color_t *color) {
+    // Anything with text or a border on it fails within the first row, so
+    // the scan only runs to the end for areas that really are one color.
+    lv_color_int_t first = color_map[0].full;
+    for (uint32_t i = 1; i < pixels; i++) {
+        if (color_map[i].full != first) {
+            return false;
+        }
+    }
+    color->full = first;
+    return true;
+}
+
+bool display_solid_cache_covers(const display_solid_cache_t *cache,
+                                const lv_area_t *area, lv_color_t color) {
+    for (int i = 0; i < DISPLAY_SOLID_CACHE_SIZE; i++) {
+        const display_solid_entry_t *entry = &cache->entry[i];
+        if (entry->valid && entry->color.full == color.full &&
+            _lv_area_is_in(area, &entry->area, 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void display_solid_cache_invalidate(display_solid_cache_t *cache,
+                                    const lv_area_t *area) {
+    for (int i = 0; i < DISPLAY_SOLID_CACHE_SIZE; i++) {
+        display_solid_entry_t *entry = &cache->entry[i];
+        lv_area_t overlap;
+        if (entry->valid && _lv_area_intersect(&overlap, &entry->area, area)) {
+            entry->valid = false;
+        }
+    }
+}
+
+void display_solid_cache_add(display_solid_cache_t *cache,
+                             const lv_area_t *area, lv_color_t color) {
+    display_solid_cache_invalidate(cache, area);
+
+    // Reuse a free slot if there is one, otherwise replace the oldest
+    display_solid_entry_t *slot = NULL;
+    for (int i = 0; i < DISPLAY_SOLID_CACHE_SIZE; i++) {
+        if (!cache->entry[i].valid) {
+            slot = &cache->entry[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        slot = &cache->entry[cache->next];
+        cache->next = (cache->next + 1) % DISPLAY_SOLID_CACHE_SIZE;
+    }
+
+    lv_area_copy(&slot->area, area);
+    slot->color = color;
+    slot->valid = true;
+}
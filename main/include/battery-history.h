@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-memory battery history.  Recent readings are kept as delta/varint
+// encoded samples; as they age they're rolled up into 1 minute, then 15
+// minute min/avg/max buckets.  Each 15 minute bucket is written to NVS as
+// it closes and reloaded at boot; a reset loses at most the open one.
+//
+// Times are seconds of uptime.  There's no wall clock, so history from a
+// previous boot is placed right before this one, at negative times.
+
+typedef void *battery_history_handle_t;
+
+typedef struct battery_point {
+    int32_t time;
+    uint16_t mv;
+} battery_point_t;
+
+battery_history_handle_t battery_history_init(void);
+void battery_history_add(battery_history_handle_t history, int32_t time,
+                         uint16_t mv);
+// Bumped by every add, to tell when a chart is stale.
+uint32_t battery_history_version(battery_history_handle_t history);
+// Fills out with up to max points, oldest first, covering the last span
+// seconds (or all of it) at the finest resolution that fits in max.
+size_t battery_history_get(battery_history_handle_t history, int32_t span,
+                           battery_point_t *out, size_t max);
+
+// Largest-Triangle-Three-Buckets downsampling of in[n] to threshold points.
+size_t battery_history_lttb(const battery_point_t *in, size_t n,
+                            battery_point_t *out, size_t threshold);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact binary record of raw button edges, as seen by button_isr before
+// any filtering.  A trace is a header followed by one record per edge:
+//
+//   "BTRC" u8 version u8[3] reserved
+//   varint  edge_time delta (us) from the previous record
+//   u8      button << 1 | level
+//
+// so a typical edge costs 2-4 bytes.  The board records into a static
+// buffer from boot and button_trace_dump() prints it with the diagnostics
+// chord; turn the serial log back into a file with
+//
+//   sed -n '/^BTRACE [0-9]/,/^BTRACE end/{/^BTRACE/d;p}' log | xxd -r -p
+//
+// and replay it with host/tools/button-bench -r.
+
+#define BUTTON_TRACE_VERSION 1
+#define BUTTON_TRACE_HEADER_SIZE 8
+// Largest encoded record: 10 byte varint plus the button/level byte
+#define BUTTON_TRACE_RECORD_MAX 11
+
+typedef struct button_trace_rec {
+    int64_t edge_time;
+    uint8_t button;
+    uint8_t level;
+} button_trace_rec_t;
+
+typedef struct button_trace_writer {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    int64_t last_time;
+    uint32_t records;
+    uint32_t dropped; // Records that didn't fit
+} button_trace_writer_t;
+
+typedef struct button_trace_reader {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+    int64_t last_time;
+} button_trace_reader_t;
+
+// Starts a trace in buf, which must hold at least the header.
+bool button_trace_writer_init(button_trace_writer_t *writer, uint8_t *buf,
+                              size_t size);
+// Safe to call from an ISR, never allocates.
+bool button_trace_put(button_trace_writer_t *writer,
+                      const button_trace_rec_t *rec);
+// Hex to stdout between BTRACE lines.  Detach the writer first.
+void button_trace_dump(const button_trace_writer_t *writer);
+
+// Fails if buf doesn't start with a trace header this version understands.
+bool button_trace_reader_init(button_trace_reader_t *reader,
+                              const uint8_t *buf, size_t len);
+// False at the end of the trace or on a truncated record.
+bool button_trace_get(button_trace_reader_t *reader, button_trace_rec_t *rec);
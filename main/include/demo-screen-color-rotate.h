@@ -8,8 +8,7 @@
 #include "freertos/task.h"
 #include "lvgl/lvgl.h"
 
-// Color changing interval in microseconds
-#define UPDATE_INTERVAL_US 1000LL * 1000LL
+extern const screen_desc_t color_rotate_screen;
 
 void *color_rotate_screen_init(lv_obj_t *screen);
 void color_rotate_screen_worker(lv_obj_t *screen, void *priv);
\ No newline at end of file
@@ -5,18 +5,51 @@
 #include "freertos/queue.h"
 #include "lvgl/lvgl.h"
 
-typedef enum display_mode {
-    COLOR_ROTATE,
-    HELLO_WORLD,
-    VOLTAGE,
-    WIFI,
-    MAX_DISPLAY_MODE = WIFI
-} display_mode_t;
+#include "display-backend.h"
+
+// Index into screen_registry
+typedef uint8_t display_mode_t;
 
 typedef void *screen_handle_t;
 typedef void *display_handle_t;
 
 typedef void (*tick_callback_t)(lv_obj_t *screen, void *priv);
+typedef void *(*screen_init_t)(lv_obj_t *screen);
+
+// Everything the display task needs to know about a screen.  Each screen
+// module exports one of these and screen-registry.c lists them in the order
+// the buttons cycle through; the first entry is shown at boot.
+typedef struct screen_desc {
+    const char *name;
+    screen_init_t init_cb;
+    tick_callback_t load_cb;
+    tick_callback_t unload_cb;
+    tick_callback_t tick_cb;
+    tick_callback_t release_cb;
+    // 0 ticks on every pass, including early wakeups from display_notify()
+    uint32_t tick_period_ms;
+    // Hidden this long, a screen with a release_cb is torn down. 0 keeps it.
+    int64_t idle_timeout_us;
+    // Heap + LVGL pool the screen may take when it's built. 0 is unchecked.
+    size_t mem_budget;
+    // Send only the tiles that changed, for screens that redraw whole
+    // widgets to change a few pixels.  See display-diff.h.
+    bool frame_diff;
+} screen_desc_t;
+
+extern const screen_desc_t *const screen_registry[];
+extern const uint8_t screen_registry_count;
+
+static inline uint8_t display_screen_count(void) {
+    return screen_registry_count;
+}
 
-display_handle_t init_display(int screen_count);
-void show_display(display_handle_t disp_handle, display_mode_t disp);
\ No newline at end of file
+display_handle_t init_display(void);
+display_handle_t init_display_backend(const display_backend_t *backend);
+void show_display(display_handle_t disp_handle, display_mode_t disp);
+// Wake the display task early, e.g. when a screen's data source has posted
+// something new.
+void display_notify(void);
+// Backlight brightness, faded to over fade_ms (0 for at once).  Safe from
+// any task, before the display is up it sets the starting level.
+void display_set_backlight(uint8_t percent, uint32_t fade_ms);
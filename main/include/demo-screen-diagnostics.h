@@ -0,0 +1,9 @@
+#pragma once
+
+#include "demo-screen-common.h"
+
+extern const screen_desc_t diagnostics_screen;
+
+void *diagnostics_screen_init(lv_obj_t *screen);
+void diagnostics_screen_worker(lv_obj_t *screen, void *priv);
+void diagnostics_screen_release(lv_obj_t *screen, void *priv);
@@ -5,5 +5,9 @@
 #include "freertos/task.h"
 #include "lvgl/lvgl.h"
 
+#include "demo-screen-common.h"
+
+extern const screen_desc_t hello_world_screen;
+
 void *hello_world_screen_init(lv_obj_t *screen);
 void hello_world_screen_worker(lv_obj_t *screen, void *priv);
\ No newline at end of file
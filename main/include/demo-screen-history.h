@@ -0,0 +1,9 @@
+#pragma once
+
+#include "demo-screen-common.h"
+
+extern const screen_desc_t history_screen;
+
+void *history_screen_init(lv_obj_t *screen);
+void history_screen_worker(lv_obj_t *screen, void *priv);
+void history_screen_release(lv_obj_t *screen, void *priv);
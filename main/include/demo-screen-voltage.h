@@ -2,7 +2,10 @@
 
 #include "demo-screen-common.h"
 
+extern const screen_desc_t voltage_screen;
+
 void *voltage_screen_init(lv_obj_t *screen);
 void voltage_screen_worker(lv_obj_t *screen, void *priv);
 void voltage_screen_load(lv_obj_t *screen, void *priv);
-void voltage_screen_unload(lv_obj_t *screen, void *priv);
\ No newline at end of file
+void voltage_screen_unload(lv_obj_t *screen, void *priv);
+void voltage_screen_release(lv_obj_t *screen, void *priv);
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 #include "demo-screen-common.h"
 
+extern const screen_desc_t wifi_screen;
+
 void *wifi_screen_init(lv_obj_t *screen);
+void wifi_screen_release(lv_obj_t *screen, void *priv);
 void wifi_screen_worker(lv_obj_t *screen, void *priv);
\ No newline at end of file
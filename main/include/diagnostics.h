@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Memory and stack figures for sizing task stacks and pools from data
+// rather than guesses.  Shown on the diagnostics screen and logged by
+// diag_dump().
+
+typedef enum diag_tag {
+    DIAG_TAG_BUTTON,
+    DIAG_TAG_VOLTAGE,
+    DIAG_TAG_HISTORY,
+    DIAG_TAG_DISPLAY,
+    DIAG_TAG_SCREEN,
+    DIAG_TAG_POWER,
+    DIAG_TAG_MAX
+} diag_tag_t;
+
+#define DIAG_MAX_TASKS 8
+
+typedef struct diag_alloc_stats {
+    uint32_t bytes; // Live
+    uint32_t peak;
+    uint32_t allocs; // Live
+    uint32_t failures;
+} diag_alloc_stats_t;
+
+typedef struct diag_task_stats {
+    const char *name;
+    uint32_t stack_size; // Bytes
+    uint32_t stack_free; // Least ever free, in bytes
+} diag_task_stats_t;
+
+typedef struct diag_heap_stats {
+    uint32_t free;
+    uint32_t minimum_free;
+    uint32_t largest_block;
+    // LVGL's pool, as of the last diag_sample_lvgl()
+    uint32_t lv_total;
+    uint32_t lv_free;
+    uint32_t lv_biggest;
+    uint32_t lv_max_used;
+    uint8_t lv_frag_pct;
+} diag_heap_stats_t;
+
+// Tagged allocations.  Blocks carry a small header, so they must be freed
+// (or realloc'd) through diag_free (or diag_realloc), never plain free().
+// Failures are counted and logged along with a full dump.
+void *diag_malloc(diag_tag_t tag, size_t size);
+void *diag_calloc(diag_tag_t tag, size_t n, size_t size);
+void *diag_realloc(diag_tag_t tag, void *ptr, size_t size);
+void diag_free(void *ptr);
+
+// stack_depth is as passed to xTaskCreate
+void diag_register_task(TaskHandle_t task, const char *name,
+                        uint32_t stack_depth);
+// lv_mem_monitor() isn't thread safe, so the display task calls this and
+// everyone else reads the copy it leaves.  Rate limited internally.
+void diag_sample_lvgl(void);
+
+const char *diag_tag_name(diag_tag_t tag);
+void diag_get_allocs(diag_tag_t tag, diag_alloc_stats_t *stats);
+size_t diag_get_tasks(diag_task_stats_t *out, size_t max);
+void diag_get_heap(diag_heap_stats_t *stats);
+// Everything above, to the log
+void diag_dump(void);
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "lvgl/lvgl.h"
+
+// Where LVGL's rendered areas end up.  The flush is wrapped so every backend
+// gets the same per-frame accounting.  fill is optional: when set, areas that
+// rendered to a single color go through it instead of flush.  flush_windows
+// is too: it sends count windows whose pixels follow one another in
+// color_map, for frame diffing to send only what changed without one
+// bounding box.  All of them must call lv_disp_flush_ready() once, when
+// color_map can be reused.  wait, if set, blocks until everything they've
+// queued has gone out; without it, sends are taken to be done by the time
+// flush-ready is called.
+typedef struct display_backend {
+    const char *name;
+    void (*init)(void);
+    void (*flush)(lv_disp_drv_t *drv, const lv_area_t *area,
+                  lv_color_t *color_map);
+    void (*fill)(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t color);
+    void (*flush_windows)(lv_disp_drv_t *drv, const lv_area_t *windows,
+                          uint8_t count, lv_color_t *color_map);
+    void (*wait)(void);
+} display_backend_t;
+
+// The panel on the board, via lvgl_esp32_drivers
+extern const display_backend_t st7789_backend;
+// LV_HOR_RES_MAX x LV_VER_RES_MAX RGB565 framebuffer in RAM, no panel needed
+extern const display_backend_t headless_backend;
+
+#ifndef DISPLAY_DEFAULT_BACKEND
+#define DISPLAY_DEFAULT_BACKEND st7789_backend
+#endif
+
+typedef struct display_frame_stats {
+    // All times in US
+    int64_t handler_us; // Time in lv_task_handler() while rendering the frame
+    int64_t handoff_us; // ... of which in the flush_cb
+    int64_t flush_us;   // Each area's flush call to its flush-ready
+    int64_t frame_us;   // Start of rendering to the last flush-ready
+    int64_t latency_us; // First invalidation to the last flush-ready
+    uint32_t areas;     // Number of flushed areas
+    uint64_t pixels;
+    uint64_t bytes; // Pixel and command bytes on the wire
+    uint32_t transactions_saved; // By display_coalesce_areas()
+    int64_t bytes_saved;
+    uint32_t solid_areas;   // Areas that rendered to a single color
+    uint32_t solid_skipped; // ... and were already on the panel
+    uint32_t diff_tiles;      // Tiles hashed by display-diff.h
+    uint32_t diff_unchanged;  // ... and not sent
+    uint32_t diff_windows;    // Windows the changed ones went out as
+    uint32_t diff_collisions; // Wrongly matched, when verifying
+    int64_t diff_bytes_saved;
+    int64_t diff_us;          // Hashing and compacting
+} display_frame_stats_t;
+
+typedef struct display_metrics {
+    uint32_t frames;
+    display_frame_stats_t last;
+    display_frame_stats_t total;
+    display_frame_stats_t max;
+    // display_backend_transition() frames sliding in to this screen.  Only
+    // the areas, pixels, bytes, flush and frame times are filled in.
+    uint32_t transition_frames;
+    display_frame_stats_t transition;
+} display_metrics_t;
+
+// Metrics are kept per screen, for up to this many registry entries
+#define DISPLAY_MAX_SCREENS 8
+
+// Pipelined, LVGL's flush_cb only hands each stripe to a flush task on
+// DISPLAY_FLUSH_CORE.  That task snapshots, mirrors, diffs and checks the
+// stripe for a solid color, then calls the backend, all while LVGL renders
+// the next stripe into its other buffer.  Serial, all of it runs inside the
+// flush_cb.
+#ifndef DISPLAY_PIPELINE
+#define DISPLAY_PIPELINE (portNUM_PROCESSORS > 1)
+#endif
+#ifndef DISPLAY_FLUSH_CORE
+#define DISPLAY_FLUSH_CORE 0
+#endif
+
+// Frames in a display_backend_transition(), the last one rendered by LVGL
+#ifndef DISPLAY_TRANSITION_FRAMES
+#define DISPLAY_TRANSITION_FRAMES 6
+#endif
+
+// What init_display() uses, DISPLAY_DEFAULT_BACKEND unless changed before
+const display_backend_t *display_backend_default(void);
+void display_backend_set_default(const display_backend_t *backend);
+
+void display_backend_install(lv_disp_drv_t *drv,
+                             const display_backend_t *backend);
+uint32_t display_backend_task_handler(void);
+void display_backend_set_screen(uint8_t screen);
+// display_snapshot_drop(), once the flush task is done with it
+void display_backend_drop_snapshot(uint8_t screen);
+void display_backend_set_coalescing(bool enabled);
+void display_backend_set_solid_fill(bool enabled);
+// Set before init_display()
+void display_backend_set_pipelined(bool enabled);
+// Only send the display-diff.h tiles that changed, set per screen from
+// screen_desc_t.frame_diff.  Forcing turns it on for every screen, for
+// measuring, and optionally counts hash collisions.
+void display_backend_set_frame_diff(bool enabled);
+void display_backend_force_frame_diff(bool verify);
+// Also copy every rendered area, sent or not, into the headless
+// framebuffer.  Set before init_display(); lets what reached another backend
+// be checked against what LVGL drew.
+void display_backend_set_mirror(bool enabled);
+// Slides from one screen to another using their display-snapshot.h copies,
+// without LVGL rendering anything.  Returns false, having drawn nothing, if
+// either isn't cached.  The caller loads the new screen afterwards so LVGL
+// draws the final frame.
+bool display_backend_transition(uint8_t from, uint8_t to, bool forward);
+bool display_backend_get_metrics(uint8_t screen, display_metrics_t *metrics);
+void display_backend_log_metrics(void);
+
+// Contents of the headless backend, NULL unless it's the active backend or
+// mirroring.
+const lv_color_t *display_headless_framebuffer(void);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+// Wire cost of one flushed area on the ST7789: CASET + 4, RASET + 4, RAMWR
+#define DISPLAY_AREA_CMD_BYTES 11
+// What a separate transaction costs beyond its command bytes (CS/DC
+// toggling, queueing the SPI transfers, waiting on completion), expressed as
+// the number of pixel bytes that could be sent in the same time.
+#define DISPLAY_AREA_SETUP_COST 160
+
+typedef struct display_coalesce_result {
+    uint32_t transactions_saved;
+    int64_t bytes_saved; // Command bytes saved minus extra pixel bytes sent
+} display_coalesce_result_t;
+
+// What sending area as its own window costs, in pixel bytes
+int64_t display_area_cost(const lv_area_t *area);
+
+void display_coalesce_areas(lv_disp_t *disp,
+                            display_coalesce_result_t *result);
+// Same joining over a plain list of windows, in place.  Returns how many are
+// left.
+uint8_t display_coalesce_windows(lv_area_t *windows, uint8_t count);
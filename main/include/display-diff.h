@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+// Tile hashes of what was last sent to the panel, so a rendered area can be
+// cut down to the tiles that actually changed.  LVGL invalidates whole
+// widgets, e.g. a label that gets new text, even when most of it renders
+// the same as before.
+//
+// Only tiles an area covers completely can be compared; rounding invalidated
+// areas out to the tile grid (display_diff_round() from the rounder_cb)
+// makes that every tile.
+
+#define DISPLAY_DIFF_TILE 16
+
+typedef struct display_diff_result {
+    uint32_t tiles;      // Compared
+    uint32_t unchanged;  // ... and the same as on the panel
+    uint32_t collisions; // Hash matched, pixels didn't (verify only)
+} display_diff_result_t;
+
+// Grows area to tile boundaries, clipped to the screen
+void display_diff_round(lv_area_t *area);
+
+// Most windows an area is cut into.  Runs past that are joined into the
+// last one.
+#define DISPLAY_DIFF_MAX_WINDOWS 8
+
+typedef struct display_diff_windows {
+    uint8_t count;
+    lv_area_t area[DISPLAY_DIFF_MAX_WINDOWS];
+} display_diff_windows_t;
+
+// Hashes area's tiles, remembers them as sent and adds to result.  Returns
+// false if none changed; otherwise changed has a window per run of changed
+// tiles along a tile row, joined wherever display_area_cost() says one
+// window is cheaper than two.
+bool display_diff_area(const lv_area_t *area, const lv_color_t *color_map,
+                       display_diff_windows_t *changed,
+                       display_diff_result_t *result);
+// Moves the pixels of sub, inside area, to the start of color_map so they
+// can be flushed on their own
+void display_diff_compact(const lv_area_t *area, lv_color_t *color_map,
+                          const lv_area_t *sub);
+// Copies the pixels of each window, inside area, one after the other into
+// out.  Several windows can't be compacted in place: one's rows would
+// overwrite another's before they're read.
+void display_diff_gather(const lv_area_t *area, const lv_color_t *color_map,
+                         const display_diff_windows_t *windows,
+                         lv_color_t *out);
+
+// Forget everything, for when the panel changed behind the table's back
+void display_diff_reset(void);
+// Also keep a copy of the last frame sent and check every hash match against
+// it, to count collisions.  Costs a full framebuffer.
+void display_diff_set_verify(bool enabled);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+// Run-length compressed copies of what each screen last looked like on the
+// panel, built from the areas going through the flush.  A screen transition
+// with both ends cached is drawn by sliding the two copies instead of having
+// LVGL render both object trees for every animation frame.
+//
+// Rows are compressed separately, so a flush only re-encodes the rows it
+// touches.  Rows that don't compress, like anti-aliased text, are kept as
+// plain pixels.  A row is only kept once a full-width area has covered it; a
+// snapshot is usable once every row has been.
+
+// Size of the arena every screen's rows share, allocated on the first
+// capture.  It's compacted when it fills up, and least recently shown
+// screens are dropped when that isn't enough.  Each screen also has a
+// LV_VER_RES_MAX * 4 byte row table outside it.
+#ifndef DISPLAY_SNAPSHOT_BUDGET
+#define DISPLAY_SNAPSHOT_BUDGET (40 * 1024)
+#endif
+
+typedef struct display_snapshot_stats {
+    uint32_t hits;      // Transitions drawn from snapshots
+    uint32_t misses;    // ... left to LVGL's animation
+    uint32_t evictions; // Snapshots dropped for the budget
+    uint32_t oversize;  // Screens that didn't fit on their own
+    uint32_t compactions;
+    uint32_t cached;    // Complete snapshots held right now
+    uint32_t raw_bytes; // What those would take as plain RGB565
+    uint32_t bytes;     // What they do take
+} display_snapshot_stats_t;
+
+void display_snapshot_capture(uint8_t screen, const lv_area_t *area,
+                              const lv_color_t *color_map);
+// Marks screen as the one on the panel, for eviction order
+void display_snapshot_activate(uint8_t screen);
+void display_snapshot_drop(uint8_t screen);
+
+// Counts a hit if both screens have complete snapshots, a miss otherwise
+bool display_snapshot_lookup(uint8_t from, uint8_t to);
+// Decodes row y of a complete snapshot into line (LV_HOR_RES_MAX pixels)
+void display_snapshot_row(uint8_t screen, lv_coord_t y, lv_color_t *line);
+
+void display_snapshot_get_stats(display_snapshot_stats_t *stats);
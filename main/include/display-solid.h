@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+#define DISPLAY_SOLID_CACHE_SIZE 16
+
+// Solid-color areas known to be on the panel right now, so a flush that
+// would send the same color to the same place again can be dropped.
+typedef struct display_solid_entry {
+    lv_area_t area;
+    lv_color_t color;
+    bool valid;
+} display_solid_entry_t;
+
+typedef struct display_solid_cache {
+    display_solid_entry_t entry[DISPLAY_SOLID_CACHE_SIZE];
+    uint8_t next;
+} display_solid_cache_t;
+
+bool display_area_is_solid(const lv_color_t *color_map, uint32_t pixels,
+                           lv_color_t *color);
+
+bool display_solid_cache_covers(const display_solid_cache_t *cache,
+                                const lv_area_t *area, lv_color_t color);
+void display_solid_cache_add(display_solid_cache_t *cache,
+                             const lv_area_t *area, lv_color_t color);
+void display_solid_cache_invalidate(display_solid_cache_t *cache,
+                                    const lv_area_t *area);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+// Deferred logging for hot paths.  A call stores a pointer to its call site
+// (level, tag, format) plus raw arguments in a lock-free ring and returns;
+// the dlog task formats and prints them later at low priority.  Safe from
+// ISRs.  When the ring is full messages are dropped and counted.
+//
+// Arguments must be integers of 32 bits or less, at most DLOG_MAX_ARGS, and
+// the format may only use conversions that take them (%d %u %x %c ...).
+// No %s or %p: the argument is rendered long after the call.
+//
+//   DLOGI(button, "Attached button %d", index);
+//
+// The tag is an identifier with a DLOG_LEVEL_<tag> below; calls above that
+// level compile to nothing.  Override per tag with -DDLOG_LEVEL_<tag>=...
+
+#define DLOG_NONE ESP_LOG_NONE
+#define DLOG_ERROR ESP_LOG_ERROR
+#define DLOG_WARN ESP_LOG_WARN
+#define DLOG_INFO ESP_LOG_INFO
+#define DLOG_DEBUG ESP_LOG_DEBUG
+#define DLOG_VERBOSE ESP_LOG_VERBOSE
+
+#ifndef DLOG_LEVEL_DEFAULT
+#define DLOG_LEVEL_DEFAULT CONFIG_LOG_DEFAULT_LEVEL
+#endif
+
+#ifndef DLOG_LEVEL_button
+#define DLOG_LEVEL_button DLOG_LEVEL_DEFAULT
+#endif
+#ifndef DLOG_LEVEL_wifi
+#define DLOG_LEVEL_wifi DLOG_LEVEL_DEFAULT
+#endif
+#ifndef DLOG_LEVEL_main
+#define DLOG_LEVEL_main DLOG_LEVEL_DEFAULT
+#endif
+
+// Records buffered, must be a power of two
+#ifndef DLOG_RING_SIZE
+#define DLOG_RING_SIZE 64
+#endif
+
+#define DLOG_MAX_ARGS 4
+
+typedef struct dlog_site {
+    esp_log_level_t level;
+    const char *tag;
+    const char *format;
+} dlog_site_t;
+
+// Starts the task that renders the ring.  Messages logged before this are
+// kept (as many as fit).
+void dlog_init(void);
+void dlog_write(const dlog_site_t *site, int nargs, ...);
+uint32_t dlog_dropped(void);
+
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, n, ...) n
+#define DLOG_NARGS(...) DLOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+
+#define DLOG(tag, lvl, fmt, ...)                                            \
+    do {                                                                    \
+        _Static_assert(DLOG_NARGS(__VA_ARGS__) <= DLOG_MAX_ARGS,            \
+                       "too many dlog arguments");                          \
+        if ((lvl) <= DLOG_LEVEL_##tag) {                                    \
+            static const dlog_site_t dlog_site = {(lvl), #tag, fmt};        \
+            dlog_write(&dlog_site, DLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__); \
+        }                                                                   \
+        /* Type checks the format, never runs */                            \
+        if (0) printf(fmt, ##__VA_ARGS__);                                  \
+    } while (0)
+
+#define DLOGE(tag, fmt, ...) DLOG(tag, DLOG_ERROR, fmt, ##__VA_ARGS__)
+#define DLOGW(tag, fmt, ...) DLOG(tag, DLOG_WARN, fmt, ##__VA_ARGS__)
+#define DLOGI(tag, fmt, ...) DLOG(tag, DLOG_INFO, fmt, ##__VA_ARGS__)
+#define DLOGD(tag, fmt, ...) DLOG(tag, DLOG_DEBUG, fmt, ##__VA_ARGS__)
+#define DLOGV(tag, fmt, ...) DLOG(tag, DLOG_VERBOSE, fmt, ##__VA_ARGS__)
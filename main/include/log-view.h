@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+#include "text-field.h"
+
+// Scrollback log in fixed memory.  The last LOG_VIEW_HISTORY lines are kept
+// in a ring outside LVGL's pool, and only as many label rows as fit on
+// screen exist; they're reused for whatever lines are in view, so adding a
+// line costs the same on day one and day one hundred.
+
+// Lines kept, must be a power of two
+#define LOG_VIEW_HISTORY 32
+#define LOG_VIEW_MAX_ROWS 8
+
+typedef struct log_view {
+    text_field_t rows[LOG_VIEW_MAX_ROWS];
+    uint8_t row_cnt;
+    uint32_t added; // Lines ever added
+    uint32_t scroll; // Lines back from the newest
+    char lines[LOG_VIEW_HISTORY][TEXT_FIELD_SIZE];
+} log_view_t;
+
+// Fits as many rows as height allows, up to LOG_VIEW_MAX_ROWS.  The view
+// must stay put in memory while its rows exist.
+void log_view_init(log_view_t *view, lv_obj_t *parent, lv_coord_t width,
+                   lv_coord_t height);
+void log_view_add(log_view_t *view, const char *line);
+void log_view_printf(log_view_t *view, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+// Positive looks further back, clamped to what's kept.  New lines don't
+// move a view that's scrolled back.
+void log_view_scroll(log_view_t *view, int lines);
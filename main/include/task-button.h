@@ -4,6 +4,13 @@
 #include "freertos/queue.h"
 #include "stdint.h"
 
+#include "button-trace.h"
+
+// Buttons are tracked as bits in a uint64_t mask
+#define MAX_BUTTONS 64
+// Edges buffered between the ISR and button_worker, must be a power of two
+#define BUTTON_RING_SIZE 32
+
 typedef enum button_active_level {
     LOW,
     HIGH
@@ -16,18 +23,26 @@ typedef void *button_callback_param_t;
 typedef void (*button_callback_func_t)(int64_t event_time, event_t evt,
                                        button_callback_param_t param);
 typedef void *callback_handle_t;
+// Every edge button_worker takes off the ring, before any callbacks run
+typedef void (*button_activity_func_t)(int64_t event_time, void *param);
 
 typedef struct button_spec {
     gpio_num_t gpio_num;
     gpio_pull_mode_t pull_mode;
     button_active_level_t active_level;
+
+    // Debounce, edges closer than this (us) to the last accepted one are
+    // dropped and the level is rechecked once the line has been quiet.
+    int64_t debounce_time;
+    // Reads per edge, the majority wins.  0 or 1 for a single read.
+    uint8_t samples;
 } button_spec_t;
 
 typedef struct button_callback {
     // All times in US
     int64_t min_time; // Minimum press duration to be considered for 'press'
     int64_t max_time; // Maximum press duration to be considered for 'release'
-    int64_t callback_interval; // How often after 'press' until 'release' to receive callbacks
+    int64_t callback_interval; // How often after 'press' until 'release' to receive callbacks, 0 for once
 
     uint64_t button_mask;
     uint64_t ignore_mask;
@@ -40,7 +55,24 @@ typedef struct button_callback {
     button_callback_param_t release_param;
 } button_callback_t;
 
+typedef struct button_stats {
+    uint32_t events;     // Edges queued by the ISR
+    uint32_t overflows;  // Edges dropped because the ring was full
+    uint32_t high_water; // Most edges waiting at once
+    uint32_t rejected;   // Edges dropped by the debounce/glitch filter
+} button_stats_t;
+
 buttons_handle_t init_buttons(int max_buttons);
 void setup_interrupts(buttons_handle_t *wdata);
 int setup_button_gpio(buttons_handle_t data, button_spec_t *button);
-callback_handle_t attach_callback(buttons_handle_t data, button_callback_t *cb);
\ No newline at end of file
+callback_handle_t attach_callback(buttons_handle_t data, button_callback_t *cb);
+void button_get_stats(buttons_handle_t data, button_stats_t *stats);
+// Record every raw edge into trace, NULL to stop.
+void button_set_trace(buttons_handle_t data, button_trace_writer_t *trace);
+// esp_timer time button_worker next wakes up on its own, 0 if it's idle.
+int64_t button_next_wakeup(buttons_handle_t data);
+// Wake button_worker to recheck held buttons against the current time.
+void button_wake(buttons_handle_t data);
+// One per set of buttons, NULL to stop.  Called from button_worker.
+void button_set_activity_cb(buttons_handle_t data, button_activity_func_t cb,
+                            void *param);
\ No newline at end of file
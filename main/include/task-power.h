@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driver/gpio.h"
+
+// Steps the board down as it sits without input: full brightness at full
+// clock while in use, then the backlight dims and the CPU is let down to
+// min_freq_mhz, then the backlight goes off, then the chip light sleeps in
+// slices until a wake pin goes active.  Any input goes straight back to
+// active.
+
+typedef enum power_state {
+    POWER_ACTIVE,
+    POWER_DIM,
+    POWER_OFF,
+    POWER_SLEEP,
+    POWER_STATE_MAX
+} power_state_t;
+
+#define POWER_MAX_WAKE_PINS 4
+
+typedef struct power_wake_pin {
+    gpio_num_t gpio_num;
+    uint8_t active_level;
+} power_wake_pin_t;
+
+typedef struct power_config {
+    // All times in US since the last input, 0 skips that step
+    int64_t dim_after;
+    int64_t off_after;
+    int64_t sleep_after;
+    uint8_t dim_percent; // Backlight while dimmed
+    uint32_t min_freq_mhz;
+    power_wake_pin_t wake_pins[POWER_MAX_WAKE_PINS];
+    uint8_t wake_pin_cnt;
+} power_config_t;
+
+typedef struct power_stats {
+    power_state_t state;
+    int64_t residency_us[POWER_STATE_MAX]; // Including the current state
+    int64_t since_us;                       // ... counted from here
+    int64_t at_us;                          // ... to here
+    int64_t slept_us;   // Actually in light sleep, part of POWER_SLEEP
+    uint32_t sleeps;
+    uint32_t gpio_wakeups;
+} power_stats_t;
+
+void power_init(const power_config_t *config);
+// Input seen, from any task
+void power_activity(void);
+void power_get_stats(power_stats_t *stats);
+const char *power_state_name(power_state_t state);
+void power_dump(void);
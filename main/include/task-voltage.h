@@ -5,8 +5,12 @@
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
 
+#include "battery-history.h"
+
 typedef struct {
-    float reading;
+    float reading; // Filtered battery voltage
+    float noise;   // Spread of the samples behind it, in volts
+    uint16_t samples;
     bool charging;
 } adc_reading_t;
 
@@ -15,4 +19,7 @@ typedef void *adc_handle_t;
 QueueHandle_t voltage_worker_init(adc_handle_t *data);
 void voltage_task_worker(void *param);
 void voltage_task_start(adc_handle_t data);
-void voltage_task_stop(adc_handle_t data);
\ No newline at end of file
+void voltage_task_stop(adc_handle_t data);
+void voltage_task_set_notify(adc_handle_t data, void (*notify)(void));
+// Every reading, shown or not, lands here.  NULL until voltage_worker_init.
+battery_history_handle_t voltage_task_history(void);
\ No newline at end of file
@@ -3,4 +3,52 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
-QueueHandle_t wifi_init(char *ssid, char *pass);
\ No newline at end of file
+
+// Status updates queued for the screen; the queue's storage is the whole
+// pool, nothing is allocated per event.
+#define WIFI_STATUS_SLOTS 8
+
+typedef enum wifi_state {
+    WIFI_STATE_CONNECTING,
+    WIFI_STATE_CONNECTED,
+    WIFI_STATE_DISCONNECTED,
+    WIFI_STATE_GOT_IP
+} wifi_state_t;
+
+typedef struct wifi_status {
+    int64_t time;      // esp_timer time the event came in
+    uint32_t ip;       // Network order, only for WIFI_STATE_GOT_IP
+    uint32_t backoff_ms; // Wait before the next try, WIFI_STATE_DISCONNECTED
+    uint16_t retries;  // Reconnects since the last IP
+    uint8_t state;     // wifi_state_t
+    uint8_t reason;    // wifi_err_reason_t, only for WIFI_STATE_DISCONNECTED
+    int8_t rssi;       // 0 when unknown
+    uint8_t channel;   // 0 when unknown
+} wifi_status_t;
+
+// Returns a queue of wifi_status_t
+QueueHandle_t wifi_init(char *ssid, char *pass);
+// Stops the driver and deletes the queue; wifi_init can start it again.
+void wifi_deinit(QueueHandle_t msg_queue);
+void wifi_set_notify(void (*notify)(void));
+// Statuses thrown away because the queue was full
+uint32_t wifi_dropped_status(void);
+
+// Time from esp_wifi_connect() to an IP
+typedef struct wifi_connect_metrics {
+    uint32_t count;
+    int64_t last_us;
+    int64_t min_us;
+    int64_t max_us;
+    int64_t total_us;
+} wifi_connect_metrics_t;
+
+typedef struct wifi_metrics {
+    wifi_connect_metrics_t cold; // Full scan
+    wifi_connect_metrics_t warm; // Straight to the cached BSSID/channel
+    uint32_t failures;
+} wifi_metrics_t;
+
+void wifi_get_metrics(wifi_metrics_t *metrics);
+// Logs the metrics above
+void wifi_dump(void);
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+// A single line of text on a fixed size label that owns its buffer.
+// Setting the same text again does nothing, and a change only invalidates
+// from the first differing character to the end of the line, instead of
+// the reallocation and full re-layout lv_textarea/lv_label_set_text do.
+//
+// ASCII only, so byte offsets are glyph offsets.
+
+#define TEXT_FIELD_SIZE 48
+
+typedef struct text_field {
+    lv_obj_t *label;
+    uint8_t len;
+    char text[TEXT_FIELD_SIZE];
+} text_field_t;
+
+// width of 0 fills the parent's width.  The field must stay put in memory
+// while the label exists, the label draws straight from field->text.
+void text_field_init(text_field_t *field, lv_obj_t *parent, lv_coord_t width,
+                     const char *text);
+// Both return whether anything changed.  Text past TEXT_FIELD_SIZE - 1
+// characters is cut off.
+bool text_field_set(text_field_t *field, const char *text);
+bool text_field_printf(text_field_t *field, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
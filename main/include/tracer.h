@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Flight recorder for input-to-photon latency.  Begin/end/instant records go
+// into a fixed ring, oldest overwritten first, and tracer_dump() prints it as
+// text for host/tools/trace-to-chrome to turn into Chrome/Perfetto JSON.
+//
+// Build with TRACE_ENABLED=0 to compile every TRACE_* site out.
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// Records kept, must be a power of two.  16 bytes each on the ESP32.
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 512
+#endif
+
+typedef enum trace_event {
+    TRACE_BUTTON_ISR,
+    TRACE_BUTTON_DISPATCH,
+    TRACE_SHOW_DISPLAY,
+    TRACE_CONTENT_WORKER,
+    TRACE_SCREEN_LOAD,
+    TRACE_SCREEN_UNLOAD,
+    TRACE_LV_TASK_HANDLER,
+    TRACE_FLUSH,
+    TRACE_FLUSH_SEND,
+    TRACE_ADC_SAMPLE,
+    TRACE_SNAPSHOT_TRANSITION,
+    TRACE_EVENT_MAX
+} trace_event_t;
+
+typedef enum trace_phase {
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E',
+    TRACE_PHASE_INSTANT = 'i',
+} trace_phase_t;
+
+void tracer_start(void);
+void tracer_stop(void);
+// Safe from ISRs.  from_isr records against the interrupted core rather
+// than the interrupted task.
+void tracer_record(trace_phase_t phase, trace_event_t event, uint32_t arg,
+                   bool from_isr);
+// Prints the ring, oldest first.  Recording pauses while it does.
+void tracer_dump(void);
+
+#if TRACE_ENABLED
+#define TRACE_BEGIN(event, arg) \
+    tracer_record(TRACE_PHASE_BEGIN, (event), (arg), false)
+#define TRACE_END(event, arg) \
+    tracer_record(TRACE_PHASE_END, (event), (arg), false)
+#define TRACE_INSTANT(event, arg) \
+    tracer_record(TRACE_PHASE_INSTANT, (event), (arg), false)
+#define TRACE_INSTANT_ISR(event, arg) \
+    tracer_record(TRACE_PHASE_INSTANT, (event), (arg), true)
+#else
+#define TRACE_BEGIN(event, arg) do {} while (0)
+#define TRACE_END(event, arg) do {} while (0)
+#define TRACE_INSTANT(event, arg) do {} while (0)
+#define TRACE_INSTANT_ISR(event, arg) do {} while (0)
+#endif
@@ -0,0 +1,612 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "battery-history.h"
+#include "diagnostics.h"
+
+#define HISTORY_BLOCK_SIZE 128
+#define HISTORY_BLOCKS 8
+#define HISTORY_MINUTE 60
+#define HISTORY_MINUTE_BUCKETS 120 // 2 hours
+#define HISTORY_QUARTER (15 * 60)
+#define HISTORY_QUARTER_BUCKETS 96 // 24 hours
+// Quarter hour buckets collected before they're written out.  Anything not
+// written is lost on a reset or brown-out, so every one goes out as it
+// closes; that's about 100 small blob writes a day.
+#define HISTORY_FLUSH_BUCKETS 1
+
+#define HISTORY_NVS_NAMESPACE "history"
+#define HISTORY_NVS_KEY "battery"
+#define HISTORY_NVS_VERSION 1
+#define HISTORY_NVS_HEADER 4
+// varint time delta, zigzag avg delta, then min, max and count varints
+#define HISTORY_NVS_BUCKET_MAX 17
+
+static const char *tag = "battery_history";
+
+// Samples after the first are varint time deltas followed by zigzag varint
+// mV deltas, usually 2 bytes a sample.
+typedef struct history_block {
+    int32_t start;
+    int32_t last_time;
+    uint16_t first_mv;
+    uint16_t last_mv;
+    uint16_t count;
+    uint16_t len;
+    uint8_t data[HISTORY_BLOCK_SIZE - 16];
+} history_block_t;
+
+typedef struct history_bucket {
+    int32_t time; // Start of the bucket
+    uint16_t min;
+    uint16_t max;
+    uint16_t avg;
+    uint16_t count;
+} history_bucket_t;
+
+typedef struct bucket_ring {
+    history_bucket_t *buckets;
+    uint16_t size;
+    uint16_t head; // Next slot to write
+    uint16_t count;
+} bucket_ring_t;
+
+typedef struct rollup {
+    int32_t slot;
+    uint32_t sum;
+    uint32_t count;
+    uint16_t min;
+    uint16_t max;
+} rollup_t;
+
+typedef struct history {
+    SemaphoreHandle_t lock;
+    uint32_t version;
+
+    history_block_t blocks[HISTORY_BLOCKS];
+    uint8_t block_head; // Block being appended to
+    uint8_t block_count;
+
+    history_bucket_t minute_buckets[HISTORY_MINUTE_BUCKETS];
+    history_bucket_t quarter_buckets[HISTORY_QUARTER_BUCKETS];
+    bucket_ring_t minutes;
+    bucket_ring_t quarters;
+    rollup_t minute_rollup;
+    rollup_t quarter_rollup;
+    int unflushed;
+} history_t;
+
+typedef struct point_sink {
+    battery_point_t *out;
+    size_t max;
+    size_t count;
+    int32_t from;
+    int32_t step;
+
+    int32_t time;
+    uint32_t sum;
+    uint32_t samples;
+} point_sink_t;
+
+static size_t put_varint(uint8_t *out, uint32_t val) {
+    size_t len = 0;
+    while (val >= 0x80) {
+        out[len++] = (val & 0x7f) | 0x80;
+        val >>= 7;
+    }
+    out[len++] = val;
+    return len;
+}
+
+// Returns the bytes used, 0 if in runs out first
+static size_t get_varint(const uint8_t *in, size_t len, uint32_t *val) {
+    *val = 0;
+    for (size_t i = 0; i < len && i < 5; i++) {
+        *val |= (uint32_t)(in[i] & 0x7f) << (7 * i);
+        if (!(in[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t zigzag(int32_t val) {
+    return ((uint32_t)val << 1) ^ (uint32_t)(val >> 31);
+}
+
+static int32_t unzigzag(uint32_t val) {
+    return (int32_t)(val >> 1) ^ -(int32_t)(val & 1);
+}
+
+static int32_t slot_of(int32_t time, int32_t slot_len) {
+    int32_t slot = time / slot_len;
+    if (time < 0 && slot * slot_len != time) {
+        slot--;
+    }
+    return slot * slot_len;
+}
+
+static void ring_push(bucket_ring_t *ring, const history_bucket_t *bucket) {
+    ring->buckets[ring->head] = *bucket;
+    ring->head = (ring->head + 1) % ring->size;
+    if (ring->count < ring->size) {
+        ring->count++;
+    }
+}
+
+// i counts from the oldest bucket
+static history_bucket_t *ring_at(bucket_ring_t *ring, int i) {
+    return &ring->buckets[(ring->head + ring->size - ring->count + i) %
+                          ring->size];
+}
+
+// Adds in to the rollup, first handing back the finished bucket in done if
+// in starts a new slot.
+static bool rollup_add(rollup_t *rollup, int32_t slot_len,
+                       const history_bucket_t *in, history_bucket_t *done) {
+    int32_t slot = slot_of(in->time, slot_len);
+    bool finished = false;
+
+    if (rollup->count && slot != rollup->slot) {
+        done->time = rollup->slot;
+        done->min = rollup->min;
+        done->max = rollup->max;
+        done->avg = (rollup->sum + rollup->count / 2) / rollup->count;
+        done->count = rollup->count > UINT16_MAX ? UINT16_MAX : rollup->count;
+        rollup->count = 0;
+        finished = true;
+    }
+
+    if (rollup->count == 0) {
+        rollup->slot = slot;
+        rollup->sum = 0;
+        rollup->min = UINT16_MAX;
+        rollup->max = 0;
+    }
+    rollup->sum += (uint32_t)in->avg * in->count;
+    rollup->count += in->count;
+    if (in->min < rollup->min) rollup->min = in->min;
+    if (in->max > rollup->max) rollup->max = in->max;
+    return finished;
+}
+
+static void raw_add(history_t *history, int32_t time, uint16_t mv) {
+    history_block_t *block = &history->blocks[history->block_head];
+    uint8_t encoded[10];
+    size_t len = 0;
+
+    if (history->block_count) {
+        if (time < block->last_time) {
+            time = block->last_time;
+        }
+        len = put_varint(encoded, time - block->last_time);
+        len += put_varint(encoded + len,
+                          zigzag((int32_t)mv - block->last_mv));
+    }
+
+    if (history->block_count == 0 || block->len + len > sizeof(block->data)) {
+        // Start a new block, dropping the oldest one if they're all used
+        if (history->block_count) {
+            history->block_head = (history->block_head + 1) % HISTORY_BLOCKS;
+        }
+        if (history->block_count < HISTORY_BLOCKS) {
+            history->block_count++;
+        }
+        block = &history->blocks[history->block_head];
+        memset(block, 0, sizeof(history_block_t));
+        block->start = block->last_time = time;
+        block->first_mv = block->last_mv = mv;
+        block->count = 1;
+        return;
+    }
+
+    memcpy(block->data + block->len, encoded, len);
+    block->len += len;
+    block->count++;
+    block->last_time = time;
+    block->last_mv = mv;
+}
+
+static history_block_t *block_at(history_t *history, int i) {
+    return &history->blocks[(history->block_head + HISTORY_BLOCKS -
+                             history->block_count + 1 + i) %
+                            HISTORY_BLOCKS];
+}
+
+// Serializes the quarter buckets, under the lock.  NULL if there's no room.
+static uint8_t *encode_buckets(history_t *history, size_t *out_len) {
+    bucket_ring_t *quarters = &history->quarters;
+    size_t size = HISTORY_NVS_HEADER + quarters->count * HISTORY_NVS_BUCKET_MAX;
+    uint8_t *buf = diag_malloc(DIAG_TAG_HISTORY, size);
+    if (buf == NULL) {
+        ESP_LOGE(tag, "ENOMEM serializing history");
+        return NULL;
+    }
+
+    buf[0] = HISTORY_NVS_VERSION;
+    buf[1] = 0;
+    buf[2] = quarters->count & 0xff;
+    buf[3] = quarters->count >> 8;
+    size_t len = HISTORY_NVS_HEADER;
+
+    history_bucket_t prev = {0};
+    for (int i = 0; i < quarters->count; i++) {
+        history_bucket_t *b = ring_at(quarters, i);
+        if (i == 0) {
+            len += put_varint(buf + len, zigzag(b->time));
+        } else {
+            len += put_varint(buf + len, b->time - prev.time);
+        }
+        len += put_varint(buf + len, zigzag((int32_t)b->avg - prev.avg));
+        len += put_varint(buf + len, b->avg - b->min);
+        len += put_varint(buf + len, b->max - b->avg);
+        len += put_varint(buf + len, b->count);
+        prev = *b;
+    }
+
+    *out_len = len;
+    return buf;
+}
+
+static bool store_buckets(const uint8_t *buf, size_t len) {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(HISTORY_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, HISTORY_NVS_KEY, buf, len);
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(tag, "Failed to save history: %s", esp_err_to_name(err));
+        return false;
+    }
+    ESP_LOGI(tag, "Saved %d buckets in %zu bytes", buf[2] | (buf[3] << 8),
+             len);
+    return true;
+}
+
+// Takes a snapshot of the buckets under the lock and writes it out after
+// letting go, so readers like the history screen don't wait on a flash
+// write.  Only battery_history_add() writes, so there's never a second
+// writer to order against.
+static void write_buckets(history_t *history) {
+    xSemaphoreTake(history->lock, portMAX_DELAY);
+    int pending = history->unflushed;
+    size_t len = 0;
+    uint8_t *buf = encode_buckets(history, &len);
+    if (buf != NULL) {
+        history->unflushed = 0;
+    }
+    xSemaphoreGive(history->lock);
+
+    if (buf != NULL) {
+        if (!store_buckets(buf, len)) {
+            // Try again with the next batch
+            xSemaphoreTake(history->lock, portMAX_DELAY);
+            history->unflushed += pending;
+            xSemaphoreGive(history->lock);
+        }
+        diag_free(buf);
+    }
+}
+
+static void read_buckets(history_t *history) {
+    nvs_handle_t nvs;
+    if (nvs_open(HISTORY_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+
+    size_t size = HISTORY_NVS_HEADER +
+                  HISTORY_QUARTER_BUCKETS * HISTORY_NVS_BUCKET_MAX;
+    uint8_t *buf = diag_malloc(DIAG_TAG_HISTORY, size);
+    if (buf == NULL || nvs_get_blob(nvs, HISTORY_NVS_KEY, buf, &size) != ESP_OK ||
+        size < HISTORY_NVS_HEADER || buf[0] != HISTORY_NVS_VERSION) {
+        diag_free(buf);
+        nvs_close(nvs);
+        return;
+    }
+    nvs_close(nvs);
+
+    int count = buf[2] | (buf[3] << 8);
+    size_t pos = HISTORY_NVS_HEADER;
+    history_bucket_t bucket = {0};
+    for (int i = 0; i < count; i++) {
+        uint32_t val[5];
+        for (int v = 0; v < 5; v++) {
+            size_t used = get_varint(buf + pos, size - pos, &val[v]);
+            if (used == 0) {
+                ESP_LOGW(tag, "Saved history is truncated");
+                count = i;
+                break;
+            }
+            pos += used;
+        }
+        if (i == count) {
+            break;
+        }
+
+        bucket.time = i == 0 ? unzigzag(val[0]) : bucket.time + (int32_t)val[0];
+        bucket.avg += unzigzag(val[1]);
+        bucket.min = bucket.avg - val[2];
+        bucket.max = bucket.avg + val[3];
+        bucket.count = val[4];
+        ring_push(&history->quarters, &bucket);
+    }
+    diag_free(buf);
+
+    if (history->quarters.count == 0) {
+        return;
+    }
+
+    // Line the old boot up so its last bucket ends where this boot starts
+    int32_t shift = -(ring_at(&history->quarters,
+                              history->quarters.count - 1)->time +
+                      HISTORY_QUARTER);
+    for (int i = 0; i < history->quarters.count; i++) {
+        ring_at(&history->quarters, i)->time += shift;
+    }
+    ESP_LOGI(tag, "Loaded %d buckets", history->quarters.count);
+}
+
+battery_history_handle_t battery_history_init(void) {
+    history_t *history = diag_calloc(DIAG_TAG_HISTORY, 1, sizeof(history_t));
+    if (history == NULL) {
+        ESP_LOGE(tag, "ENOMEM allocating history");
+        vTaskDelay(portMAX_DELAY);
+    }
+
+    history->lock = xSemaphoreCreateMutex();
+    if (history->lock == NULL) {
+        ESP_LOGE(tag, "Failed to create history lock");
+        vTaskDelay(portMAX_DELAY);
+    }
+
+    history->minutes.buckets = history->minute_buckets;
+    history->minutes.size = HISTORY_MINUTE_BUCKETS;
+    history->quarters.buckets = history->quarter_buckets;
+    history->quarters.size = HISTORY_QUARTER_BUCKETS;
+
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
+        ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    if (ret == ESP_OK) {
+        read_buckets(history);
+    } else {
+        ESP_LOGW(tag, "No NVS, history won't be saved");
+    }
+
+    return history;
+}
+
+void battery_history_add(battery_history_handle_t handle, int32_t time,
+                         uint16_t mv) {
+    history_t *history = handle;
+    history_bucket_t sample = {
+        .time = time, .min = mv, .max = mv, .avg = mv, .count = 1};
+    history_bucket_t minute, quarter;
+
+    xSemaphoreTake(history->lock, portMAX_DELAY);
+    raw_add(history, time, mv);
+    if (rollup_add(&history->minute_rollup, HISTORY_MINUTE, &sample,
+                   &minute)) {
+        ring_push(&history->minutes, &minute);
+        if (rollup_add(&history->quarter_rollup, HISTORY_QUARTER, &minute,
+                       &quarter)) {
+            ring_push(&history->quarters, &quarter);
+            history->unflushed++;
+        }
+    }
+    history->version++;
+    bool flush = history->unflushed >= HISTORY_FLUSH_BUCKETS;
+    xSemaphoreGive(history->lock);
+
+    if (flush) {
+        write_buckets(history);
+    }
+}
+
+uint32_t battery_history_version(battery_history_handle_t handle) {
+    history_t *history = handle;
+    return history->version;
+}
+
+static void sink_flush(point_sink_t *sink) {
+    if (sink->samples == 0) {
+        return;
+    }
+
+    battery_point_t point = {
+        .time = sink->time,
+        .mv = (sink->sum + sink->samples / 2) / sink->samples};
+    if (sink->count < sink->max) {
+        sink->out[sink->count++] = point;
+    } else {
+        sink->out[sink->max - 1] = point;
+    }
+    sink->samples = 0;
+}
+
+// Points closer together than step are averaged into one
+static void sink_add(point_sink_t *sink, int32_t time, uint16_t mv) {
+    if (time < sink->from) {
+        return;
+    }
+    if (sink->samples && time - sink->time >= sink->step) {
+        sink_flush(sink);
+    }
+    if (sink->samples == 0) {
+        sink->time = time;
+        sink->sum = 0;
+    }
+    sink->sum += mv;
+    sink->samples++;
+}
+
+static void sink_block(point_sink_t *sink, history_block_t *block) {
+    int32_t time = block->start;
+    int32_t mv = block->first_mv;
+    size_t pos = 0;
+
+    sink_add(sink, time, mv);
+    for (int i = 1; i < block->count; i++) {
+        uint32_t dt, dmv;
+        size_t used = get_varint(block->data + pos, block->len - pos, &dt);
+        if (used == 0) {
+            return;
+        }
+        pos += used;
+        used = get_varint(block->data + pos, block->len - pos, &dmv);
+        if (used == 0) {
+            return;
+        }
+        pos += used;
+
+        time += dt;
+        mv += unzigzag(dmv);
+        sink_add(sink, time, mv);
+    }
+}
+
+size_t battery_history_get(battery_history_handle_t handle, int32_t span,
+                           battery_point_t *out, size_t max) {
+    history_t *history = handle;
+    if (max == 0) {
+        return 0;
+    }
+
+    xSemaphoreTake(history->lock, portMAX_DELAY);
+
+    // Each tier only covers what the finer one after it no longer has
+    int32_t raw_start = INT32_MAX;
+    int32_t newest = INT32_MIN;
+    int32_t oldest = INT32_MAX;
+    if (history->block_count) {
+        raw_start = block_at(history, 0)->start;
+        newest = history->blocks[history->block_head].last_time;
+        oldest = raw_start;
+    }
+    int32_t minute_start = raw_start;
+    if (history->minutes.count) {
+        history_bucket_t *first = ring_at(&history->minutes, 0);
+        history_bucket_t *last =
+            ring_at(&history->minutes, history->minutes.count - 1);
+        minute_start = first->time < raw_start ? first->time : raw_start;
+        if (first->time < oldest) oldest = first->time;
+        if (last->time > newest) newest = last->time;
+    }
+    if (history->quarters.count) {
+        history_bucket_t *first = ring_at(&history->quarters, 0);
+        history_bucket_t *last =
+            ring_at(&history->quarters, history->quarters.count - 1);
+        if (first->time < oldest) oldest = first->time;
+        if (last->time > newest) newest = last->time;
+    }
+
+    size_t count = 0;
+    if (oldest <= newest) {
+        point_sink_t sink = {.out = out, .max = max};
+        sink.from = oldest;
+        if (span > 0 && newest - span > oldest) {
+            sink.from = newest - span;
+        }
+        sink.step = (newest - sink.from) / (int32_t)max + 1;
+
+        for (int i = 0; i < history->quarters.count; i++) {
+            history_bucket_t *b = ring_at(&history->quarters, i);
+            if (b->time + HISTORY_QUARTER <= minute_start) {
+                sink_add(&sink, b->time, b->avg);
+            }
+        }
+        for (int i = 0; i < history->minutes.count; i++) {
+            history_bucket_t *b = ring_at(&history->minutes, i);
+            if (b->time + HISTORY_MINUTE <= raw_start) {
+                sink_add(&sink, b->time, b->avg);
+            }
+        }
+        for (int i = 0; i < history->block_count; i++) {
+            sink_block(&sink, block_at(history, i));
+        }
+        sink_flush(&sink);
+        count = sink.count;
+    }
+
+    xSemaphoreGive(history->lock);
+    return count;
+}
+
+size_t battery_history_lttb(const battery_point_t *in, size_t n,
+                            battery_point_t *out, size_t threshold) {
+    if (threshold >= n) {
+        memcpy(out, in, n * sizeof(battery_point_t));
+        return n;
+    }
+    if (threshold < 3) {
+        if (threshold > 0) out[0] = in[0];
+        if (threshold > 1) out[1] = in[n - 1];
+        return threshold;
+    }
+
+    // First and last points are always kept, the rest are split into
+    // threshold - 2 buckets and each keeps the point that makes the biggest
+    // triangle with the previous pick and the next bucket's average.
+    size_t count = 0;
+    size_t a = 0;
+    out[count++] = in[0];
+
+    for (size_t bucket = 0; bucket < threshold - 2; bucket++) {
+        size_t start = 1 + bucket * (n - 2) / (threshold - 2);
+        size_t end = 1 + (bucket + 1) * (n - 2) / (threshold - 2);
+        size_t next_end = 1 + (bucket + 2) * (n - 2) / (threshold - 2);
+        if (next_end > n) {
+            next_end = n;
+        }
+
+        int64_t avg_x = 0, avg_y = 0;
+        size_t next_cnt = next_end - end;
+        if (next_cnt == 0) {
+            avg_x = in[n - 1].time;
+            avg_y = in[n - 1].mv;
+        } else {
+            for (size_t i = end; i < next_end; i++) {
+                avg_x += in[i].time;
+                avg_y += in[i].mv;
+            }
+            avg_x /= (int64_t)next_cnt;
+            avg_y /= (int64_t)next_cnt;
+        }
+
+        int64_t best_area = -1;
+        size_t best = start;
+        for (size_t i = start; i < end; i++) {
+            int64_t area = ((int64_t)in[a].time - avg_x) *
+                               ((int64_t)in[i].mv - in[a].mv) -
+                           ((int64_t)in[a].time - in[i].time) *
+                               (avg_y - in[a].mv);
+            if (area < 0) {
+                area = -area;
+            }
+            if (area > best_area) {
+                best_area = area;
+                best = i;
+            }
+        }
+        out[count++] = in[best];
+        a = best;
+    }
+
+    out[count++] = in[n - 1];
+    return count;
+}
@@ -0,0 +1,110 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_attr.h"
+
+#include "button-trace.h"
+
+static const uint8_t magic[4] = {'B', 'T', 'R', 'C'};
+
+bool button_trace_writer_init(button_trace_writer_t *writer, uint8_t *buf,
+                              size_t size) {
+    if (size < BUTTON_TRACE_HEADER_SIZE) {
+        return false;
+    }
+
+    memset(writer, 0, sizeof(button_trace_writer_t));
+    memset(buf, 0, BUTTON_TRACE_HEADER_SIZE);
+    memcpy(buf, magic, sizeof(magic));
+    buf[4] = BUTTON_TRACE_VERSION;
+
+    writer->buf = buf;
+    writer->size = size;
+    writer->len = BUTTON_TRACE_HEADER_SIZE;
+    return true;
+}
+
+bool IRAM_ATTR button_trace_put(button_trace_writer_t *writer,
+                                const button_trace_rec_t *rec) {
+    if (writer->size - writer->len < BUTTON_TRACE_RECORD_MAX) {
+        writer->dropped++;
+        return false;
+    }
+
+    // Edges can be stamped out of order across buttons, never go backwards
+    uint64_t delta = 0;
+    if (rec->edge_time > writer->last_time) {
+        delta = rec->edge_time - writer->last_time;
+        writer->last_time = rec->edge_time;
+    }
+
+    uint8_t *out = writer->buf + writer->len;
+    while (delta >= 0x80) {
+        *out++ = (delta & 0x7f) | 0x80;
+        delta >>= 7;
+    }
+    *out++ = delta;
+    *out++ = (rec->button << 1) | (rec->level & 1);
+
+    writer->len = out - writer->buf;
+    writer->records++;
+    return true;
+}
+
+void button_trace_dump(const button_trace_writer_t *writer) {
+    printf("BTRACE %" PRIu32 " records, %" PRIu32 " dropped, %zu bytes\n",
+           writer->records, writer->dropped, writer->len);
+    for (size_t i = 0; i < writer->len; i += 32) {
+        for (size_t j = i; j < writer->len && j < i + 32; j++) {
+            printf("%02x", writer->buf[j]);
+        }
+        printf("\n");
+    }
+    printf("BTRACE end\n");
+    fflush(stdout);
+}
+
+bool button_trace_reader_init(button_trace_reader_t *reader,
+                              const uint8_t *buf, size_t len) {
+    if (len < BUTTON_TRACE_HEADER_SIZE || memcmp(buf, magic, sizeof(magic)) ||
+        buf[4] != BUTTON_TRACE_VERSION) {
+        return false;
+    }
+
+    memset(reader, 0, sizeof(button_trace_reader_t));
+    reader->buf = buf;
+    reader->len = len;
+    reader->pos = BUTTON_TRACE_HEADER_SIZE;
+    return true;
+}
+
+bool button_trace_get(button_trace_reader_t *reader, button_trace_rec_t *rec) {
+    uint64_t delta = 0;
+    int shift = 0;
+    size_t pos = reader->pos;
+
+    while (true) {
+        if (pos >= reader->len || shift > 63) {
+            return false;
+        }
+        uint8_t b = reader->buf[pos++];
+        delta |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+
+    if (pos >= reader->len) {
+        return false;
+    }
+    uint8_t packed = reader->buf[pos++];
+
+    reader->last_time += delta;
+    reader->pos = pos;
+    rec->edge_time = reader->last_time;
+    rec->button = packed >> 1;
+    rec->level = packed & 1;
+    return true;
+}
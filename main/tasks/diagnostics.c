@@ -0,0 +1,250 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "lvgl/lvgl.h"
+
+#include "diagnostics.h"
+
+#define LVGL_SAMPLE_US (1000 * 1000)
+
+// Sits in front of every tagged block
+typedef union alloc_header {
+    struct {
+        uint32_t size;
+        uint8_t tag;
+    } info;
+    max_align_t align;
+} alloc_header_t;
+
+typedef struct diag_task {
+    TaskHandle_t handle;
+    const char *name;
+    uint32_t stack_size;
+} diag_task_t;
+
+typedef struct diag_data {
+    diag_alloc_stats_t allocs[DIAG_TAG_MAX];
+    diag_task_t tasks[DIAG_MAX_TASKS];
+    size_t task_cnt;
+    lv_mem_monitor_t lv_mem;
+    int64_t lv_sampled_at;
+} diag_data_t;
+
+static const char *diag_log_tag = "diagnostics";
+
+static const char *tag_names[DIAG_TAG_MAX] = {
+    [DIAG_TAG_BUTTON] = "button",
+    [DIAG_TAG_VOLTAGE] = "voltage",
+    [DIAG_TAG_HISTORY] = "history",
+    [DIAG_TAG_DISPLAY] = "display",
+    [DIAG_TAG_SCREEN] = "screen",
+    [DIAG_TAG_POWER] = "power",
+};
+
+static portMUX_TYPE diag_mux = portMUX_INITIALIZER_UNLOCKED;
+static diag_data_t diag;
+
+const char *diag_tag_name(diag_tag_t tag) {
+    if (tag >= DIAG_TAG_MAX) {
+        return "?";
+    }
+    return tag_names[tag];
+}
+
+static void account(diag_tag_t tag, int32_t bytes, int32_t allocs) {
+    portENTER_CRITICAL(&diag_mux);
+    diag_alloc_stats_t *stats = &diag.allocs[tag];
+    stats->bytes += bytes;
+    stats->allocs += allocs;
+    if (stats->bytes > stats->peak) {
+        stats->peak = stats->bytes;
+    }
+    portEXIT_CRITICAL(&diag_mux);
+}
+
+static void alloc_failed(diag_tag_t tag, size_t size) {
+    portENTER_CRITICAL(&diag_mux);
+    diag.allocs[tag].failures++;
+    portEXIT_CRITICAL(&diag_mux);
+
+    ESP_LOGE(tag_names[tag], "ENOMEM allocating %u bytes", (unsigned)size);
+    diag_dump();
+}
+
+static void *track(diag_tag_t tag, alloc_header_t *header, size_t size) {
+    header->info.size = size;
+    header->info.tag = tag;
+    account(tag, size, 1);
+    return header + 1;
+}
+
+void *diag_malloc(diag_tag_t tag, size_t size) {
+    alloc_header_t *header = malloc(sizeof(alloc_header_t) + size);
+    if (header == NULL) {
+        alloc_failed(tag, size);
+        return NULL;
+    }
+    return track(tag, header, size);
+}
+
+void *diag_calloc(diag_tag_t tag, size_t n, size_t size) {
+    if (size != 0 && n > (SIZE_MAX - sizeof(alloc_header_t)) / size) {
+        alloc_failed(tag, SIZE_MAX);
+        return NULL;
+    }
+
+    alloc_header_t *header = calloc(1, sizeof(alloc_header_t) + n * size);
+    if (header == NULL) {
+        alloc_failed(tag, n * size);
+        return NULL;
+    }
+    return track(tag, header, n * size);
+}
+
+void *diag_realloc(diag_tag_t tag, void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return diag_malloc(tag, size);
+    }
+
+    // Stays charged to whoever first allocated it
+    alloc_header_t *header = (alloc_header_t *)ptr - 1;
+    diag_tag_t owner = header->info.tag;
+    uint32_t old_size = header->info.size;
+
+    alloc_header_t *new_header =
+        realloc(header, sizeof(alloc_header_t) + size);
+    if (new_header == NULL) {
+        alloc_failed(owner, size);
+        return NULL;
+    }
+
+    new_header->info.size = size;
+    account(owner, (int32_t)size - (int32_t)old_size, 0);
+    return new_header + 1;
+}
+
+void diag_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    alloc_header_t *header = (alloc_header_t *)ptr - 1;
+    account(header->info.tag, -(int32_t)header->info.size, -1);
+    free(header);
+}
+
+void diag_register_task(TaskHandle_t task, const char *name,
+                        uint32_t stack_depth) {
+    portENTER_CRITICAL(&diag_mux);
+    if (diag.task_cnt < DIAG_MAX_TASKS) {
+        diag_task_t *entry = &diag.tasks[diag.task_cnt++];
+        entry->handle = task;
+        entry->name = name;
+        entry->stack_size = stack_depth * sizeof(StackType_t);
+    }
+    portEXIT_CRITICAL(&diag_mux);
+}
+
+void diag_sample_lvgl(void) {
+    int64_t now = esp_timer_get_time();
+    if (diag.lv_sampled_at != 0 && now - diag.lv_sampled_at < LVGL_SAMPLE_US) {
+        return;
+    }
+
+    // Walks the whole pool, so done outside the lock
+    lv_mem_monitor_t mon;
+    lv_mem_monitor(&mon);
+
+    portENTER_CRITICAL(&diag_mux);
+    diag.lv_mem = mon;
+    diag.lv_sampled_at = now;
+    portEXIT_CRITICAL(&diag_mux);
+}
+
+void diag_get_allocs(diag_tag_t tag, diag_alloc_stats_t *stats) {
+    if (tag >= DIAG_TAG_MAX) {
+        memset(stats, 0, sizeof(diag_alloc_stats_t));
+        return;
+    }
+
+    portENTER_CRITICAL(&diag_mux);
+    *stats = diag.allocs[tag];
+    portEXIT_CRITICAL(&diag_mux);
+}
+
+size_t diag_get_tasks(diag_task_stats_t *out, size_t max) {
+    diag_task_t tasks[DIAG_MAX_TASKS];
+
+    portENTER_CRITICAL(&diag_mux);
+    size_t cnt = diag.task_cnt;
+    memcpy(tasks, diag.tasks, cnt * sizeof(diag_task_t));
+    portEXIT_CRITICAL(&diag_mux);
+
+    if (cnt > max) {
+        cnt = max;
+    }
+
+    for (size_t i = 0; i < cnt; i++) {
+        out[i].name = tasks[i].name;
+        out[i].stack_size = tasks[i].stack_size;
+        out[i].stack_free = uxTaskGetStackHighWaterMark(tasks[i].handle) *
+                            sizeof(StackType_t);
+    }
+    return cnt;
+}
+
+void diag_get_heap(diag_heap_stats_t *stats) {
+    stats->free = esp_get_free_heap_size();
+    stats->minimum_free = esp_get_minimum_free_heap_size();
+    stats->largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    portENTER_CRITICAL(&diag_mux);
+    stats->lv_total = diag.lv_mem.total_size;
+    stats->lv_free = diag.lv_mem.free_size;
+    stats->lv_biggest = diag.lv_mem.free_biggest_size;
+    stats->lv_max_used = diag.lv_mem.max_used;
+    stats->lv_frag_pct = diag.lv_mem.frag_pct;
+    portEXIT_CRITICAL(&diag_mux);
+}
+
+void diag_dump(void) {
+    diag_heap_stats_t heap;
+    diag_get_heap(&heap);
+    ESP_LOGI(diag_log_tag,
+             "heap: %" PRIu32 " free, %" PRIu32 " min free, %" PRIu32
+             " largest block",
+             heap.free, heap.minimum_free, heap.largest_block);
+    ESP_LOGI(diag_log_tag,
+             "lvgl: %" PRIu32 "/%" PRIu32 " free, %" PRIu32
+             " largest block, %" PRIu32 " max used, %u%% fragmented",
+             heap.lv_free, heap.lv_total, heap.lv_biggest, heap.lv_max_used,
+             heap.lv_frag_pct);
+
+    diag_task_stats_t tasks[DIAG_MAX_TASKS];
+    size_t task_cnt = diag_get_tasks(tasks, DIAG_MAX_TASKS);
+    for (size_t i = 0; i < task_cnt; i++) {
+        ESP_LOGI(diag_log_tag,
+                 "stack %s: %" PRIu32 " of %" PRIu32 " never used",
+                 tasks[i].name, tasks[i].stack_free, tasks[i].stack_size);
+    }
+
+    for (diag_tag_t t = 0; t < DIAG_TAG_MAX; t++) {
+        diag_alloc_stats_t stats;
+        diag_get_allocs(t, &stats);
+        ESP_LOGI(diag_log_tag,
+                 "alloc %s: %" PRIu32 " bytes in %" PRIu32 " blocks, %" PRIu32
+                 " peak, %" PRIu32 " failed",
+                 tag_names[t], stats.bytes, stats.allocs, stats.peak,
+                 stats.failures);
+    }
+}
@@ -0,0 +1,141 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "diagnostics.h"
+#include "dlog.h"
+
+#if (DLOG_RING_SIZE & (DLOG_RING_SIZE - 1)) != 0
+#error "DLOG_RING_SIZE must be a power of two"
+#endif
+
+// How often the dlog task empties the ring
+#define DLOG_DRAIN_MS 50
+#define DLOG_LINE_SIZE 128
+
+// Positions count up forever; a slot is reused once per lap of the ring.  A
+// slot's seq is the first position of the lap it's free for, or that plus
+// one once the record for that lap has been written.  Zeroed is all free
+// for the first lap, so it works before dlog_init().
+typedef struct dlog_rec {
+    uint32_t seq;
+    uint32_t time;
+    const dlog_site_t *site;
+    uint32_t args[DLOG_MAX_ARGS];
+} dlog_rec_t;
+
+static dlog_rec_t dlog_ring[DLOG_RING_SIZE];
+static uint32_t dlog_head;
+static uint32_t dlog_tail;
+static uint32_t dlog_drops;
+static TaskHandle_t dlog_task;
+
+static const char *dlog_tag = "dlog";
+
+static const char level_letters[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+
+static inline IRAM_ATTR uint32_t lap(uint32_t pos) {
+    return pos & ~(uint32_t)(DLOG_RING_SIZE - 1);
+}
+
+void IRAM_ATTR dlog_write(const dlog_site_t *site, int nargs, ...) {
+    uint32_t pos = __atomic_load_n(&dlog_head, __ATOMIC_RELAXED);
+    dlog_rec_t *rec;
+
+    while (true) {
+        rec = &dlog_ring[pos & (DLOG_RING_SIZE - 1)];
+        int32_t diff =
+            (int32_t)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - lap(pos));
+        if (diff < 0) {
+            // The reader hasn't got to this slot yet
+            __atomic_fetch_add(&dlog_drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (diff == 0 &&
+            __atomic_compare_exchange_n(&dlog_head, &pos, pos + 1, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+        if (diff > 0) {
+            // Another writer claimed pos first
+            pos = __atomic_load_n(&dlog_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    rec->time = esp_log_timestamp();
+    rec->site = site;
+
+    va_list args;
+    va_start(args, nargs);
+    for (int i = 0; i < nargs; i++) {
+        rec->args[i] = va_arg(args, uint32_t);
+    }
+    va_end(args);
+
+    __atomic_store_n(&rec->seq, lap(pos) + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t dlog_dropped(void) {
+    return __atomic_load_n(&dlog_drops, __ATOMIC_RELAXED);
+}
+
+static bool render_one(void) {
+    dlog_rec_t *rec = &dlog_ring[dlog_tail & (DLOG_RING_SIZE - 1)];
+    if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != lap(dlog_tail) + 1) {
+        return false;
+    }
+
+    const dlog_site_t *site = rec->site;
+    char line[DLOG_LINE_SIZE];
+    // Unused trailing arguments are ignored by snprintf
+    snprintf(line, sizeof(line), site->format, rec->args[0], rec->args[1],
+             rec->args[2], rec->args[3]);
+    uint32_t time = rec->time;
+
+    __atomic_store_n(&rec->seq, lap(dlog_tail) + DLOG_RING_SIZE,
+                     __ATOMIC_RELEASE);
+    dlog_tail++;
+
+    esp_log_write(site->level, site->tag, "%c (%u) %s: %s\n",
+                  level_letters[site->level], (unsigned)time, site->tag,
+                  line);
+    return true;
+}
+
+static void dlog_worker(void *param) {
+    uint32_t reported = 0;
+
+    while (true) {
+        while (render_one()) {
+        }
+
+        uint32_t drops = dlog_dropped();
+        if (drops != reported) {
+            ESP_LOGW(dlog_tag, "%u messages dropped",
+                     (unsigned)(drops - reported));
+            reported = drops;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(DLOG_DRAIN_MS));
+    }
+}
+
+void dlog_init(void) {
+    if (dlog_task != NULL) {
+        return;
+    }
+
+    BaseType_t ret = xTaskCreate(&dlog_worker, dlog_tag, 2048, NULL,
+                                 tskIDLE_PRIORITY + 1, &dlog_task);
+    if (ret != pdTRUE) {
+        ESP_LOGE(dlog_tag, "Failed to create the dlog task");
+        vTaskDelay(portMAX_DELAY);
+    }
+    diag_register_task(dlog_task, dlog_tag, 2048);
+}
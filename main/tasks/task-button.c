@@ -1,15 +1,19 @@
+#include <stdlib.h>
 #include <limits.h>
 #include <string.h>
 #include <inttypes.h>
-#include <math.h>
 
 #include "esp_system.h"
 #include "esp_timer.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 
 #include "task-button.h"
+#include "diagnostics.h"
+#include "dlog.h"
+#include "tracer.h"
 
 static const char *tag = "button_task";
 
@@ -19,8 +23,10 @@ typedef struct isr_event {
     uint8_t level;
 } isr_event_t;
 
-void log_evt(const char *ltag, isr_event_t *evt) {
-    ESP_LOGI(ltag, "(%"PRId64") (%i)->%u", evt->edge_time, evt->button, evt->level);
+// Cheap enough to leave in process_event while chasing a gesture problem
+void log_evt(isr_event_t *evt) {
+    DLOGD(button, "(%u) (%d)->%u", (uint32_t)evt->edge_time, evt->button,
+          evt->level);
 }
 
 typedef struct callback_item {
@@ -28,31 +34,145 @@ typedef struct callback_item {
     button_callback_t callback;
     bool pressed;
     uint64_t callbacks;
+    int index; // Attach order
 } callback_item_t;
 
+typedef struct callback_list {
+    callback_item_t **items;
+    int count;
+} callback_list_t;
+
+// Single producer/single consumer ring of edges.  All button ISRs are
+// dispatched by the gpio isr service on the core that installed it, so
+// only one of them runs at a time; button_worker is the only consumer.
+typedef struct event_ring {
+    isr_event_t events[BUTTON_RING_SIZE];
+    volatile uint32_t head; // Only written by the ISR
+    volatile uint32_t tail; // Only written by button_worker
+    volatile uint32_t events_total;
+    volatile uint32_t overflows;
+    volatile uint32_t high_water;
+} event_ring_t;
+
+struct buttons;
+
 typedef struct isr_data {
-    QueueHandle_t button_queue;
+    struct buttons *buttons;
     button_spec_t button_spec;
     uint8_t button;
+
+    // Debounce state, shared between the ISR and button_worker under mux
+    uint8_t level;       // Last level passed on to the worker
+    int64_t last_edge;   // When that level was passed on
+    int64_t last_raw;    // Last edge seen at all
+    bool unsettled;      // Edges were rejected since last_edge
+    volatile uint32_t rejected;
 } isr_data_t;
 
 typedef struct buttons {
-    QueueHandle_t button_queue;
+    event_ring_t ring;
     TaskHandle_t button_task;
+    button_trace_writer_t *trace;
+    button_activity_func_t activity_cb;
+    void *activity_param;
+    volatile int64_t next_wakeup;
     isr_data_t **button_data;
+    // Held by button_worker while it dispatches and by attach_callback()
+    // while it grows the lists below, which can move them
+    SemaphoreHandle_t callback_lock;
     callback_item_t *callback_head;
+    int callback_cnt;
+    callback_list_t *by_button; // Callbacks each button's edges can affect
+    callback_list_t held;       // Callbacks whose buttons are all down
+    callback_item_t **held_next;
     int max_buttons;
     int buttons_registered;
 } buttons_t;
 
+static inline bool IRAM_ATTR ring_push(event_ring_t *ring,
+                                       const isr_event_t *evt) {
+    uint32_t head = ring->head;
+    uint32_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (used >= BUTTON_RING_SIZE) {
+        ring->overflows++;
+        return false;
+    }
+
+    ring->events[head & (BUTTON_RING_SIZE - 1)] = *evt;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    ring->events_total++;
+    if (used + 1 > ring->high_water) {
+        ring->high_water = used + 1;
+    }
+    return true;
+}
+
+static inline bool ring_pop(event_ring_t *ring, isr_event_t *evt) {
+    uint32_t tail = ring->tail;
+
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+        return false;
+    }
+
+    *evt = ring->events[tail & (BUTTON_RING_SIZE - 1)];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static portMUX_TYPE button_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t IRAM_ATTR sample_level(const button_spec_t *spec) {
+    if (spec->samples <= 1) {
+        return gpio_get_level(spec->gpio_num);
+    }
+
+    int high = 0;
+    for (int i = 0; i < spec->samples; i++) {
+        high += gpio_get_level(spec->gpio_num);
+    }
+    return (high * 2 > spec->samples);
+}
+
 void IRAM_ATTR button_isr(void *param) {
     isr_data_t *data = (isr_data_t *)param;
+    struct buttons *bdata = data->buttons;
     BaseType_t should_wake = pdFALSE;
     isr_event_t evt = {.button = data->button,
-                       .level = gpio_get_level(data->button_spec.gpio_num),
+                       .level = sample_level(&data->button_spec),
                        .edge_time = esp_timer_get_time()};
+    bool queued = false;
 
-    xQueueSendFromISR(data->button_queue, &evt, &should_wake);
+    TRACE_INSTANT_ISR(TRACE_BUTTON_ISR, evt.button << 1 | evt.level);
+
+    portENTER_CRITICAL_ISR(&button_mux);
+    if (bdata->trace != NULL) {
+        button_trace_rec_t rec = {.edge_time = evt.edge_time,
+                                  .button = evt.button,
+                                  .level = evt.level};
+        button_trace_put(bdata->trace, &rec);
+    }
+
+    data->last_raw = evt.edge_time;
+    if (evt.level == data->level) {
+        // Glitch, the line was back where it was before we could read it
+        data->rejected++;
+    } else if (evt.edge_time - data->last_edge < data->button_spec.debounce_time) {
+        // Bounce, button_worker rechecks once the line has been quiet
+        data->rejected++;
+        data->unsettled = true;
+    } else {
+        data->level = evt.level;
+        data->last_edge = evt.edge_time;
+        data->unsettled = false;
+        queued = ring_push(&bdata->ring, &evt);
+    }
+    portEXIT_CRITICAL_ISR(&button_mux);
+
+    if ((queued || data->unsettled) && bdata->button_task != NULL) {
+        vTaskNotifyGiveFromISR(bdata->button_task, &should_wake);
+    }
 
     if (should_wake == pdTRUE) {
         portYIELD_FROM_ISR();
@@ -69,20 +189,25 @@ int setup_button_gpio(buttons_handle_t button_handle, button_spec_t *button) {
     buttons_t *bdata = (buttons_t *)button_handle;
     int button_index = bdata->buttons_registered;
 
+    if (button_index >= bdata->max_buttons) {
+        ESP_LOGE(tag, "No room for button on gpio %d", button->gpio_num);
+        return -1;
+    }
+
     gpio_set_intr_type(button->gpio_num, GPIO_INTR_ANYEDGE);
     gpio_set_direction(button->gpio_num, GPIO_MODE_INPUT);
     gpio_set_pull_mode(button->gpio_num, button->pull_mode);
 
-    isr_data_t *button_isr_data = calloc(1, sizeof(isr_data_t));
+    isr_data_t *button_isr_data =
+        diag_calloc(DIAG_TAG_BUTTON, 1, sizeof(isr_data_t));
     if (button_isr_data == NULL) {
         ESP_LOGE(tag, "ENOMEM allocating button%d data",
                  bdata->buttons_registered);
         vTaskDelay(portMAX_DELAY);
     }
 
-    ESP_LOGI(tag, "Working on bdata: %p", bdata);
-    
-    button_isr_data->button_queue = bdata->button_queue;
+    button_isr_data->buttons = bdata;
+    button_isr_data->level = sample_level(button);
     button_isr_data->button = bdata->buttons_registered;
     memcpy(&button_isr_data->button_spec, button, sizeof(button_spec_t));
 
@@ -90,113 +215,312 @@ int setup_button_gpio(buttons_handle_t button_handle, button_spec_t *button) {
     bdata->buttons_registered++;
 
     gpio_isr_handler_add(button->gpio_num, &button_isr, button_isr_data);
-    ESP_LOGI(tag, "Attached button %i", button_index);
+    DLOGI(button, "Attached button %d on gpio %d", button_index,
+          button->gpio_num);
     return button_index;
 }
 
 int64_t get_start_time(int64_t *times, uint64_t button_mask) {
-    uint64_t n = button_mask;
-    uint8_t start = log2(n & -n);
     int64_t start_time = INT64_MAX;
-    for (uint8_t i = start; n & ~((1UL << i) - 1); i++) {
-        if (n & (1UL << i)) {
-            if (times[i] < start_time) {
-                start_time = times[i];
-            }
+    for (uint64_t n = button_mask; n; n &= n - 1) {
+        int i = __builtin_ctzll(n);
+        if (times[i] < start_time) {
+            start_time = times[i];
         }
     }
     return start_time;
 }
 
+static void set_repeat(int64_t *repeat, int64_t wait) {
+    if (wait > 0 && (*repeat == 0 || wait < *repeat)) {
+        *repeat = wait;
+    }
+}
+
+static TickType_t us_to_ticks(int64_t us) {
+    if (us <= 0) {
+        return portMAX_DELAY;
+    }
+    int64_t tick_us = portTICK_PERIOD_MS * 1000;
+    return (us + tick_us - 1) / tick_us;
+}
+
+// Runs one callback against the current button state, returns whether its
+// buttons are held (and none of its ignored ones).
+static bool dispatch(callback_item_t *cb, uint64_t evt_mask, int64_t now,
+                     int64_t *start_times, int64_t *repeat) {
+    int64_t start = get_start_time(start_times, cb->callback.button_mask);
+    int64_t duration = now - start;
+
+    if (((cb->callback.button_mask & evt_mask) == cb->callback.button_mask) &&
+        ((cb->callback.ignore_mask & evt_mask) == 0)) {
+
+        if (!cb->pressed) {
+            if(duration > cb->callback.min_time) {
+                if (cb->callback.press_cb) {
+                    cb->callback.press_cb(start, PRESS, cb->callback.press_param);
+                }
+                cb->pressed = true;
+            } else {
+                set_repeat(repeat, cb->callback.min_time - duration + 1);
+            }
+        }
+
+        if(cb->callback.held_cb && cb->pressed) {
+            int64_t next_held = cb->callback.min_time +
+                                cb->callbacks * cb->callback.callback_interval;
+            if (cb->callback.callback_interval <= 0 && cb->callbacks > 0) {
+                // Single 'held' callback per press
+            } else if(duration > next_held) {
+                cb->callback.held_cb(now, HELD, cb->callback.held_param);
+                cb->callbacks++;
+                set_repeat(repeat, cb->callback.callback_interval);
+            } else {
+                set_repeat(repeat, next_held - duration + 1);
+            }
+        }
+        return true;
+    }
+
+    if (cb->pressed) {
+        if (cb->callback.release_cb) {
+            if (duration < cb->callback.max_time) {
+                cb->callback.release_cb(now, RELEASE, cb->callback.release_param);
+            }
+        }
+        cb->pressed = false;
+    }
+    cb->callbacks = 0;
+    return false;
+}
+
+typedef struct worker_state {
+    int64_t *start_times;
+    uint64_t active_mask;
+    int64_t repeat;
+} worker_state_t;
+
+// An edge_time of 0 means no edge, just re-check the held callbacks' timing
+static void process_event(buttons_t *bdata, worker_state_t *state,
+                          isr_event_t *evt) {
+    //log_evt(evt);
+    TRACE_BEGIN(TRACE_BUTTON_DISPATCH, evt->button);
+
+    uint64_t evt_mask = state->active_mask;
+    callback_list_t edge = {0};
+
+    if(evt->edge_time) {
+        button_spec_t *button_spec =
+            &(bdata->button_data[evt->button]->button_spec);
+        button_active_level_t active_level = button_spec->active_level;
+        bool button_active = (evt->level == active_level);
+        uint64_t button_mask = (1ULL << evt->button);
+        if(button_active) {
+            if(!(state->active_mask & button_mask)) {
+                state->start_times[evt->button] = evt->edge_time;
+            }
+            evt_mask = state->active_mask | button_mask;
+        } else {
+            evt_mask = state->active_mask & ~button_mask;
+        }
+        edge = bdata->by_button[evt->button];
+    } else {
+        evt->edge_time = esp_timer_get_time();
+    }
+
+    // Only callbacks that involve the button that changed, plus the ones
+    // already held (for their press/held timing), can do anything.  Walk
+    // both lists merged in attach order; what's still held afterwards is
+    // next round's held list.
+    callback_list_t *held = &bdata->held;
+    callback_item_t **next_held = bdata->held_next;
+    int held_cnt = 0;
+    int e = 0, h = 0;
+    state->repeat = 0;
+    while (e < edge.count || h < held->count) {
+        callback_item_t *cb;
+        if (h >= held->count ||
+            (e < edge.count && edge.items[e]->index < held->items[h]->index)) {
+            cb = edge.items[e++];
+        } else if (e >= edge.count ||
+                   held->items[h]->index < edge.items[e]->index) {
+            cb = held->items[h++];
+        } else {
+            cb = edge.items[e++];
+            h++;
+        }
+
+        if (dispatch(cb, evt_mask, evt->edge_time, state->start_times,
+                     &state->repeat)) {
+            next_held[held_cnt++] = cb;
+        }
+    }
+
+    bdata->held_next = held->items;
+    held->items = next_held;
+    held->count = held_cnt;
+
+    state->active_mask = evt_mask;
+    TRACE_END(TRACE_BUTTON_DISPATCH, held_cnt);
+}
+
+// Once a rejected bounce has been quiet for debounce_time, make sure the
+// worker agrees with where the line actually settled.  Returns how long
+// until the next button needs checking, 0 for none.
+static int64_t settle_buttons(buttons_t *bdata, worker_state_t *state) {
+    int64_t wait = 0;
+
+    for (int i = 0; i < bdata->buttons_registered; i++) {
+        isr_data_t *data = bdata->button_data[i];
+        if (!data->unsettled) {
+            continue;
+        }
+
+        int64_t now = esp_timer_get_time();
+        isr_event_t evt = {.button = i, .edge_time = 0};
+
+        portENTER_CRITICAL(&button_mux);
+        int64_t remaining = data->last_raw + data->button_spec.debounce_time - now;
+        if (remaining <= 0) {
+            data->unsettled = false;
+            evt.level = sample_level(&data->button_spec);
+            if (evt.level != data->level) {
+                data->level = evt.level;
+                data->last_edge = now;
+                evt.edge_time = now;
+            }
+        }
+        portEXIT_CRITICAL(&button_mux);
+
+        if (evt.edge_time) {
+            int64_t repeat = state->repeat;
+            process_event(bdata, state, &evt);
+            set_repeat(&state->repeat, repeat);
+        } else if (remaining > 0) {
+            set_repeat(&wait, remaining);
+        }
+    }
+    return wait;
+}
+
 static const char *button_tag = "button_worker";
 void button_worker(buttons_handle_t button_handle) {
     buttons_t *bdata = (buttons_t *)button_handle;
-    int64_t *start_times = calloc(bdata->max_buttons, sizeof(int64_t));
-    uint64_t active_mask = 0;
+    worker_state_t state = {0};
+    uint32_t overflows = 0;
+
+    state.start_times =
+        diag_calloc(DIAG_TAG_BUTTON, bdata->max_buttons, sizeof(int64_t));
+    if (state.start_times == NULL) {
+        ESP_LOGE(button_tag, "ENOMEM allocating start times");
+        vTaskDelay(portMAX_DELAY);
+    }
 
     while (true) {
-        isr_event_t evt = {0};
-        if (xQueueReceive(bdata->button_queue, &evt, portMAX_DELAY) == pdTRUE) {
-            //log_evt(">", &evt);
-            do {
-                uint64_t evt_mask = 0;
-                
-                if(evt.edge_time) {
-                    button_spec_t *button_spec =
-                        &(bdata->button_data[evt.button]->button_spec);
-                    button_active_level_t active_level = button_spec->active_level;
-                    bool button_active = (evt.level == active_level);
-                    uint64_t button_mask = (1<<evt.button);
-                    if(button_active) {
-                        if(!(active_mask & button_mask)) {
-                            start_times[evt.button] = evt.edge_time;
-                        }
-                        evt_mask = active_mask | button_mask;
-                    } else {
-                        evt_mask = active_mask & ~button_mask;
-                    }
-                } else {
-                    evt.edge_time = esp_timer_get_time();
-                    evt_mask = active_mask;
-                }
+        ulTaskNotifyTake(pdTRUE, us_to_ticks(state.repeat));
 
-                callback_item_t *cb = bdata->callback_head;
-                int64_t repeat = 0;
-                while(cb != NULL) {
-                    int64_t start = get_start_time(start_times, cb->callback.button_mask);
-                    int64_t duration = evt.edge_time - start;
-                    
-                    if (((cb->callback.button_mask & evt_mask) == cb->callback.button_mask) &&
-                        ((cb->callback.ignore_mask & evt_mask) == 0)) {
-                                                
-                        if (!cb->pressed) {
-                            if(duration > cb->callback.min_time) {
-                                if (cb->callback.press_cb) {
-                                    cb->callback.press_cb(start, PRESS, cb->callback.press_param);
-                                }
-                                cb->pressed = true;
-                            } else {
-                                repeat = cb->callback.min_time - duration;
-                            }
-                        }
-                        
-                        if(cb->callback.held_cb) {
-                            if(duration > cb->callback.min_time + cb->callbacks * cb->callback.callback_interval) {
-                                cb->callback.held_cb(evt.edge_time, HELD, cb->callback.held_param);
-                                cb->callbacks++;
-                                repeat = cb->callback.callback_interval;
-                            }
-                        }
-                    } else {
-                        if (cb->pressed) {
-                            if (cb->callback.release_cb) {
-                                if (duration < cb->callback.max_time) {
-                                    cb->callback.release_cb(evt.edge_time, RELEASE, cb->callback.release_param);
-                                }
-                            }
-                            cb->pressed = false;
-                        }
-                        cb->callbacks = 0;
-                    }
-                    cb = cb->next;
-                }
+        xSemaphoreTake(bdata->callback_lock, portMAX_DELAY);
 
-                active_mask = evt_mask;
-                if (xQueueReceive(bdata->button_queue, &evt, pdMS_TO_TICKS(repeat/1000)) == pdFALSE) {
-                    evt.edge_time = 0;                    
-                }
-            } while(active_mask);
+        // Drain everything the ISR queued since the last wakeup
+        isr_event_t evt;
+        bool drained = false;
+        while (ring_pop(&bdata->ring, &evt)) {
+            if (bdata->activity_cb != NULL) {
+                bdata->activity_cb(evt.edge_time, bdata->activity_param);
+            }
+            process_event(bdata, &state, &evt);
+            drained = true;
+        }
+
+        if (!drained) {
+            evt.edge_time = 0;
+            process_event(bdata, &state, &evt);
+        }
+
+        set_repeat(&state.repeat, settle_buttons(bdata, &state));
+        xSemaphoreGive(bdata->callback_lock);
+
+        bdata->next_wakeup =
+            state.repeat ? esp_timer_get_time() + state.repeat : 0;
+
+        if (bdata->ring.overflows != overflows) {
+            DLOGW(button, "Dropped %u button edges",
+                  (uint32_t)(bdata->ring.overflows - overflows));
+            overflows = bdata->ring.overflows;
         }
     }
 }
 
+void button_set_trace(buttons_handle_t button_handle,
+                      button_trace_writer_t *trace) {
+    buttons_t *bdata = (buttons_t *)button_handle;
+
+    portENTER_CRITICAL(&button_mux);
+    bdata->trace = trace;
+    portEXIT_CRITICAL(&button_mux);
+}
+
+void button_set_activity_cb(buttons_handle_t button_handle,
+                            button_activity_func_t cb, void *param) {
+    buttons_t *bdata = (buttons_t *)button_handle;
+
+    portENTER_CRITICAL(&button_mux);
+    bdata->activity_param = param;
+    bdata->activity_cb = cb;
+    portEXIT_CRITICAL(&button_mux);
+}
+
+int64_t button_next_wakeup(buttons_handle_t button_handle) {
+    buttons_t *bdata = (buttons_t *)button_handle;
+    return bdata->next_wakeup;
+}
+
+void button_wake(buttons_handle_t button_handle) {
+    buttons_t *bdata = (buttons_t *)button_handle;
+    xTaskNotifyGive(bdata->button_task);
+}
+
+void button_get_stats(buttons_handle_t button_handle, button_stats_t *stats) {
+    buttons_t *bdata = (buttons_t *)button_handle;
+
+    stats->events = bdata->ring.events_total;
+    stats->overflows = bdata->ring.overflows;
+    stats->high_water = bdata->ring.high_water;
+    stats->rejected = 0;
+    for (int i = 0; i < bdata->buttons_registered; i++) {
+        stats->rejected += bdata->button_data[i]->rejected;
+    }
+}
+
+static void list_append(callback_list_t *list, callback_item_t *cb) {
+    callback_item_t **items =
+        diag_realloc(DIAG_TAG_BUTTON,
+                     list->items, (list->count + 1) * sizeof(callback_item_t *));
+    if (items == NULL) {
+        ESP_LOGE(tag, "ENOMEM growing callback list");
+        vTaskDelay(portMAX_DELAY);
+    }
+    items[list->count++] = cb;
+    list->items = items;
+}
+
 callback_handle_t attach_callback(buttons_handle_t button_handle,
                                   button_callback_t *cb) {
     buttons_t *bdata = (buttons_t *)button_handle;
 
-    callback_item_t *new_cb = calloc(1, sizeof(callback_item_t));
+    callback_item_t *new_cb =
+        diag_calloc(DIAG_TAG_BUTTON, 1, sizeof(callback_item_t));
+    if (new_cb == NULL) {
+        ESP_LOGE(tag, "ENOMEM allocating callback");
+        vTaskDelay(portMAX_DELAY);
+    }
     memcpy(&new_cb->callback, cb, sizeof(button_callback_t));
-    
+
+    // button_worker is already running, and the lists are about to move.
+    // Not from inside a button callback, those run with the lock held.
+    xSemaphoreTake(bdata->callback_lock, portMAX_DELAY);
+    new_cb->index = bdata->callback_cnt++;
+
     callback_item_t *insert_at = bdata->callback_head;
     if(insert_at == NULL) {
         bdata->callback_head = new_cb;
@@ -206,26 +530,65 @@ callback_handle_t attach_callback(buttons_handle_t button_handle,
         }
         insert_at->next = new_cb;
     }
+
+    // Index the callback under every button whose edges can change whether
+    // it matches.
+    uint64_t involved = cb->button_mask | cb->ignore_mask;
+    for (uint64_t n = involved; n; n &= n - 1) {
+        int button = __builtin_ctzll(n);
+        if (button < bdata->max_buttons) {
+            list_append(&bdata->by_button[button], new_cb);
+        }
+    }
+
+    // Room for every callback to be held at once
+    callback_item_t **held =
+        diag_realloc(DIAG_TAG_BUTTON,
+                     bdata->held.items, bdata->callback_cnt * sizeof(callback_item_t *));
+    callback_item_t **held_next =
+        diag_realloc(DIAG_TAG_BUTTON,
+                     bdata->held_next, bdata->callback_cnt * sizeof(callback_item_t *));
+    if (held == NULL || held_next == NULL) {
+        ESP_LOGE(tag, "ENOMEM growing held callback list");
+        vTaskDelay(portMAX_DELAY);
+    }
+    bdata->held.items = held;
+    bdata->held_next = held_next;
+    xSemaphoreGive(bdata->callback_lock);
+
     return new_cb;
 }
 
 buttons_handle_t init_buttons(int max_buttons) {
-    buttons_t *button_data = calloc(1, sizeof(buttons_t));
+    buttons_t *button_data = diag_calloc(DIAG_TAG_BUTTON, 1, sizeof(buttons_t));
     if (button_data == NULL) {
         ESP_LOGE(tag, "Failed to create button_handle");
         vTaskDelay(portMAX_DELAY);
     }
 
+    if (max_buttons > MAX_BUTTONS) {
+        ESP_LOGE(tag, "Only %d buttons fit in a button mask", MAX_BUTTONS);
+        max_buttons = MAX_BUTTONS;
+    }
+
     button_data->max_buttons = max_buttons;
-    button_data->button_data = calloc(max_buttons, sizeof(isr_data_t *));
+    button_data->button_data =
+        diag_calloc(DIAG_TAG_BUTTON, max_buttons, sizeof(isr_data_t *));
     if(button_data->button_data == NULL) {
         ESP_LOGE(tag, "Failed to create button_data storage");
         vTaskDelay(portMAX_DELAY);
     }
 
-    button_data->button_queue = xQueueCreate(10, sizeof(isr_event_t));
-    if (button_data->button_queue == NULL) {
-        ESP_LOGE(tag, "Failed to create button_queue");
+    button_data->by_button =
+        diag_calloc(DIAG_TAG_BUTTON, max_buttons, sizeof(callback_list_t));
+    if(button_data->by_button == NULL) {
+        ESP_LOGE(tag, "Failed to create callback index");
+        vTaskDelay(portMAX_DELAY);
+    }
+
+    button_data->callback_lock = xSemaphoreCreateMutex();
+    if (button_data->callback_lock == NULL) {
+        ESP_LOGE(tag, "Failed to create the callback lock");
         vTaskDelay(portMAX_DELAY);
     }
 
@@ -235,6 +598,7 @@ buttons_handle_t init_buttons(int max_buttons) {
         ESP_LOGE(tag, "Failed to create the button_task");
         vTaskDelay(portMAX_DELAY);
     }
+    diag_register_task(button_data->button_task, button_tag, 2048);
 
     ESP_LOGI(tag, "Allocated button_data: %p", button_data);
     return button_data;
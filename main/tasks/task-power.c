@@ -0,0 +1,307 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "sdkconfig.h"
+
+#include "demo-screen-common.h"
+#include "task-power.h"
+#include "diagnostics.h"
+
+// Light sleep is taken in slices this long, with a short awake window
+// between them for esp_timer callbacks and the tasks that were due
+#define POWER_SLEEP_SLICE_US (5 * 1000000LL)
+#define POWER_AWAKE_WINDOW_MS 200
+#define POWER_FADE_MS 500
+#define POWER_STACK 2048
+
+typedef struct power_data {
+    power_config_t config;
+    TaskHandle_t power_task;
+    esp_pm_lock_handle_t freq_lock; // Held while active
+    bool freq_locked;
+
+    // Shared with power_activity() under power_mux
+    int64_t last_activity;
+    power_state_t state;
+    int64_t entered_at;
+    power_stats_t stats;
+} power_data_t;
+
+static const char *power_tag = "power_governor";
+static const char *state_names[POWER_STATE_MAX] = {"active", "dim", "off",
+                                                   "sleep"};
+
+static portMUX_TYPE power_mux = portMUX_INITIALIZER_UNLOCKED;
+// There's only the one chip to govern
+static power_data_t *power_instance;
+
+const char *power_state_name(power_state_t state) {
+    return state < POWER_STATE_MAX ? state_names[state] : "?";
+}
+
+static TickType_t us_to_ticks(int64_t us) {
+    if (us == INT64_MAX) {
+        return portMAX_DELAY;
+    }
+    int64_t tick_us = portTICK_PERIOD_MS * 1000;
+    return (us + tick_us - 1) / tick_us;
+}
+
+// The deepest state idle time calls for, and how long until the next step
+static power_state_t wanted_state(const power_config_t *config, int64_t idle,
+                                  int64_t *next) {
+    const int64_t after[POWER_STATE_MAX] = {
+        [POWER_DIM] = config->dim_after,
+        [POWER_OFF] = config->off_after,
+        [POWER_SLEEP] = config->sleep_after,
+    };
+    power_state_t state = POWER_ACTIVE;
+
+    *next = INT64_MAX;
+    for (power_state_t s = POWER_DIM; s < POWER_STATE_MAX; s++) {
+        if (after[s] == 0) {
+            continue;
+        }
+        if (idle >= after[s]) {
+            state = s;
+        } else if (after[s] - idle < *next) {
+            *next = after[s] - idle;
+        }
+    }
+    return state;
+}
+
+static void enter_state(power_data_t *pdata, power_state_t state) {
+    int64_t now = esp_timer_get_time();
+    power_state_t from = pdata->state;
+
+    portENTER_CRITICAL(&power_mux);
+    pdata->stats.residency_us[from] += now - pdata->entered_at;
+    pdata->entered_at = now;
+    pdata->state = state;
+    portEXIT_CRITICAL(&power_mux);
+
+    // Only active needs the full clock, the rest can run at min_freq_mhz
+    if (state == POWER_ACTIVE && !pdata->freq_locked) {
+        esp_pm_lock_acquire(pdata->freq_lock);
+        pdata->freq_locked = true;
+    } else if (state != POWER_ACTIVE && pdata->freq_locked) {
+        esp_pm_lock_release(pdata->freq_lock);
+        pdata->freq_locked = false;
+    }
+
+    switch (state) {
+        case POWER_ACTIVE:
+            // Coming back should be instant, going down can take its time
+            display_set_backlight(100, 0);
+            break;
+        case POWER_DIM:
+            display_set_backlight(pdata->config.dim_percent, POWER_FADE_MS);
+            break;
+        case POWER_OFF:
+        case POWER_SLEEP:
+        case POWER_STATE_MAX:
+            display_set_backlight(0, POWER_FADE_MS);
+            break;
+    }
+
+    ESP_LOGI(power_tag, "%s -> %s", power_state_name(from),
+             power_state_name(state));
+}
+
+static bool wake_pin_active(const power_config_t *config) {
+    for (uint8_t i = 0; i < config->wake_pin_cnt; i++) {
+        const power_wake_pin_t *pin = &config->wake_pins[i];
+        if (gpio_get_level(pin->gpio_num) == pin->active_level) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// One slice of light sleep.  gpio_wakeup_enable() turns the pin's interrupt
+// into a level one, which would fire the button ISR nonstop while the button
+// is held, so the button interrupts are off for the duration and put back
+// the way setup_button_gpio() left them.  The press that wakes the board
+// isn't seen by the buttons.
+static void light_sleep(power_data_t *pdata) {
+    const power_config_t *config = &pdata->config;
+
+    // An active pin would wake the chip straight back up
+    if (wake_pin_active(config)) {
+        power_activity();
+        return;
+    }
+
+    for (uint8_t i = 0; i < config->wake_pin_cnt; i++) {
+        const power_wake_pin_t *pin = &config->wake_pins[i];
+        gpio_intr_disable(pin->gpio_num);
+        gpio_wakeup_enable(pin->gpio_num, pin->active_level
+                                              ? GPIO_INTR_HIGH_LEVEL
+                                              : GPIO_INTR_LOW_LEVEL);
+    }
+    esp_sleep_enable_gpio_wakeup();
+    esp_sleep_enable_timer_wakeup(POWER_SLEEP_SLICE_US);
+
+    int64_t start = esp_timer_get_time();
+    esp_light_sleep_start();
+    int64_t slept = esp_timer_get_time() - start;
+    bool gpio_wake = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO;
+
+    for (uint8_t i = 0; i < config->wake_pin_cnt; i++) {
+        const power_wake_pin_t *pin = &config->wake_pins[i];
+        gpio_wakeup_disable(pin->gpio_num);
+        gpio_set_intr_type(pin->gpio_num, GPIO_INTR_ANYEDGE);
+        gpio_intr_enable(pin->gpio_num);
+    }
+
+    portENTER_CRITICAL(&power_mux);
+    pdata->stats.slept_us += slept;
+    pdata->stats.sleeps++;
+    if (gpio_wake) {
+        pdata->stats.gpio_wakeups++;
+    }
+    portEXIT_CRITICAL(&power_mux);
+
+    if (gpio_wake) {
+        power_activity();
+    } else {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(POWER_AWAKE_WINDOW_MS));
+    }
+}
+
+static void power_worker(void *param) {
+    power_data_t *pdata = param;
+
+    while (true) {
+        portENTER_CRITICAL(&power_mux);
+        int64_t idle = esp_timer_get_time() - pdata->last_activity;
+        portEXIT_CRITICAL(&power_mux);
+
+        int64_t next;
+        power_state_t state = wanted_state(&pdata->config, idle, &next);
+        if (state != pdata->state) {
+            enter_state(pdata, state);
+        }
+
+        if (state == POWER_SLEEP) {
+            light_sleep(pdata);
+        } else {
+            ulTaskNotifyTake(pdTRUE, us_to_ticks(next));
+        }
+    }
+}
+
+void power_activity(void) {
+    power_data_t *pdata = power_instance;
+    if (pdata == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&power_mux);
+    pdata->last_activity = esp_timer_get_time();
+    bool wake = pdata->state != POWER_ACTIVE;
+    portEXIT_CRITICAL(&power_mux);
+
+    // Already active, the worker notices the new time at its next deadline
+    if (wake) {
+        xTaskNotifyGive(pdata->power_task);
+    }
+}
+
+void power_init(const power_config_t *config) {
+    if (power_instance != NULL) {
+        return;
+    }
+
+    power_data_t *pdata = diag_calloc(DIAG_TAG_POWER, 1, sizeof(power_data_t));
+    if (pdata == NULL) {
+        ESP_LOGE(power_tag, "ENOMEM allocating power data");
+        vTaskDelay(portMAX_DELAY);
+    }
+    memcpy(&pdata->config, config, sizeof(power_config_t));
+    if (pdata->config.wake_pin_cnt > POWER_MAX_WAKE_PINS) {
+        pdata->config.wake_pin_cnt = POWER_MAX_WAKE_PINS;
+    }
+
+    // Light sleep is entered by hand in light_sleep(), not by the idle task,
+    // so tickless idle can stay off
+    esp_pm_config_esp32_t pm = {
+        .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = pdata->config.min_freq_mhz,
+        .light_sleep_enable = false};
+    esp_err_t err = esp_pm_configure(&pm);
+    if (err != ESP_OK) {
+        ESP_LOGW(power_tag, "Frequency scaling unavailable (%d)", err);
+    }
+
+    err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "power_active",
+                             &pdata->freq_lock);
+    if (err != ESP_OK) {
+        ESP_LOGE(power_tag, "Failed to create the frequency lock");
+        vTaskDelay(portMAX_DELAY);
+    }
+    esp_pm_lock_acquire(pdata->freq_lock);
+    pdata->freq_locked = true;
+
+    int64_t now = esp_timer_get_time();
+    pdata->state = POWER_ACTIVE;
+    pdata->last_activity = now;
+    pdata->entered_at = now;
+    pdata->stats.since_us = now;
+    power_instance = pdata;
+
+    BaseType_t ret = xTaskCreate(power_worker, power_tag, POWER_STACK, pdata,
+                                 1, &pdata->power_task);
+    if (ret != pdTRUE) {
+        ESP_LOGE(power_tag, "Failed to create the power_task");
+        vTaskDelay(portMAX_DELAY);
+    }
+    diag_register_task(pdata->power_task, power_tag, POWER_STACK);
+}
+
+void power_get_stats(power_stats_t *stats) {
+    power_data_t *pdata = power_instance;
+    if (pdata == NULL) {
+        memset(stats, 0, sizeof(power_stats_t));
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&power_mux);
+    *stats = pdata->stats;
+    stats->state = pdata->state;
+    stats->at_us = now;
+    stats->residency_us[pdata->state] += now - pdata->entered_at;
+    portEXIT_CRITICAL(&power_mux);
+}
+
+void power_dump(void) {
+    power_stats_t stats;
+    power_get_stats(&stats);
+
+    int64_t elapsed = stats.at_us - stats.since_us;
+    int64_t total = 0;
+    for (power_state_t s = POWER_ACTIVE; s < POWER_STATE_MAX; s++) {
+        total += stats.residency_us[s];
+        ESP_LOGI(power_tag, "%s: %" PRId64 "us, %u%%", power_state_name(s),
+                 stats.residency_us[s],
+                 elapsed > 0
+                     ? (unsigned)(stats.residency_us[s] * 100 / elapsed)
+                     : 0);
+    }
+    ESP_LOGI(power_tag,
+             "now %s, %" PRId64 "us accounted of %" PRId64 "us elapsed",
+             power_state_name(stats.state), total, elapsed);
+    ESP_LOGI(power_tag,
+             "light sleep: %" PRId64 "us in %" PRIu32 " slices, %" PRIu32
+             " woken by gpio",
+             stats.slept_us, stats.sleeps, stats.gpio_wakeups);
+}
@@ -1,13 +1,32 @@
+#include <stdlib.h>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "task-voltage.h"
+#include "diagnostics.h"
+#include "tracer.h"
 
 #define BAT_ADC ADC1_CHANNEL_6
 #define BAT_ADC_EN GPIO_NUM_14
 #define ADC_READ_INTERVAL_MS 1000
+// Keeps the battery history going while the voltage screen isn't shown
+#define ADC_IDLE_INTERVAL_MS 10000
+// Samples taken per enable window, filtered down to one reading
+#define ADC_BURST_SAMPLES 16
+#define ADC_LUT_SIZE 4096
+// IIR weight of each new reading is 1/2^ADC_IIR_SHIFT
+#define ADC_IIR_SHIFT 2
+#define ADC_IIR_FRAC 4
+// A jump this big (mV) is a plug/unplug, not noise, so start over
+#define ADC_IIR_RESET_MV 200
+// battery_history_add() writes the history to NVS every 15 minutes from
+// this task, which needs a lot more stack than the readings.  Check the
+// "stack voltage_worker" line of diag_dump() after a save.
+#define VOLTAGE_STACK 3584
 
 typedef enum adc_worker_message {
     ADC_STOP = 0,
@@ -19,11 +38,15 @@ typedef struct adc_data {
     QueueHandle_t voltage_event_queue;
     QueueHandle_t readings_queue;
     esp_adc_cal_characteristics_t caldata;
+    uint16_t *lut; // raw -> battery mV
+    int32_t filtered; // mV << ADC_IIR_FRAC, 0 until the first reading
+    battery_history_handle_t history;
+    void (*notify)(void);
 } adc_data_t;
 
 void disable_adc() {
+    // Nothing reads the divider once it's off, no need to wait for it
     gpio_set_level(BAT_ADC_EN, 0);
-    vTaskDelay(pdMS_TO_TICKS(10));
 }
 
 void enable_adc() {
@@ -32,8 +55,17 @@ void enable_adc() {
 }
 
 static const char *voltage_tag = "voltage_worker";
+// There's only the one battery
+static adc_data_t *voltage_instance;
+
 QueueHandle_t voltage_worker_init(adc_handle_t *data) {
-    adc_data_t *adc_data = calloc(1, sizeof(adc_data_t));
+    // Every screen that wants the battery shares the one worker
+    if (voltage_instance != NULL) {
+        *data = voltage_instance;
+        return voltage_instance->readings_queue;
+    }
+
+    adc_data_t *adc_data = diag_calloc(DIAG_TAG_VOLTAGE, 1, sizeof(adc_data_t));
     if(adc_data == NULL) {
         ESP_LOGE(voltage_tag, "ENOMEM Allocating ADC Data");
         vTaskDelay(portMAX_DELAY);
@@ -74,57 +106,128 @@ QueueHandle_t voltage_worker_init(adc_handle_t *data) {
         ESP_LOGI(voltage_tag, "Using Default ADC Calibration");
     }
 
-    BaseType_t ret = xTaskCreate(&voltage_task_worker, voltage_tag, 2048, adc_data, 2,
+    // esp_adc_cal_raw_to_voltage does a fair bit of math per call, so do it
+    // once per possible raw value up front.
+    adc_data->lut =
+        diag_malloc(DIAG_TAG_VOLTAGE, ADC_LUT_SIZE * sizeof(uint16_t));
+    if (adc_data->lut == NULL) {
+        ESP_LOGE(voltage_tag, "ENOMEM Allocating ADC LUT");
+        vTaskDelay(portMAX_DELAY);
+    }
+    for (int raw = 0; raw < ADC_LUT_SIZE; raw++) {
+        // Battery is behind a /2 divider
+        adc_data->lut[raw] =
+            esp_adc_cal_raw_to_voltage(raw, &adc_data->caldata) * 2;
+    }
+
+    adc_data->history = battery_history_init();
+    voltage_instance = adc_data;
+
+    BaseType_t ret = xTaskCreate(&voltage_task_worker, voltage_tag,
+                                 VOLTAGE_STACK, adc_data, 2,
                                  &adc_data->voltage_task);
     if (ret != pdTRUE) {
         ESP_LOGE(voltage_tag, "Failed to create the voltage_task");
         vTaskDelay(portMAX_DELAY);
     }
+    diag_register_task(adc_data->voltage_task, voltage_tag, VOLTAGE_STACK);
     ESP_LOGI(voltage_tag, "Done creating voltage task");
 
     *data = adc_data;
     return adc_data->readings_queue;
 }
 
+static void sort_samples(int *samples, int count) {
+    for (int i = 1; i < count; i++) {
+        int val = samples[i];
+        int j = i;
+        for (; j > 0 && samples[j - 1] > val; j--) {
+            samples[j] = samples[j - 1];
+        }
+        samples[j] = val;
+    }
+}
+
+// Takes a burst of samples in one enable window; the median throws out
+// spikes, the IIR smooths what's left across bursts.  Noise is the burst's
+// median absolute deviation, in mV.
+static adc_reading_t read_battery(adc_data_t *adc_data) {
+    int samples[ADC_BURST_SAMPLES];
+    int deviations[ADC_BURST_SAMPLES];
+    adc_reading_t reading = {0};
+
+    TRACE_BEGIN(TRACE_ADC_SAMPLE, 0);
+    enable_adc();
+    for (int i = 0; i < ADC_BURST_SAMPLES; i++) {
+        int raw = adc1_get_raw(BAT_ADC);
+        samples[i] = raw < 0 ? 0 : raw >= ADC_LUT_SIZE ? ADC_LUT_SIZE - 1 : raw;
+    }
+    disable_adc();
+
+    sort_samples(samples, ADC_BURST_SAMPLES);
+    int median = samples[ADC_BURST_SAMPLES / 2];
+    for (int i = 0; i < ADC_BURST_SAMPLES; i++) {
+        deviations[i] = abs(samples[i] - median);
+    }
+    sort_samples(deviations, ADC_BURST_SAMPLES);
+    int mad = deviations[ADC_BURST_SAMPLES / 2];
+
+    int32_t mv = adc_data->lut[median];
+    int32_t noise_mv = adc_data->lut[median + mad < ADC_LUT_SIZE ?
+                                     median + mad : ADC_LUT_SIZE - 1] - mv;
+
+    int32_t filtered_mv = adc_data->filtered >> ADC_IIR_FRAC;
+    if (adc_data->filtered == 0 || abs(mv - filtered_mv) > ADC_IIR_RESET_MV) {
+        adc_data->filtered = mv << ADC_IIR_FRAC;
+    } else {
+        adc_data->filtered +=
+            ((mv << ADC_IIR_FRAC) - adc_data->filtered) >> ADC_IIR_SHIFT;
+    }
+
+    reading.reading = (float)adc_data->filtered / (1000 << ADC_IIR_FRAC);
+    reading.noise = (float)noise_mv / 1000;
+    reading.samples = ADC_BURST_SAMPLES;
+    reading.charging = reading.reading > 4.5f;
+    TRACE_END(TRACE_ADC_SAMPLE, mv);
+    return reading;
+}
+
+static void record_reading(adc_data_t *adc_data, adc_reading_t *reading) {
+    battery_history_add(adc_data->history, esp_timer_get_time() / 1000000,
+                        reading->reading * 1000 + 0.5f);
+}
+
 void voltage_task_worker(void *param) {
     adc_data_t *adc_data = (adc_data_t *)param;
     adc_worker_message_t msg = ADC_STOP;
 
-    TickType_t wait_interval = portMAX_DELAY;
+    TickType_t wait_interval = pdMS_TO_TICKS(ADC_IDLE_INTERVAL_MS);
     while (1) {
         if (xQueueReceive(adc_data->voltage_event_queue, &msg,
                           wait_interval) == pdFALSE) {
             if (msg == ADC_STOP) {
-                ESP_LOGI(voltage_tag, "Timed out waiting for update");
+                // Nobody's watching, just keep the history going
+                adc_reading_t reading = read_battery(adc_data);
+                record_reading(adc_data, &reading);
                 continue;
             }
         }
 
         switch (msg) {
             case ADC_STOP:
-                wait_interval = portMAX_DELAY;
+                wait_interval = pdMS_TO_TICKS(ADC_IDLE_INTERVAL_MS);
                 break;
             case ADC_START:
                 wait_interval = pdMS_TO_TICKS(ADC_READ_INTERVAL_MS);
-                
-                int raw = 0;
-                uint32_t calibrated = 0;
-                adc_reading_t reading = {0};
-                
-                // Check to see if we have external power.
-                enable_adc();
-                raw = adc1_get_raw(BAT_ADC);
 
-                // Get calibrated value in mV
-                calibrated = esp_adc_cal_raw_to_voltage(raw, &adc_data->caldata);
-                calibrated *= 2;
-
-                reading.reading = (float)calibrated / 1000;
-                reading.charging = reading.reading > 4.5f;
+                // Check to see if we have external power.
+                adc_reading_t reading = read_battery(adc_data);
+                record_reading(adc_data, &reading);
 
                 xQueueOverwrite(adc_data->readings_queue, &reading);
-
-                disable_adc();
+                if (adc_data->notify != NULL) {
+                    adc_data->notify();
+                }
                 break;
         }
     }
@@ -140,4 +243,13 @@ void voltage_task_stop(adc_handle_t _data) {
     adc_data_t *data = _data;
     adc_worker_message_t stop = ADC_STOP;
     xQueueSend(data->voltage_event_queue, &stop, portMAX_DELAY);
+}
+
+void voltage_task_set_notify(adc_handle_t _data, void (*notify)(void)) {
+    adc_data_t *data = _data;
+    data->notify = notify;
+}
+
+battery_history_handle_t voltage_task_history(void) {
+    return voltage_instance != NULL ? voltage_instance->history : NULL;
 }
\ No newline at end of file
@@ -1,68 +1,283 @@
 #include "task-wifi.h"
 
+#include <inttypes.h>
 #include <string.h>
 
 #include "esp_err.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "nvs.h"
 #include "nvs_flash.h"
 
+#include "dlog.h"
+
+// Reconnect backoff doubles from the base up to the max, +/- jitter percent
+#define WIFI_BACKOFF_BASE_MS 500
+#define WIFI_BACKOFF_MAX_MS 60000
+#define WIFI_BACKOFF_JITTER 25
+
+#define WIFI_NVS_NAMESPACE "wifi"
+#define WIFI_NVS_CACHE_KEY "fast"
+
+// Where the AP was last found, so reconnects can skip the scan
+// Posted by the retry timer, so every attempt starts on the event loop
+// along with the handlers that read the reconnect state
+ESP_EVENT_DEFINE_BASE(WIFI_RETRY_EVENT);
+#define WIFI_RETRY_EVENT_ATTEMPT 0
+
+typedef struct wifi_ap_cache {
+    uint8_t ssid[32];
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_ap_cache_t;
+
+typedef struct wifi_reconnect {
+    wifi_config_t config;
+    wifi_ap_cache_t cache;
+    bool cache_valid;
+    bool warm;            // Current attempt is using the cache
+    bool connected;
+    int64_t attempt_start;
+    esp_timer_handle_t retry_timer;
+    wifi_metrics_t metrics; // Under metrics_mux
+} wifi_reconnect_t;
+
 typedef enum event_base {
     UNKNOWN_EVENT = 0,
     OUR_WIFI_EVENT = 1,
-    OUR_IP_EVENT = 2
+    OUR_IP_EVENT = 2,
+    OUR_RETRY_EVENT = 3
 } event_base_t;
 
 event_base_t to_base(esp_event_base_t event_base) {
     event_base_t ret = UNKNOWN_EVENT;
     if (event_base == WIFI_EVENT) ret = OUR_WIFI_EVENT;
     if (event_base == IP_EVENT) ret = OUR_IP_EVENT;
+    if (event_base == WIFI_RETRY_EVENT) ret = OUR_RETRY_EVENT;
     return ret;
 }
 
 static const char *tag = "wifi task";
 
+static void (*wifi_notify)(void);
+static uint16_t wifi_retries;
+static uint32_t wifi_dropped;
+static wifi_reconnect_t reconnect;
+static portMUX_TYPE metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void load_ap_cache(void) {
+    nvs_handle_t nvs;
+    size_t len = sizeof(wifi_ap_cache_t);
+
+    reconnect.cache_valid = false;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_blob(nvs, WIFI_NVS_CACHE_KEY, &reconnect.cache, &len) == ESP_OK &&
+        len == sizeof(wifi_ap_cache_t) &&
+        memcmp(reconnect.cache.ssid, reconnect.config.sta.ssid,
+               sizeof(reconnect.cache.ssid)) == 0) {
+        reconnect.cache_valid = true;
+    }
+    nvs_close(nvs);
+}
+
+static void save_ap_cache(const uint8_t *bssid, uint8_t channel) {
+    if (reconnect.cache_valid && reconnect.cache.channel == channel &&
+        memcmp(reconnect.cache.bssid, bssid, sizeof(reconnect.cache.bssid)) == 0) {
+        return;
+    }
+
+    memcpy(reconnect.cache.ssid, reconnect.config.sta.ssid,
+           sizeof(reconnect.cache.ssid));
+    memcpy(reconnect.cache.bssid, bssid, sizeof(reconnect.cache.bssid));
+    reconnect.cache.channel = channel;
+    reconnect.cache_valid = true;
+
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(nvs, WIFI_NVS_CACHE_KEY, &reconnect.cache,
+                     sizeof(wifi_ap_cache_t)) != ESP_OK ||
+        nvs_commit(nvs) != ESP_OK) {
+        ESP_LOGW(tag, "Failed to save the AP cache");
+    }
+    nvs_close(nvs);
+}
+
+// Otherwise the next boot would waste its first attempt on it again
+static void drop_ap_cache(void) {
+    reconnect.cache_valid = false;
+
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    esp_err_t err = nvs_erase_key(nvs, WIFI_NVS_CACHE_KEY);
+    if ((err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) ||
+        nvs_commit(nvs) != ESP_OK) {
+        ESP_LOGW(tag, "Failed to drop the AP cache");
+    }
+    nvs_close(nvs);
+}
+
+// Tries the cached AP first; if that attempt fails the next one scans.
+static void start_attempt(void) {
+    wifi_sta_config_t *sta = &reconnect.config.sta;
+    bool warm = reconnect.cache_valid;
+
+    if (warm != reconnect.warm || warm) {
+        sta->bssid_set = warm;
+        sta->channel = warm ? reconnect.cache.channel : 0;
+        if (warm) {
+            memcpy(sta->bssid, reconnect.cache.bssid, sizeof(sta->bssid));
+        }
+        esp_wifi_set_config(WIFI_IF_STA, &reconnect.config);
+    }
+
+    reconnect.warm = warm;
+    reconnect.attempt_start = esp_timer_get_time();
+    esp_wifi_connect();
+}
+
+// Runs on the esp_timer task, which mustn't touch the reconnect state
+static void retry_timer_cb(void *arg) {
+    (void)arg;
+    if (esp_event_post(WIFI_RETRY_EVENT, WIFI_RETRY_EVENT_ATTEMPT, NULL, 0,
+                       0) != ESP_OK) {
+        // The loop's queue is full, try again shortly
+        esp_timer_start_once(reconnect.retry_timer,
+                             WIFI_BACKOFF_BASE_MS * 1000ULL);
+    }
+}
+
+static uint32_t next_backoff_ms(void) {
+    uint32_t backoff = WIFI_BACKOFF_MAX_MS;
+    if (wifi_retries <= 16) {
+        backoff = WIFI_BACKOFF_BASE_MS << (wifi_retries - 1);
+        if (backoff > WIFI_BACKOFF_MAX_MS) {
+            backoff = WIFI_BACKOFF_MAX_MS;
+        }
+    }
+
+    // Spread retries out so a whole room of boards doesn't hit the AP at once
+    uint32_t jitter = backoff * WIFI_BACKOFF_JITTER / 100;
+    return backoff - jitter + esp_random() % (2 * jitter + 1);
+}
+
+static void record_time_to_ip(void) {
+    int64_t elapsed = esp_timer_get_time() - reconnect.attempt_start;
+    wifi_connect_metrics_t *m =
+        reconnect.warm ? &reconnect.metrics.warm : &reconnect.metrics.cold;
+
+    portENTER_CRITICAL(&metrics_mux);
+    m->last_us = elapsed;
+    m->total_us += elapsed;
+    if (m->count == 0 || elapsed < m->min_us) m->min_us = elapsed;
+    if (elapsed > m->max_us) m->max_us = elapsed;
+    m->count++;
+    portEXIT_CRITICAL(&metrics_mux);
+
+    if (reconnect.warm) {
+        DLOGI(wifi, "warm connect, %ums to IP", (uint32_t)(elapsed / 1000));
+    } else {
+        DLOGI(wifi, "cold connect, %ums to IP", (uint32_t)(elapsed / 1000));
+    }
+}
+
+// The event loop must never block on the screen, so if it's fallen behind
+// the oldest status goes; the newest one is the one that matters.
+static void send_status(QueueHandle_t msg_queue, wifi_status_t *status) {
+    status->time = esp_timer_get_time();
+    status->retries = wifi_retries;
+
+    if (xQueueSend(msg_queue, status, 0) == pdFALSE) {
+        wifi_status_t stale;
+        xQueueReceive(msg_queue, &stale, 0);
+        xQueueSend(msg_queue, status, 0);
+        wifi_dropped++;
+    }
+    if (wifi_notify != NULL) {
+        wifi_notify();
+    }
+}
+
+static void fill_ap_info(wifi_status_t *status) {
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        status->rssi = ap.rssi;
+        status->channel = ap.primary;
+    }
+}
+
 static void wifi_event_handler(void *arg, int32_t event_id, void *event_data) {
     QueueHandle_t msg_queue = arg;
-    char *msg;
+    wifi_status_t status = {0};
     switch (event_id) {
         case WIFI_EVENT_STA_START:
-            esp_wifi_connect();
-            msg = strdup("try AP connect");
-            ESP_LOGI(tag, "%s", msg);
-            if(xQueueSend(msg_queue, &msg, pdMS_TO_TICKS(100)) == pdFALSE) {
-                free(msg);
-            }
+            start_attempt();
+            status.state = WIFI_STATE_CONNECTING;
+            DLOGI(wifi, "try AP connect");
+            send_status(msg_queue, &status);
             break;
-               
-        case WIFI_EVENT_STA_DISCONNECTED:
-            esp_wifi_connect();
-            msg = strdup("retry AP connect");
-            ESP_LOGI(tag, "%s", msg);
-            if(xQueueSend(msg_queue, &msg, pdMS_TO_TICKS(100)) == pdFALSE) {
-                free(msg);
+
+        case WIFI_EVENT_STA_CONNECTED: {
+            wifi_event_sta_connected_t *event = event_data;
+            status.state = WIFI_STATE_CONNECTED;
+            fill_ap_info(&status);
+            status.channel = event->channel;
+            reconnect.connected = true;
+            save_ap_cache(event->bssid, event->channel);
+            DLOGI(wifi, "connected on channel %u", event->channel);
+            send_status(msg_queue, &status);
+        } break;
+
+        case WIFI_EVENT_STA_DISCONNECTED: {
+            wifi_event_sta_disconnected_t *event = event_data;
+            wifi_retries++;
+            portENTER_CRITICAL(&metrics_mux);
+            reconnect.metrics.failures++;
+            portEXIT_CRITICAL(&metrics_mux);
+            if (reconnect.warm && !reconnect.connected) {
+                // The AP moved or is gone, go back to scanning
+                drop_ap_cache();
             }
-            break;
+            reconnect.connected = false;
+
+            uint32_t backoff = next_backoff_ms();
+            esp_timer_stop(reconnect.retry_timer);
+            esp_timer_start_once(reconnect.retry_timer, backoff * 1000ULL);
+
+            status.state = WIFI_STATE_DISCONNECTED;
+            status.reason = event->reason;
+            status.backoff_ms = backoff;
+            DLOGI(wifi, "retry AP connect in %ums, reason %u", backoff,
+                  event->reason);
+            send_status(msg_queue, &status);
+        } break;
     }
 }
 
 static void ip_event_handler(void *arg, int32_t event_id, void *event_data) {
-    char *msg;
     QueueHandle_t msg_queue = arg;
+    wifi_status_t status = {0};
     switch(event_id) {
         case IP_EVENT_STA_GOT_IP: {
             ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-            msg = strdup("255.255.255.255");
-            sprintf(msg, IPSTR, IP2STR(&event->ip_info.ip));
-            ESP_LOGI(tag, "got ip: %s", msg);
-            if(xQueueSend(msg_queue, &msg, pdMS_TO_TICKS(100)) == pdFALSE) {
-                free(msg);
-            }
+            status.state = WIFI_STATE_GOT_IP;
+            status.ip = event->ip_info.ip.addr;
+            fill_ap_info(&status);
+            DLOGI(wifi, "got ip: " IPSTR, IP2STR(&event->ip_info.ip));
+            record_time_to_ip();
+            send_status(msg_queue, &status);
+            wifi_retries = 0;
         } break;
     }
 }
@@ -77,14 +292,22 @@ static void event_handler(void* arg, esp_event_base_t event_base,
         case OUR_IP_EVENT:
             ip_event_handler(arg, event_id, event_data);
             break;
+        case OUR_RETRY_EVENT:
+            start_attempt();
+            break;
         case UNKNOWN_EVENT:
             ESP_LOGE(tag, "Unknown base event %s", event_base);
             return;
     }
 }
 
-QueueHandle_t wifi_init(char *ssid, char *pass) {
-    QueueHandle_t msg_handle = xQueueCreate(10, sizeof(char*));
+// NVS, netif and the event loop can only be brought up once, the driver
+// itself comes and goes with wifi_init/wifi_deinit.
+static void platform_init(void) {
+    static bool platform_ready;
+    if (platform_ready) {
+        return;
+    }
 
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
@@ -98,6 +321,18 @@ QueueHandle_t wifi_init(char *ssid, char *pass) {
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     esp_netif_create_default_wifi_sta();
+    platform_ready = true;
+}
+
+QueueHandle_t wifi_init(char *ssid, char *pass) {
+    QueueHandle_t msg_handle = xQueueCreate(WIFI_STATUS_SLOTS, sizeof(wifi_status_t));
+    if (msg_handle == NULL) {
+        ESP_LOGE(tag, "Failed to create the wifi status queue");
+        vTaskDelay(portMAX_DELAY);
+    }
+
+    platform_init();
+    wifi_retries = 0;
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -106,6 +341,9 @@ QueueHandle_t wifi_init(char *ssid, char *pass) {
                                                &event_handler, msg_handle));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
                                                &event_handler, msg_handle));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_RETRY_EVENT,
+                                               WIFI_RETRY_EVENT_ATTEMPT,
+                                               &event_handler, msg_handle));
 
     wifi_config_t wifi_config = {
         .sta = {/* Setting a password implies station will connect to all
@@ -119,6 +357,13 @@ QueueHandle_t wifi_init(char *ssid, char *pass) {
 
     memcpy(wifi_config.sta.ssid, ssid, strlen(ssid));
     memcpy(wifi_config.sta.password, pass, strlen(pass));
+    reconnect.config = wifi_config;
+    load_ap_cache();
+
+    const esp_timer_create_args_t timer_args = {.callback = &retry_timer_cb,
+                                                .name = "wifi_retry"};
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &reconnect.retry_timer));
+
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
@@ -126,4 +371,60 @@ QueueHandle_t wifi_init(char *ssid, char *pass) {
     ESP_LOGI(tag, "wifi_init_sta finished.");
 
     return msg_handle;
+}
+
+void wifi_set_notify(void (*notify)(void)) { wifi_notify = notify; }
+
+uint32_t wifi_dropped_status(void) { return wifi_dropped; }
+
+void wifi_get_metrics(wifi_metrics_t *metrics) {
+    portENTER_CRITICAL(&metrics_mux);
+    *metrics = reconnect.metrics;
+    portEXIT_CRITICAL(&metrics_mux);
+}
+
+static void log_connect_metrics(const char *kind,
+                                const wifi_connect_metrics_t *m) {
+    if (m->count == 0) {
+        ESP_LOGI(tag, "%s connects: none", kind);
+        return;
+    }
+    ESP_LOGI(tag,
+             "%s connects: %" PRIu32 ", to IP last %" PRId64 "ms, avg %" PRId64
+             "ms, min %" PRId64 "ms, max %" PRId64 "ms",
+             kind, m->count, m->last_us / 1000,
+             m->total_us / m->count / 1000, m->min_us / 1000,
+             m->max_us / 1000);
+}
+
+void wifi_dump(void) {
+    wifi_metrics_t metrics;
+    wifi_get_metrics(&metrics);
+    log_connect_metrics("cold", &metrics.cold);
+    log_connect_metrics("warm", &metrics.warm);
+    ESP_LOGI(tag, "%" PRIu32 " failed attempts, %" PRIu32 " statuses dropped",
+             metrics.failures, wifi_dropped);
+}
+
+// Unregistering waits out a handler that's running, so after this nothing
+// on the event loop touches the reconnect state.  A retry still posted by
+// the timer finds no handler.
+void wifi_deinit(QueueHandle_t msg_queue) {
+    ESP_ERROR_CHECK(esp_event_handler_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID,
+                                                 &event_handler));
+    ESP_ERROR_CHECK(esp_event_handler_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP,
+                                                 &event_handler));
+    ESP_ERROR_CHECK(esp_event_handler_unregister(WIFI_RETRY_EVENT,
+                                                 WIFI_RETRY_EVENT_ATTEMPT,
+                                                 &event_handler));
+
+    esp_timer_stop(reconnect.retry_timer);
+    esp_wifi_stop();
+    esp_wifi_deinit();
+    esp_timer_delete(reconnect.retry_timer);
+    reconnect.retry_timer = NULL;
+    reconnect.connected = false;
+
+    vQueueDelete(msg_queue);
+    ESP_LOGI(tag, "wifi stopped");
 }
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "esp_attr.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "tracer.h"
+
+#if (TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) != 0
+#error "TRACE_RING_SIZE must be a power of two"
+#endif
+
+// Times are the low 32 bits of esp_timer, the converter unwraps them.  A
+// task of 0 is an ISR.
+typedef struct trace_rec {
+    uint32_t time;
+    uint32_t arg;
+    uintptr_t task;
+    uint8_t event;
+    uint8_t phase;
+    uint8_t core;
+    uint8_t pad;
+} trace_rec_t;
+
+static const char *event_names[TRACE_EVENT_MAX] = {
+    [TRACE_BUTTON_ISR] = "button_isr",
+    [TRACE_BUTTON_DISPATCH] = "button_dispatch",
+    [TRACE_SHOW_DISPLAY] = "show_display",
+    [TRACE_CONTENT_WORKER] = "display_content_worker",
+    [TRACE_SCREEN_LOAD] = "screen_load",
+    [TRACE_SCREEN_UNLOAD] = "screen_unload",
+    [TRACE_LV_TASK_HANDLER] = "lv_task_handler",
+    [TRACE_FLUSH] = "flush",
+    [TRACE_FLUSH_SEND] = "flush_send",
+    [TRACE_ADC_SAMPLE] = "adc_sample",
+    [TRACE_SNAPSHOT_TRANSITION] = "snapshot_transition",
+};
+
+static trace_rec_t trace_ring[TRACE_RING_SIZE];
+// Total records ever claimed, the slot is this mod TRACE_RING_SIZE
+static uint32_t trace_head;
+static bool trace_enabled;
+
+static inline IRAM_ATTR trace_rec_t *ring_rec(uint32_t n) {
+    return &trace_ring[n & (TRACE_RING_SIZE - 1)];
+}
+
+void tracer_start(void) {
+    __atomic_store_n(&trace_enabled, true, __ATOMIC_RELEASE);
+}
+
+void tracer_stop(void) {
+    __atomic_store_n(&trace_enabled, false, __ATOMIC_RELEASE);
+}
+
+void IRAM_ATTR tracer_record(trace_phase_t phase, trace_event_t event,
+                             uint32_t arg, bool from_isr) {
+    if (!__atomic_load_n(&trace_enabled, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    // Claiming the slot is the only shared write, so ISRs and both cores
+    // can record without a lock.
+    uint32_t slot = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    trace_rec_t *rec = ring_rec(slot);
+
+    rec->time = (uint32_t)esp_timer_get_time();
+    rec->arg = arg;
+    rec->task = from_isr ? 0 : (uintptr_t)xTaskGetCurrentTaskHandle();
+    rec->event = event;
+    rec->phase = phase;
+    rec->core = xPortGetCoreID();
+}
+
+#define TRACE_MAX_TASKS 16
+
+void tracer_dump(void) {
+    bool was_enabled = __atomic_exchange_n(&trace_enabled, false,
+                                           __ATOMIC_ACQ_REL);
+    // Let anything that got past the enabled check finish its record
+    vTaskDelay(1);
+
+    uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+    uint32_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+    uint32_t first = head - count;
+
+    printf("TRACE %" PRIu32 " records, %" PRIu32 " overwritten\n", count,
+           first);
+    for (int i = 0; i < TRACE_EVENT_MAX; i++) {
+        printf("TN %d %s\n", i, event_names[i]);
+    }
+
+    // Every traced task lives for the life of the app, so the handles are
+    // still good to name.
+    uintptr_t named[TRACE_MAX_TASKS];
+    int named_cnt = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uintptr_t task = ring_rec(first + i)->task;
+        bool seen = (task == 0);
+        for (int j = 0; j < named_cnt && !seen; j++) {
+            seen = (named[j] == task);
+        }
+        if (!seen && named_cnt < TRACE_MAX_TASKS) {
+            named[named_cnt++] = task;
+            printf("TK %" PRIxPTR " %s\n", task,
+                   pcTaskGetName((TaskHandle_t)task));
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const trace_rec_t *rec = ring_rec(first + i);
+        printf("TR %" PRIu32 " %c %u %" PRIxPTR " %u %" PRIu32 "\n",
+               rec->time, rec->phase, rec->core, rec->task, rec->event,
+               rec->arg);
+    }
+    printf("TRACE end\n");
+    fflush(stdout);
+
+    if (was_enabled) {
+        tracer_start();
+    }
+}
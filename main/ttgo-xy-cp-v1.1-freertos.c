@@ -17,9 +17,13 @@
 #include "sdkconfig.h"
 
 #include "demo-screen-common.h"
+#include "diagnostics.h"
+#include "dlog.h"
 
 #include "task-button.h"
+#include "task-power.h"
 #include "task-wifi.h"
+#include "tracer.h"
 
 // Just remove this block if you really want to build with psram support
 #ifdef CONFIG_ESP32_SPIRAM_SUPPORT
@@ -45,7 +49,7 @@ worker_data_t *alloc_data() {
 
     wdata->button_data = init_buttons(2);
 
-    wdata->disp_data = init_display(5);
+    wdata->disp_data = init_display();
 
     //voltage_worker_init(&wdata->adc_data);
 
@@ -60,7 +64,7 @@ int8_t screen = 0;
 void button1_evt(int64_t etime, event_t evt, button_callback_param_t parm) {
     screen--;
     if(screen < 0)
-        screen = MAX_DISPLAY_MODE;
+        screen = display_screen_count() - 1;
 
     display_handle_t handle = parm;
     show_display(handle, screen);
@@ -68,27 +72,116 @@ void button1_evt(int64_t etime, event_t evt, button_callback_param_t parm) {
 
 void button2_evt(int64_t etime, event_t evt, button_callback_param_t parm) {
     screen++;
-    if (screen > MAX_DISPLAY_MODE) screen = 0;
+    if (screen >= display_screen_count()) screen = 0;
 
     display_handle_t handle = parm;
     show_display(handle, screen);
 }
 
+// Hundreds of lines of serial output, too much stack and time for
+// button_worker.  Runs below everything else, the board carries on while
+// it prints.
+#define DUMP_STACK 3072
+static TaskHandle_t dump_task;
+
+// Raw button edges from boot, for host/tools/button-bench.  Printed and
+// started over by the diagnostics chord.  0 leaves capture out.
+#ifndef BUTTON_TRACE_CAPTURE_SIZE
+#define BUTTON_TRACE_CAPTURE_SIZE 4096
+#endif
+
+#if BUTTON_TRACE_CAPTURE_SIZE
+static uint8_t button_trace_buf[BUTTON_TRACE_CAPTURE_SIZE];
+static button_trace_writer_t button_trace;
+
+static void start_button_trace(buttons_handle_t buttons) {
+    button_trace_writer_init(&button_trace, button_trace_buf,
+                             sizeof(button_trace_buf));
+    button_set_trace(buttons, &button_trace);
+}
+#endif
+
+void dump_worker(void *param) {
+    buttons_handle_t buttons = param;
+    (void)buttons;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        diag_dump();
+        power_dump();
+        wifi_dump();
+        tracer_dump();
+#if BUTTON_TRACE_CAPTURE_SIZE
+        button_set_trace(buttons, NULL);
+        button_trace_dump(&button_trace);
+        start_button_trace(buttons);
+#endif
+    }
+}
+
+void setup_dump(worker_data_t *wdata) {
+    static const char *dump_tag = "dump_worker";
+    BaseType_t ret = xTaskCreate(&dump_worker, dump_tag, DUMP_STACK,
+                                 wdata->button_data, 1, &dump_task);
+    if (ret != pdTRUE) {
+        ESP_LOGE(dump_tag, "Failed to create the dump_task");
+        vTaskDelay(portMAX_DELAY);
+    }
+    diag_register_task(dump_task, dump_tag, DUMP_STACK);
+
+#if BUTTON_TRACE_CAPTURE_SIZE
+    start_button_trace(wdata->button_data);
+#endif
+}
+
+// Both buttons held: memory and stack figures, power state residency, the
+// event trace and the button edge trace, to the serial console
+void diag_evt(int64_t etime, event_t evt, button_callback_param_t parm) {
+    xTaskNotifyGive(dump_task);
+}
+
+void button_activity(int64_t etime, void *param) {
+    power_activity();
+}
+
+// Light sleep drops the Wi-Fi connection, task-wifi reconnects afterwards.
+// min_freq_mhz of 80 keeps APB, and with it the panel's SPI clock and the
+// backlight PWM, where they were set up.
+void setup_power(worker_data_t *wdata) {
+    power_config_t power = {.dim_after = 15 * 1000000LL,
+                            .off_after = 30 * 1000000LL,
+                            .sleep_after = 60 * 1000000LL,
+                            .dim_percent = 20,
+                            .min_freq_mhz = 80,
+                            .wake_pins = {{.gpio_num = BUTTON1,
+                                           .active_level = 0},
+                                          {.gpio_num = BUTTON2,
+                                           .active_level = 0}},
+                            .wake_pin_cnt = 2};
+
+    power_init(&power);
+    button_set_activity_cb(wdata->button_data, button_activity, NULL);
+}
+
 void setup_buttons(worker_data_t *wdata) {
     button_spec_t button1 = {.active_level = LOW,
                              .gpio_num = BUTTON1,
-                             .pull_mode = GPIO_FLOATING};
+                             .pull_mode = GPIO_FLOATING,
+                             .debounce_time = 20000,
+                             .samples = 3};
 
     int b1 = setup_button_gpio(wdata->button_data, &button1);
 
     button_spec_t button2 = {.active_level = LOW,
                              .gpio_num = BUTTON2,
-                             .pull_mode = GPIO_FLOATING};
+                             .pull_mode = GPIO_FLOATING,
+                             .debounce_time = 20000,
+                             .samples = 3};
     
     int b2 = setup_button_gpio(wdata->button_data, &button2);
 
-    button_callback_t cb1 = {.button_mask = 1 << b1,
-                             .ignore_mask = 1 << b2,
+    button_callback_t cb1 = {.button_mask = 1ULL << b1,
+                             .ignore_mask = 1ULL << b2,
                              .min_time = 100000,
                              .max_time = 2000000,
                              .release_cb = button1_evt,
@@ -96,19 +189,27 @@ void setup_buttons(worker_data_t *wdata) {
 
     attach_callback(wdata->button_data, &cb1);
 
-    button_callback_t cb2 = {.button_mask = 1 << b2,
-                             .ignore_mask = 1 << b1,
+    button_callback_t cb2 = {.button_mask = 1ULL << b2,
+                             .ignore_mask = 1ULL << b1,
                              .min_time = 100000,
                              .max_time = 2000000,
                              .release_cb = button2_evt,
                              .release_param = wdata->disp_data};
     
     attach_callback(wdata->button_data, &cb2);
+
+    button_callback_t cb3 = {.button_mask = (1ULL << b1) | (1ULL << b2),
+                             .min_time = 2000000,
+                             .press_cb = diag_evt};
+
+    attach_callback(wdata->button_data, &cb3);
 }
 
 void app_main(void) {
     static const char *tag = "main";
     ESP_LOGI(tag, "Main start");
+    tracer_start();
+    dlog_init();
 
     ESP_LOGI(tag, "Allocating objects");
     worker_data_t *wdata = alloc_data();
@@ -117,12 +218,16 @@ void app_main(void) {
     setup_interrupts(wdata->button_data);
 
     ESP_LOGI(tag, "Enabling Buttons");
+    setup_dump(wdata);
     setup_buttons(wdata);
 
+    ESP_LOGI(tag, "Starting the power governor");
+    setup_power(wdata);
+
     while(1) {
-        ESP_LOGI(tag, "Looping forever.");
+        DLOGI(main, "Looping forever.");
         vTaskDelay(portMAX_DELAY);
-        ESP_LOGI(tag, "Forever timed out");
+        DLOGI(main, "Forever timed out");
     }
 
     free(wdata);